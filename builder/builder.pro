@@ -19,8 +19,9 @@ isEqual(QT_MAJOR_VERSION, 5) {
 
 DESTDIR = ../bin
 
-QMAKE_LIBDIR += $${UPDATER_LIBDIR} $${OPENRPT_LIBDIR} $${XTUPLE_LIBDIR}
+QMAKE_LIBDIR += $${UPDATER_LIBDIR} $${OPENRPT_LIBDIR} $${XTUPLE_LIBDIR} $${PGSQL_LIBDIR}
 LIBS += -lxtuplecommon -lupdatercommon -lopenrptcommon -lrenderer -lMetaSQL
+LIBS += $${PGSQL_LIBS}
 win32-msvc* {
   PRE_TARGETDEPS += $${UPDATER_LIBDIR}/updatercommon.lib          \
                     $${OPENRPT_LIBDIR}/MetaSQL.$${OPENRPTLIBEXT}       \
@@ -35,6 +35,7 @@ HEADERS = data.h \
           initscript.h \
           script.h \
           loadable.h \
+          loadablepreparer.h \
           loadappscript.h \
           loadappui.h \
           loadcmd.h \
@@ -42,11 +43,18 @@ HEADERS = data.h \
           loadmetasql.h \
           loadpriv.h \
           loadreport.h \
+          pgconnection.h \
           pkgschema.h \
           prerequisite.h \
+          scriptschedule.h \
+          servercapabilities.h \
+          sqlarray.h \
+          sqlsplitter.h \
+          updaterledger.h \
           xabstractmessagehandler.h    \
           cmdlinemessagehandler.h      \
           guimessagehandler.h          \
+          xuuencode.h                  \
           xversion.h
 
 SOURCES = data.cpp \
@@ -60,6 +68,7 @@ SOURCES = data.cpp \
           initscript.cpp \
           script.cpp \
           loadable.cpp \
+          loadablepreparer.cpp \
           loadappscript.cpp \
           loadappui.cpp \
           loadcmd.cpp \
@@ -67,9 +76,16 @@ SOURCES = data.cpp \
           loadmetasql.cpp \
           loadpriv.cpp \
           loadreport.cpp \
+          pgconnection.cpp \
           pkgschema.cpp \
           prerequisite.cpp \
+          scriptschedule.cpp \
+          servercapabilities.cpp \
+          sqlarray.cpp \
+          sqlsplitter.cpp \
+          updaterledger.cpp \
           xabstractmessagehandler.cpp  \
           cmdlinemessagehandler.cpp    \
           guimessagehandler.cpp        \
+          xuuencode.cpp                \
           xversion.cpp
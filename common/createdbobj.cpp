@@ -17,11 +17,15 @@
 #include <QVariant>
 
 #include "metasql.h"
+#include "sqlarray.h"
 #include "xsqlquery.h"
 
 #define DEBUG false
 
 CreateDBObj::CreateDBObj()
+  : _deferVerify(false),
+    _oidMql(0),
+    _unchanged(false)
 {
 }
 
@@ -30,17 +34,22 @@ CreateDBObj::CreateDBObj(const QString &nodename, const QString &filename,
                          const QString &schema,   OnError onError)
 {
   _comment  = comment;
+  _deferVerify = false;
   _filename = filename;
   _name     = name;
   _nodename = nodename;
   _oidMql   = 0;
   _schema   = schema;
   _onError  = onError;
+  _unchanged = false;
 }
 
 CreateDBObj::CreateDBObj(const QDomElement & elem, QStringList &msg, QList<bool> &fatal)
 {
+  _deferVerify = false;
   _nodename = elem.nodeName();
+  _oidMql   = 0;
+  _unchanged = false;
 
   if (elem.hasAttribute("name"))
     _name = elem.attribute("name");
@@ -91,27 +100,33 @@ QDomElement CreateDBObj::createElement(QDomDocument & doc)
   return elem;
 }
 
+QString CreateDBObj::destSchema(const QString &pkgname) const
+{
+  if (! _schema.isEmpty())
+    return _schema;
+  else if (pkgname.isEmpty())
+    return "public";
+
+  return pkgname;
+}
+
 int CreateDBObj::writeToDB(const QByteArray &pdata, const QString pkgname, ParameterList &params, QString &errMsg)
 {
   if (DEBUG)
     qDebug("CreateDBObj::writeToDB(%s, %s, &errMsg)",
            pdata.data(), qPrintable(pkgname));
 
-  QString destschema;
-  if (! _schema.isEmpty())
-    destschema = _schema;
-  else if (pkgname.isEmpty())
-    destschema = "public";
-  else if (! pkgname.isEmpty())
-    destschema = pkgname;
-
   params.append("name", _name);
-  params.append("schema", destschema);
+  params.append("schema", destSchema(pkgname));
 
-  int returnVal = Script::writeToDB(pdata, pkgname, params, errMsg);
+  int returnVal = _unchanged ? 0
+                             : Script::writeToDB(pdata, pkgname, params, errMsg);
   if (returnVal < 0)
     return returnVal;
 
+  if (_deferVerify)
+    return returnVal;
+
   XSqlQuery oidq = _oidMql->toQuery(params);
   if (oidq.first())
     ; // passed error check
@@ -124,11 +139,105 @@ int CreateDBObj::writeToDB(const QByteArray &pdata, const QString pkgname, Param
   }
   else // not found
   {
-    errMsg = TR("Could not find %1 in the database. The "
-                "script %2 does not match the package.xml description.")
-            .arg(_name).arg(_filename);
+    errMsg = notFoundMessage(pkgname);
     return -8;
   }
 
   return returnVal;
 }
+
+QString CreateDBObj::notFoundMessage(const QString &pkgname) const
+{
+  Q_UNUSED(pkgname);
+  return TR("Could not find %1 in the database. The "
+            "script %2 does not match the package.xml description.")
+          .arg(_name).arg(_filename);
+}
+
+/** Check that every object in objs exists in the database with a single
+    catalog query. This replaces the per-object lookup in writeToDB for
+    objects with deferVerify() set, so a phase full of tables or functions
+    costs one round trip to verify instead of one or two per script.
+
+    The objects that were not found are appended to missing, in the order
+    they appear in objs.
+
+    @return 0 on success, even if some objects are missing, or -7 if the
+            catalog query failed, in which case errMsg describes the error
+*/
+int CreateDBObj::verifyAll(const QList<CreateDBObj*> &objs, const QString pkgname,
+                           QList<CreateDBObj*> &missing, QString &errMsg)
+{
+  if (DEBUG)
+    qDebug("CreateDBObj::verifyAll(%d objects, %s)",
+           objs.size(), qPrintable(pkgname));
+
+  if (objs.isEmpty())
+    return 0;
+
+  QStringList types;
+  QStringList names;
+  QStringList schemas;
+  QStringList relkinds;
+  foreach (CreateDBObj *obj, objs)
+  {
+    types.append(obj->pkgitemtype());
+    names.append(obj->name());
+    schemas.append(obj->destSchema(pkgname));
+    relkinds.append(obj->relkind());
+  }
+
+  XSqlQuery oidq;
+  oidq.prepare("SELECT a.i"
+               "  FROM " +
+               sqlArrayRows(QStringList() << "types TEXT[]"
+                                          << "names TEXT[]"
+                                          << "schemas TEXT[]"
+                                          << "relkinds TEXT[]") +
+               " WHERE NOT CASE a.types[a.i]"
+               "        WHEN 'F' THEN EXISTS(SELECT 1"
+               "                               FROM pg_proc"
+               "                               JOIN pg_namespace ON (pronamespace=pg_namespace.oid)"
+               "                              WHERE proname=a.names[a.i]"
+               "                                AND nspname=a.schemas[a.i])"
+               "        WHEN 'G' THEN EXISTS(SELECT 1"
+               "                               FROM pg_trigger"
+               "                               JOIN pg_class     ON (tgrelid=pg_class.oid)"
+               "                               JOIN pg_namespace ON (relnamespace=pg_namespace.oid)"
+               "                              WHERE tgname=a.names[a.i]"
+               "                                AND nspname=a.schemas[a.i])"
+               "        WHEN 'V' THEN EXISTS(SELECT 1"
+               "                               FROM pg_class"
+               "                               JOIN pg_namespace ON (relnamespace=pg_namespace.oid)"
+               "                              WHERE relname=a.names[a.i]"
+               "                                AND relkind IN ('v', 'm')"
+               "                                AND nspname=a.schemas[a.i])"
+               "        ELSE          EXISTS(SELECT 1"
+               "                               FROM pg_class"
+               "                               JOIN pg_namespace ON (relnamespace=pg_namespace.oid)"
+               "                              WHERE relname=a.names[a.i]"
+               "                                AND CAST(relkind AS TEXT)=a.relkinds[a.i]"
+               "                                AND nspname=a.schemas[a.i])"
+               "       END"
+               " ORDER BY a.i;");
+  oidq.bindValue(":types",    toSqlArray(types));
+  oidq.bindValue(":names",    toSqlArray(names));
+  oidq.bindValue(":schemas",  toSqlArray(schemas));
+  oidq.bindValue(":relkinds", toSqlArray(relkinds));
+  oidq.exec();
+  while (oidq.next())
+  {
+    int i = oidq.value(0).toInt() - 1;
+    if (i >= 0 && i < objs.size())
+      missing.append(objs.at(i));
+  }
+  if (oidq.lastError().type() != QSqlError::NoError)
+  {
+    errMsg = _sqlerrtxt.arg(objs.first()->filename())
+                       .arg(oidq.lastError().databaseText())
+                       .arg(oidq.lastError().driverText());
+    return -7;
+  }
+
+  return 0;
+}
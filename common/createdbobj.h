@@ -11,6 +11,7 @@
 #ifndef __CREATEDBOBJ_H__
 #define __CREATEDBOBJ_H__
 
+#include <QList>
 #include <QString>
 
 #include "script.h"
@@ -39,13 +40,27 @@ class CreateDBObj : public Script
     virtual bool    isValid()  const { return !_nodename.isEmpty() &&
                                               !_name.isEmpty() &&
                                               !_filename.isEmpty(); }
+    virtual QString nodename()    const { return _nodename; }
+    virtual QString pkgitemtype() const { return _pkgitemtype; }
+    virtual QString schema()      const { return _schema; }
+    virtual QString destSchema(const QString &pkgname) const;
+    virtual bool    deferVerify() const { return _deferVerify; }
+    virtual void    setDeferVerify(bool p) { _deferVerify = p; }
+    virtual bool    isUnchanged() const { return _unchanged; }
+    virtual QString relkind()     const { return QString(); }
+    virtual QString notFoundMessage(const QString &pkgname) const;
+
+    static int verifyAll(const QList<CreateDBObj*> &objs, const QString pkgname,
+                         QList<CreateDBObj*> &missing, QString &errMsg);
 
   protected:
+    bool          _deferVerify;
     QString       _filename;
     QString       _nodename;
     MetaSQLQuery *_oidMql;
     QString       _pkgitemtype;
     QString       _schema;
+    bool          _unchanged;   // the database already matches the script
 
     CreateDBObj();
     virtual int writeToDB(const QByteArray &pdata, const QString pkgname, ParameterList &params, QString &errMsg);
@@ -15,10 +15,20 @@
 #include <QSqlError>
 #include <QVariant>     // used by XSqlQuery::bindValue()
 
+#include "pgconnection.h"
+#include "servercapabilities.h"
+#include "sqlarray.h"
+#include "sqlsplitter.h"
 #include "xsqlquery.h"
 
 #define DEBUG false
 
+// a digest of the functions in pg_proc l, for noticing that one
+// has been dropped or replaced
+#define DEFINITIONDIGEST \
+  "md5(array_to_string(array_agg(CAST(l.oid AS TEXT) || ' ' ||" \
+  "                              pg_get_functiondef(l.oid) ORDER BY l.oid), ' '))"
+
 CreateFunction::CreateFunction(const QString &filename, 
                                const QString &name, const QString &comment,
                                const QString &schema, const OnError onError)
@@ -47,13 +57,26 @@ int CreateFunction::writeToDB(const QByteArray &pdata, const QString pkgname,
     qDebug("CreateFunction::writeToDb(%s, %s, &errMsg)",
            pdata.data(), qPrintable(pkgname));
 
-  QString destschema;
-  if (! _schema.isEmpty())
-    destschema = _schema;
-  else if (pkgname.isEmpty())
-    destschema = "public";
-  else if (! pkgname.isEmpty())
-    destschema = pkgname;
+  // an earlier script may have dropped or replaced the function since
+  // findUnchanged() looked at it
+  if (_unchanged)
+  {
+    XSqlQuery defq;
+    defq.prepare("SELECT " DEFINITIONDIGEST " AS definition"
+                 "  FROM pg_proc l"
+                 " WHERE l.oid = ANY(CAST(:oids AS OID[]));");
+    defq.bindValue(":oids", _oids);
+    defq.exec();
+    if (! defq.first() || defq.value("definition").toString() != _definition)
+      _unchanged = false;
+  }
+
+  if (_deferVerify && _unchanged)
+    return 0;
+  else if (_deferVerify)
+    return Script::writeToDB(pdata, pkgname, params, errMsg);
+
+  QString destschema = destSchema(pkgname);
 
   XSqlQuery oidq;
   QMap<QString,int> oldoids;
@@ -88,7 +111,8 @@ int CreateFunction::writeToDB(const QByteArray &pdata, const QString pkgname,
     }
   }
 
-  int returnVal = Script::writeToDB(pdata, pkgname, params, errMsg);
+  int returnVal = _unchanged ? 0
+                             : Script::writeToDB(pdata, pkgname, params, errMsg);
   if (returnVal < 0)
     return returnVal;
 
@@ -111,11 +135,245 @@ int CreateFunction::writeToDB(const QByteArray &pdata, const QString pkgname,
   }
   if (count == 0)
   {
-    errMsg = TR("Could not find function %1 in the database for package %2. "
-                "The script %3 does not match the package.xml description.")
-              .arg(_name).arg(pkgname).arg(_filename);
+    errMsg = notFoundMessage(pkgname);
     return -6;
   }
 
   return 0;
 }
+
+QString CreateFunction::notFoundMessage(const QString &pkgname) const
+{
+  return TR("Could not find function %1 in the database for package %2. "
+            "The script %3 does not match the package.xml description.")
+          .arg(_name).arg(pkgname).arg(_filename);
+}
+
+/** Rewrite a createfunction script to define its functions in the
+    session's temporary schema. Only scripts made of nothing but CREATE
+    OR REPLACE FUNCTION statements are rewritten, since skipping anything
+    else could change the outcome of the upgrade.
+
+    @param data    the script
+    @param names   gets the name of each function the script defines
+    @param schemas gets the schema of each function, or a null string if
+                   the name is not qualified
+    @return the rewritten statements or an empty list if the script
+            cannot be rewritten
+*/
+QList<QByteArray> CreateFunction::tempDefinitions(const QByteArray &data,
+                                                  QStringList &names,
+                                                  QStringList &schemas)
+{
+  QList<QByteArray> result;
+  SqlSplitter splitter(data);
+  while (! splitter.atEnd())
+  {
+    QByteArray stmt = splitter.next();
+    if (splitter.isBlank())
+      continue;
+
+    int pos = 0;
+    if (SqlSplitter::nextWord(stmt, pos) != "create" ||
+        SqlSplitter::nextWord(stmt, pos) != "or"     ||
+        SqlSplitter::nextWord(stmt, pos) != "replace" ||
+        SqlSplitter::nextWord(stmt, pos) != "function")
+      return QList<QByteArray>();
+
+    int        nameStart;
+    QByteArray first   = SqlSplitter::nextWord(stmt, pos, &nameStart);
+    QByteArray name    = first;
+    QString    schema;
+    int        nameEnd = pos;
+    QByteArray punct   = SqlSplitter::nextWord(stmt, pos);
+    if (punct == ".")
+    {
+      schema  = SqlSplitter::identifier(first);
+      name    = SqlSplitter::nextWord(stmt, pos, &nameStart);
+      nameEnd = pos;
+      punct   = SqlSplitter::nextWord(stmt, pos);
+    }
+    if (! SqlSplitter::isIdentifier(name) || punct != "(")
+      return QList<QByteArray>();
+
+    names.append(SqlSplitter::identifier(name));
+    schemas.append(schema);
+    result.append("CREATE FUNCTION pg_temp." +
+                  stmt.mid(nameStart, nameEnd - nameStart) +
+                  stmt.mid(nameEnd));
+  }
+
+  return result;
+}
+
+/** Find the functions whose definitions in the package match the
+    database exactly, so writeToDB() can leave them alone. Replacing a
+    function that has not changed still invalidates every session's
+    cached plans and takes locks.
+
+    Each candidate script is run with its functions moved to the
+    session's temporary schema, letting the server parse and normalise the
+    definitions, and one query then compares every one of them with the
+    function of the same name and argument types in the live catalog.
+    Everything is rolled back afterwards. A script that cannot be run
+    this way is treated as changed.
+
+    @return the number of unchanged scripts or a negative number on error
+*/
+int CreateFunction::findUnchanged(const QList<Script*> &functions,
+                                  const QList<QByteArray> &data,
+                                  QString &errMsg)
+{
+  if (! PgConnection::inTransaction())
+    return 0;
+
+  QList<CreateFunction*>    candidates;
+  QList<QList<QByteArray> > definitions;
+  QList<int>                owners;
+  QStringList               names;
+  QStringList               schemas;
+  for (int i = 0; i < functions.size() && i < data.size(); i++)
+  {
+    CreateFunction *fn = dynamic_cast<CreateFunction*>(functions.at(i));
+    if (! fn)
+      continue;
+    fn->_unchanged = false;
+    fn->_definition.clear();
+    fn->_oids.clear();
+
+    QStringList fnnames;
+    QStringList fnschemas;
+    QList<QByteArray> temp = tempDefinitions(toClientEncoding(data.at(i)),
+                                             fnnames, fnschemas);
+    if (temp.isEmpty())
+      continue;
+
+    candidates.append(fn);
+    definitions.append(temp);
+    for (int j = 0; j < fnnames.size(); j++)
+    {
+      owners.append(candidates.size());
+      names.append(fnnames.at(j));
+      schemas.append(fnschemas.at(j));
+    }
+  }
+  if (candidates.isEmpty())
+    return 0;
+
+  XSqlQuery savepoint("SAVEPOINT updaterFunctions;");
+  savepoint.exec("SET LOCAL check_function_bodies TO false;");
+
+  QList<int> defined;
+  for (int i = 0; i < candidates.size(); i++)
+  {
+    QString   execErr;
+    bool      ok = true;
+    XSqlQuery fnsavepoint("SAVEPOINT updaterFunction;");
+    foreach (QByteArray stmt, definitions.at(i))
+    {
+      if (! (ok = (PgConnection::exec(stmt, QByteArray(), execErr) >= 0)))
+        break;
+    }
+    if (! ok)
+    {
+      if (DEBUG)
+        qDebug("CreateFunction::findUnchanged() %s cannot be compared: %s",
+               qPrintable(candidates.at(i)->filename()), qPrintable(execErr));
+      fnsavepoint.exec("ROLLBACK TO updaterFunction;");
+    }
+    else
+      defined.append(i + 1);
+    fnsavepoint.exec("RELEASE SAVEPOINT updaterFunction;");
+  }
+
+  // proleakproof appeared in 9.2 and proparallel in 9.6
+  int version = ServerCapabilities::serverVersion();
+  if (version <= 0)
+  {
+    XSqlQuery versionq("SHOW server_version_num;");
+    if (versionq.first())
+      version = versionq.value(0).toInt();
+  }
+  QString newer;
+  if (version >= 90200)
+    newer += "    AND l.proleakproof=t.proleakproof";
+  if (version >= 90600)
+    newer += "    AND l.proparallel=t.proparallel";
+
+  XSqlQuery compareq;
+  compareq.prepare(QString("SELECT a.owners[a.i] AS owner,"
+                   "       bool_and(l.oid IS NOT NULL) AS unchanged,"
+                   "       CAST(array_agg(l.oid) AS TEXT) AS oids,"
+                   "       " DEFINITIONDIGEST " AS definition"
+                   "  FROM " +
+                   sqlArrayRows(QStringList() << "owners INTEGER[]"
+                                              << "names TEXT[]"
+                                              << "schemas TEXT[]"
+                                              << "defined INTEGER[]") +
+                   "  JOIN pg_proc t ON (t.pronamespace=pg_my_temp_schema()"
+                   "                 AND t.proname=a.names[a.i])"
+                   "  LEFT OUTER JOIN pg_proc l"
+                   "    ON (l.pronamespace=(SELECT oid FROM pg_namespace"
+                   "                         WHERE nspname=COALESCE(a.schemas[a.i],"
+                   "                                                current_schema()))"
+                   "    AND l.proname=t.proname"
+                   "    AND l.proargtypes=t.proargtypes"
+                   "    AND l.prorettype=t.prorettype"
+                   "    AND l.proretset=t.proretset"
+                   "    AND l.prolang=t.prolang"
+                   "    AND l.prosrc=t.prosrc"
+                   "    AND l.probin IS NOT DISTINCT FROM t.probin"
+                   "    AND l.provolatile=t.provolatile"
+                   "    AND l.proisstrict=t.proisstrict"
+                   "    AND l.prosecdef=t.prosecdef"
+                   "%1"
+                   "    AND l.procost=t.procost"
+                   "    AND l.prorows=t.prorows"
+                   "    AND l.proallargtypes IS NOT DISTINCT FROM t.proallargtypes"
+                   "    AND l.proargmodes    IS NOT DISTINCT FROM t.proargmodes"
+                   "    AND l.proargnames    IS NOT DISTINCT FROM t.proargnames"
+                   "    AND l.proconfig      IS NOT DISTINCT FROM t.proconfig"
+                   "    AND pg_get_expr(l.proargdefaults, 0) IS NOT DISTINCT FROM"
+                   "        pg_get_expr(t.proargdefaults, 0))"
+                   " WHERE a.owners[a.i] = ANY(a.defined)"
+                   " GROUP BY a.owners[a.i];").arg(newer));
+  compareq.bindValue(":owners",  toSqlArray(owners));
+  compareq.bindValue(":names",   toSqlArray(names));
+  compareq.bindValue(":schemas", toSqlArray(schemas));
+  compareq.bindValue(":defined", toSqlArray(defined));
+  compareq.exec();
+
+  int unchanged = 0;
+  while (compareq.next())
+  {
+    int owner = compareq.value("owner").toInt() - 1;
+    if (compareq.value("unchanged").toBool() && owner >= 0 &&
+        owner < candidates.size())
+    {
+      candidates.at(owner)->_unchanged  = true;
+      candidates.at(owner)->_definition = compareq.value("definition").toString();
+      candidates.at(owner)->_oids       = compareq.value("oids").toString();
+      unchanged++;
+    }
+  }
+
+  int result = unchanged;
+  if (compareq.lastError().type() != QSqlError::NoError)
+  {
+    errMsg = _sqlerrtxt.arg(candidates.first()->filename())
+                       .arg(compareq.lastError().databaseText())
+                       .arg(compareq.lastError().driverText());
+    foreach (CreateFunction *fn, candidates)
+      fn->_unchanged = false;
+    result = -1;
+  }
+
+  savepoint.exec("ROLLBACK TO updaterFunctions;");
+  savepoint.exec("RELEASE SAVEPOINT updaterFunctions;");
+
+  if (DEBUG)
+    qDebug("CreateFunction::findUnchanged() %d of %d scripts are unchanged",
+           unchanged, functions.size());
+
+  return result;
+}
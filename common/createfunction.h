@@ -22,9 +22,19 @@ class CreateFunction : public CreateDBObj
                    const OnError onError = Default);
     CreateFunction(const QDomElement &, QStringList &, QList<bool> &);
 
+    virtual QString notFoundMessage(const QString &pkgname) const;
     virtual int writeToDB(const QByteArray &, const QString pkgname, ParameterList &params, QString &errMsg);
 
+    static int findUnchanged(const QList<Script*> &functions,
+                             const QList<QByteArray> &data, QString &errMsg);
+
   protected:
+    QString _definition;  // a digest of the functions findUnchanged() saw
+    QString _oids;        // and their oids, as an array literal
+
+    static QList<QByteArray> tempDefinitions(const QByteArray &data,
+                                             QStringList &names,
+                                             QStringList &schemas);
 };
 
 #endif
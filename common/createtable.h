@@ -22,6 +22,7 @@ class CreateTable : public CreateDBObj
                 const OnError onError = Default);
     CreateTable(const QDomElement &, QStringList &, QList<bool> &);
 
+    virtual QString relkind() const { return _relkind; }
     virtual int writeToDB(const QByteArray &pdata, const QString pkgname, ParameterList &params, QString &errMsg);
 
   protected:
@@ -11,11 +11,15 @@
 #include "createview.h"
 
 #include <QDomDocument>
+#include <QHash>
 #include <QMessageBox>
 #include <QSqlError>
 #include <QVariant>     // used by XSqlQuery::bindValue()
 
 #include "metasql.h"
+#include "pgconnection.h"
+#include "sqlarray.h"
+#include "sqlsplitter.h"
 #include "xsqlquery.h"
 
 #define DEBUG false
@@ -48,6 +52,37 @@ int CreateView::writeToDB(const QByteArray &pdata, const QString pkgname,
     qDebug("CreateView::writeToDb(%s, %s, &errMsg)",
            pdata.data(), qPrintable(pkgname));
 
+  // an earlier script may have dropped or replaced the view since
+  // findUnchanged() looked at it
+  if (_unchanged)
+  {
+    XSqlQuery defq;
+    defq.prepare("SELECT pg_get_viewdef(pg_class.oid) AS viewdef"
+                 "  FROM pg_class"
+                 "  JOIN pg_namespace ON (relnamespace=pg_namespace.oid)"
+                 " WHERE relname=:name AND nspname=:schema AND relkind='v';");
+    defq.bindValue(":name",   _name);
+    defq.bindValue(":schema", destSchema(pkgname));
+    defq.exec();
+    if (! defq.first() || defq.value("viewdef").toString() != _viewdef)
+      _unchanged = false;
+  }
+
+  if (_unchanged)
+  {
+    QByteArray tempCreate;
+    QByteArray grants;
+    QString    name;
+    QString    schema;
+    if (splitScript(pdata, tempCreate, name, schema, grants) &&
+        ! grants.isEmpty())
+    {
+      int returnVal = Script::writeToDB(grants, pkgname, params, errMsg);
+      if (returnVal < 0)
+        return returnVal;
+    }
+  }
+
   _oidMql = new MetaSQLQuery("SELECT pg_class.oid AS oid "
                              "FROM pg_class, pg_namespace "
                              "WHERE ((relname=<? value('name') ?>)"
@@ -62,3 +97,340 @@ int CreateView::writeToDB(const QByteArray &pdata, const QString pkgname,
 
   return returnVal;
 }
+
+// read a string literal made of a single word, as dropIfExists() is given
+static bool readLiteral(const QByteArray &stmt, int &pos, QString &value)
+{
+  if (SqlSplitter::nextWord(stmt, pos) != "'")
+    return false;
+  int end = stmt.indexOf('\'', pos);
+  if (end < 0 || stmt.mid(end, 2) == "''")
+    return false;
+  value = QString::fromUtf8(stmt.mid(pos, end - pos));
+  pos   = end + 1;
+  return ! value.isEmpty() && SqlSplitter::isIdentifier(value.toUtf8());
+}
+
+/** Pick apart a createview script made of the usual statements: drop the
+    view, create it, and set its privileges and comment. Anything else,
+    including dropping some other view, might matter even when the view
+    has not changed, so such scripts are always run in full.
+
+    @param data       the script
+    @param tempCreate gets the CREATE VIEW statement rewritten to create
+                      the view in the session's temporary schema
+    @param name       gets the name of the view
+    @param schema     gets the schema of the view or a null string if the
+                      name is not qualified
+    @param grants     gets the GRANT, REVOKE and COMMENT statements
+    @return true if the script has this shape
+*/
+bool CreateView::splitScript(const QByteArray &data, QByteArray &tempCreate,
+                             QString &name, QString &schema, QByteArray &grants)
+{
+  tempCreate.clear();
+  grants.clear();
+  QStringList dropped;          // schema and name of each view dropped
+
+  SqlSplitter splitter(data);
+  while (! splitter.atEnd())
+  {
+    QByteArray stmt = splitter.next();
+    if (splitter.isBlank())
+      continue;
+
+    int        pos   = 0;
+    QByteArray first = SqlSplitter::nextWord(stmt, pos);
+    if (first == "grant" || first == "revoke" || first == "comment")
+      grants += stmt + "\n";
+    else if (first == "drop")
+    {
+      if (SqlSplitter::nextWord(stmt, pos) != "view")
+        return false;
+      QByteArray word = SqlSplitter::nextWord(stmt, pos);
+      if (word == "if")
+      {
+        if (SqlSplitter::nextWord(stmt, pos) != "exists")
+          return false;
+        word = SqlSplitter::nextWord(stmt, pos);
+      }
+      QString dropschema;
+      QString dropname = SqlSplitter::identifier(word);
+      if (! SqlSplitter::isIdentifier(word))
+        return false;
+      word = SqlSplitter::nextWord(stmt, pos);
+      if (word == ".")
+      {
+        dropschema = dropname;
+        word       = SqlSplitter::nextWord(stmt, pos);
+        dropname   = SqlSplitter::identifier(word);
+        if (! SqlSplitter::isIdentifier(word))
+          return false;
+        word = SqlSplitter::nextWord(stmt, pos);
+      }
+      if (word == "cascade" || word == "restrict")
+        word = SqlSplitter::nextWord(stmt, pos);
+      if (word != ";" && ! word.isEmpty())
+        return false;
+      dropped.append(dropschema + "." + dropname);
+    }
+    else if (first == "select")
+    {
+      // dropIfExists('VIEW', name [, schema [, cascade]]), schema public
+      QString type;
+      QString dropname;
+      QString dropschema("public");
+      if (SqlSplitter::nextWord(stmt, pos) != "dropifexists" ||
+          SqlSplitter::nextWord(stmt, pos) != "("            ||
+          ! readLiteral(stmt, pos, type) || type.toLower() != "view" ||
+          SqlSplitter::nextWord(stmt, pos) != ","            ||
+          ! readLiteral(stmt, pos, dropname))
+        return false;
+      int next = pos;
+      if (SqlSplitter::nextWord(stmt, next) == "," &&
+          ! readLiteral(stmt, next, dropschema))
+        return false;
+      dropped.append(dropschema + "." + dropname);
+    }
+    else if (first == "create" && tempCreate.isEmpty())
+    {
+      QByteArray word = SqlSplitter::nextWord(stmt, pos);
+      if (word == "or" && SqlSplitter::nextWord(stmt, pos) == "replace")
+        word = SqlSplitter::nextWord(stmt, pos);
+      if (word != "view")
+        return false;
+
+      int        nameStart;
+      QByteArray qualifier   = SqlSplitter::nextWord(stmt, pos, &nameStart);
+      QByteArray viewname = qualifier;
+      int        nameEnd  = pos;
+      schema = QString();
+      if (SqlSplitter::nextWord(stmt, pos) == ".")
+      {
+        schema   = SqlSplitter::identifier(qualifier);
+        viewname = SqlSplitter::nextWord(stmt, pos, &nameStart);
+        nameEnd = pos;
+      }
+      if (! SqlSplitter::isIdentifier(viewname))
+        return false;
+
+      name       = SqlSplitter::identifier(viewname);
+      tempCreate = "CREATE VIEW pg_temp." +
+                   stmt.mid(nameStart, nameEnd - nameStart) +
+                   stmt.mid(nameEnd);
+    }
+    else
+      return false;
+  }
+
+  if (tempCreate.isEmpty())
+    return false;
+
+  foreach (QString view, dropped)
+  {
+    if (view != schema + "." + name)
+      return false;
+  }
+
+  return true;
+}
+
+/** Find the views whose definitions in the package match the database,
+    so writeToDB() can leave them in place. A createview script usually
+    drops its view with CASCADE, taking every dependent view with it and
+    holding locks on the underlying tables until the whole tree has been
+    rebuilt, so recreating only what changed saves a lot of work.
+
+    Each candidate view is created in the session's temporary schema and
+    one query compares the server's rendering of it with the live view.
+    A view that has not changed must still be recreated if it depends on
+    one that has, so the views that depend on the changed ones are then
+    found with a recursive walk through pg_depend and pg_rewrite.
+    Everything is rolled back afterwards.
+
+    @param dependents gets the schema-qualified names of views outside the
+                      package that depend on the views being replaced
+    @return the number of unchanged views or a negative number on error
+*/
+int CreateView::findUnchanged(const QList<Script*> &views,
+                              const QList<QByteArray> &data,
+                              const QString &pkgname, QStringList &dependents,
+                              QString &errMsg)
+{
+  if (! PgConnection::inTransaction())
+    return 0;
+
+  QList<CreateView*> all;
+  QList<CreateView*> candidates;
+  QList<QByteArray>  definitions;
+  QStringList        names;
+  QStringList        schemas;
+  for (int i = 0; i < views.size() && i < data.size(); i++)
+  {
+    CreateView *view = dynamic_cast<CreateView*>(views.at(i));
+    if (! view)
+      continue;
+    view->_unchanged = false;
+    view->_viewdef.clear();
+    all.append(view);
+
+    QByteArray tempCreate;
+    QByteArray grants;
+    QString    name;
+    QString    schema;
+    if (splitScript(data.at(i), tempCreate, name, schema, grants))
+    {
+      candidates.append(view);
+      definitions.append(tempCreate);
+      names.append(name);
+      schemas.append(schema);
+    }
+  }
+  if (candidates.isEmpty())
+    return 0;
+
+  XSqlQuery savepoint("SAVEPOINT updaterViews;");
+
+  QList<int> defined;
+  for (int i = 0; i < candidates.size(); i++)
+  {
+    QString   execErr;
+    XSqlQuery viewsavepoint("SAVEPOINT updaterView;");
+    if (PgConnection::exec(definitions.at(i), QByteArray(), execErr) < 0)
+    {
+      if (DEBUG)
+        qDebug("CreateView::findUnchanged() %s cannot be compared: %s",
+               qPrintable(candidates.at(i)->filename()), qPrintable(execErr));
+      viewsavepoint.exec("ROLLBACK TO updaterView;");
+    }
+    else
+      defined.append(i + 1);
+    viewsavepoint.exec("RELEASE SAVEPOINT updaterView;");
+  }
+
+  XSqlQuery compareq;
+  compareq.prepare("SELECT a.i, pg_get_viewdef(l.oid) AS viewdef"
+                   "  FROM " +
+                   sqlArrayRows(QStringList() << "names TEXT[]"
+                                              << "schemas TEXT[]"
+                                              << "defined INTEGER[]") +
+                   "  JOIN pg_class t ON (t.relnamespace=pg_my_temp_schema()"
+                   "                  AND t.relname=a.names[a.i]"
+                   "                  AND t.relkind='v')"
+                   "  JOIN pg_class l"
+                   "    ON (l.relnamespace=(SELECT oid FROM pg_namespace"
+                   "                         WHERE nspname=COALESCE(a.schemas[a.i],"
+                   "                                                current_schema()))"
+                   "    AND l.relname=t.relname"
+                   "    AND l.relkind='v')"
+                   " WHERE a.i = ANY(a.defined)"
+                   "   AND pg_get_viewdef(l.oid)=pg_get_viewdef(t.oid)"
+                   "   AND l.reloptions IS NOT DISTINCT FROM t.reloptions"
+                   "   AND ARRAY(SELECT attname || ' ' || format_type(atttypid, atttypmod)"
+                   "               FROM pg_attribute"
+                   "              WHERE attrelid=l.oid AND attnum > 0"
+                   "              ORDER BY attnum)"
+                   "     = ARRAY(SELECT attname || ' ' || format_type(atttypid, atttypmod)"
+                   "               FROM pg_attribute"
+                   "              WHERE attrelid=t.oid AND attnum > 0"
+                   "              ORDER BY attnum);");
+  compareq.bindValue(":names",   toSqlArray(names));
+  compareq.bindValue(":schemas", toSqlArray(schemas));
+  compareq.bindValue(":defined", toSqlArray(defined));
+  compareq.exec();
+  while (compareq.next())
+  {
+    int i = compareq.value("i").toInt() - 1;
+    if (i >= 0 && i < candidates.size())
+    {
+      candidates.at(i)->_unchanged = true;
+      candidates.at(i)->_viewdef   = compareq.value("viewdef").toString();
+    }
+  }
+
+  QSqlError err = compareq.lastError();
+  if (err.type() == QSqlError::NoError)
+  {
+    QStringList changednames;
+    QStringList changedschemas;
+    QHash<QString, CreateView*> declared;
+    foreach (CreateView *view, all)
+    {
+      declared.insert(view->destSchema(pkgname) + "." + view->name(), view);
+      if (! view->_unchanged)
+      {
+        changednames.append(view->name());
+        changedschemas.append(view->destSchema(pkgname));
+      }
+    }
+
+    XSqlQuery depq;
+    depq.prepare("WITH RECURSIVE dep(oid) AS ("
+                 "  SELECT pg_class.oid"
+                 "    FROM " +
+                 sqlArrayRows(QStringList() << "names TEXT[]"
+                                            << "schemas TEXT[]") +
+                 "    JOIN pg_namespace ON (nspname=a.schemas[a.i])"
+                 "    JOIN pg_class ON (relnamespace=pg_namespace.oid"
+                 "                  AND relname=a.names[a.i]"
+                 "                  AND relkind IN ('v', 'm'))"
+                 "  UNION"
+                 "  SELECT pg_rewrite.ev_class"
+                 "    FROM dep"
+                 "    JOIN pg_depend ON (refclassid='pg_class'::regclass"
+                 "                   AND refobjid=dep.oid"
+                 "                   AND classid='pg_rewrite'::regclass)"
+                 "    JOIN pg_rewrite ON (pg_rewrite.oid=pg_depend.objid)"
+                 "   WHERE pg_rewrite.ev_class <> dep.oid"
+                 ")"
+                 "SELECT nspname, relname"
+                 "  FROM dep"
+                 "  JOIN pg_class ON (pg_class.oid=dep.oid)"
+                 "  JOIN pg_namespace ON (relnamespace=pg_namespace.oid);");
+    depq.bindValue(":names",   toSqlArray(changednames));
+    depq.bindValue(":schemas", toSqlArray(changedschemas));
+    depq.exec();
+    while (depq.next())
+    {
+      QString     key  = depq.value("nspname").toString() + "." +
+                         depq.value("relname").toString();
+      CreateView *view = declared.value(key, 0);
+      if (view && view->_unchanged)
+      {
+        if (DEBUG)
+          qDebug("CreateView::findUnchanged() %s depends on a changed view",
+                 qPrintable(key));
+        view->_unchanged = false;
+      }
+      else if (! view)
+        dependents.append(key);
+    }
+    err = depq.lastError();
+  }
+
+  int unchanged = 0;
+  foreach (CreateView *view, candidates)
+    if (view->_unchanged)
+      unchanged++;
+
+  int result = unchanged;
+  if (err.type() != QSqlError::NoError)
+  {
+    errMsg = _sqlerrtxt.arg(candidates.first()->filename())
+                       .arg(err.databaseText())
+                       .arg(err.driverText());
+    foreach (CreateView *view, candidates)
+      view->_unchanged = false;
+    dependents.clear();
+    result = -1;
+  }
+
+  savepoint.exec("ROLLBACK TO updaterViews;");
+  savepoint.exec("RELEASE SAVEPOINT updaterViews;");
+
+  if (DEBUG)
+    qDebug("CreateView::findUnchanged() %d of %d views are unchanged",
+           unchanged, views.size());
+
+  return result;
+}
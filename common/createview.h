@@ -24,6 +24,16 @@ class CreateView : public CreateDBObj
 
     virtual int writeToDB(const QByteArray &pdata, const QString pkgname, ParameterList &params, QString &errMsg);
 
+    static int findUnchanged(const QList<Script*> &views,
+                             const QList<QByteArray> &data,
+                             const QString &pkgname, QStringList &dependents,
+                             QString &errMsg);
+
+  protected:
+    QString _viewdef;   // the definition findUnchanged() saw
+
+    static bool splitScript(const QByteArray &data, QByteArray &tempCreate,
+                            QString &name, QString &schema, QByteArray &grants);
 };
 
 #endif
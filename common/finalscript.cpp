@@ -29,6 +29,7 @@ FinalScript::FinalScript(const QDomElement & elem, QStringList &msg, QList<bool>
     _name = elem.attribute("file");
   _onError = nameToOnError(elem.attribute("onerror"));
   _comment = elem.text();
+  readRunOnce(elem, msg, fatal);
 
   if (_name.isEmpty())
   {
@@ -47,6 +48,8 @@ QDomElement FinalScript::createElement(QDomDocument & doc)
 
   elem.setAttribute("file", _name);
   elem.setAttribute("onerror", onErrorToName(_onError));
+  if (_runOnce)
+    elem.setAttribute("runonce", "true");
 
   if(!_comment.isEmpty())
     elem.appendChild(doc.createTextNode(_comment));
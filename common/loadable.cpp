@@ -16,11 +16,21 @@
 #include <QVariant>     // used by XSqlQuery::value()
 #include <limits.h>
 
+#include "pgconnection.h"
 #include "xsqlquery.h"
 
+#define DEBUG false
+
 QRegExp Loadable::trueRegExp("^t(rue)?$",   Qt::CaseInsensitive);
 QRegExp Loadable::falseRegExp("^f(alse)?$", Qt::CaseInsensitive);
 
+int     Loadable::_chunkThreshold = 0;
+QString Loadable::_sourceEncoding("UTF8");
+bool    Loadable::_stagingCreated = false;
+
+// size of each piece of a payload streamed by Loadable::stageChunks()
+static const int payloadChunkSize = 1024 * 1024;
+
 QString Loadable::_sqlerrtxt = TR("The following error was "
                                   "encountered while trying to import %1 into "
                                   "the database:<br><pre>%2<br>%3</pre>");
@@ -43,6 +53,9 @@ Loadable::Loadable(const QString &nodename, const QString &name,
   _selectMql = 0;
   _insertMql = 0;
   _updateMql = 0;
+
+  _prepared      = false;
+  _prepareResult = 0;
 }
 
 Loadable::Loadable(const QDomElement & elem, const bool system,
@@ -94,6 +107,9 @@ Loadable::Loadable(const QDomElement & elem, const bool system,
   _selectMql = 0;
   _insertMql = 0;
   _updateMql = 0;
+
+  _prepared      = false;
+  _prepareResult = 0;
 }
 
 Loadable::~Loadable()
@@ -110,6 +126,229 @@ QString Loadable::schema() const
   return _schema;
 }
 
+/** Return the prefix to prepend to the name of this loadable's table when
+    it is installed as part of the package pkgname, and set destschema to
+    the schema that table lives in. The prefix is empty if the base table
+    should be used as-is.
+*/
+QString Loadable::tablePrefix(const QString &pkgname, QString &destschema) const
+{
+  destschema = "public";
+  QString prefix;
+  if (_schema.isEmpty()        &&   pkgname.isEmpty())
+    ;   // leave it alone
+  else if (_schema.isEmpty()   && ! pkgname.isEmpty())
+  {
+    prefix = "pkg";
+    destschema = pkgname;
+  }
+  else if ("public" == _schema &&   pkgname.isEmpty())
+    ;   // leave it alone
+  else if ("public" == _schema && ! pkgname.isEmpty())
+    prefix = "public.";
+  else if (! _schema.isEmpty())
+  {
+    prefix = _schema + ".pkg";
+    destschema = _schema;
+  }
+
+  return prefix;
+}
+
+/** Do the work needed to write this loadable to the database that does not
+    involve the database: parsing, scanning, and converting the file
+    contents. This is done once; later calls return the first result.
+
+    prepare() does not touch the database or anything shared with other
+    loadables, so it may be called from a worker thread as long as nothing
+    else uses this loadable until it returns.
+
+    @return a negative number if the file contents cannot be loaded, with
+            errMsg set to the reason
+*/
+int Loadable::prepare(const QByteArray &pdata, QString &errMsg)
+{
+  if (! _prepared)
+  {
+    _prepareResult = prepareData(pdata, _prepareErr);
+    _prepared      = true;
+  }
+
+  if (_prepareResult < 0)
+    errMsg = _prepareErr;
+
+  return _prepareResult;
+}
+
+/** Subclasses that parse their file contents do so here. The default
+    keeps the contents as the payload written to the database. The
+    payload shares pdata's buffer rather than copying it.
+*/
+int Loadable::prepareData(const QByteArray &pdata, QString &errMsg)
+{
+  Q_UNUSED(errMsg);
+  _payload = pdata;
+  return 0;
+}
+
+/** Create the temporary tables stagePayload() and stageChunks() use, so
+    they do not have to check for them before every write. Call this
+    outside of a transaction: tables created there last for the rest of
+    the session, while tables created inside one vanish if it or the
+    savepoint around them is rolled back.
+*/
+int Loadable::createStagingTables(QString &errMsg)
+{
+  if (_stagingCreated)
+    return 0;
+
+  XSqlQuery create;
+  if (! create.exec("CREATE TEMPORARY TABLE IF NOT EXISTS updater_payload ("
+                    "  payload_data BYTEA);") ||
+      ! create.exec("CREATE TEMPORARY TABLE IF NOT EXISTS updater_payload_chunk ("
+                    "  chunk_seq  INTEGER,"
+                    "  chunk_data BYTEA);"))
+  {
+    errMsg = create.lastError().databaseText();
+    return -1;
+  }
+
+  _stagingCreated = true;
+  return 0;
+}
+
+/** Set the encoding the server uses to turn staged sources into text.
+    The default is UTF8. Packages built from files in another encoding,
+    such as WIN1252 files that older updaters read with the client's
+    local 8-bit codec, can name it here. Scripts have their own setting,
+    Script::setSourceEncoding().
+
+    @return false if the name is not a plausible encoding name
+*/
+bool Loadable::setSourceEncoding(const QString &encoding)
+{
+  if (! encoding.contains(QRegExp("^[A-Za-z][A-Za-z0-9_]*$")))
+    return false;
+  _sourceEncoding = encoding;
+  return true;
+}
+
+/** Put the payload in the updater_payload temporary table, replacing
+    whatever was there, so the upsert can read it with the expression
+    Loadable::writeToDB() passes as the 'source' literal. The bytes are
+    sent as a binary bytea parameter when the driver gives access to
+    libpq, so a large source is never converted to a QString. Payloads
+    larger than chunkThreshold() are streamed with stageChunks() instead.
+*/
+int Loadable::stagePayload(const QByteArray &payload, QString &errMsg)
+{
+  if (_chunkThreshold > 0 && payload.size() > _chunkThreshold &&
+      PgConnection::handle())
+    return stageChunks(payload, errMsg);
+
+  if (! _stagingCreated)
+  {
+    XSqlQuery create("CREATE TEMPORARY TABLE IF NOT EXISTS updater_payload ("
+                     "  payload_data BYTEA);");
+    if (create.lastError().type() != QSqlError::NoError)
+    {
+      errMsg = create.lastError().databaseText();
+      return -1;
+    }
+  }
+
+  QString stage("WITH old AS (DELETE FROM updater_payload)"
+                " INSERT INTO updater_payload (payload_data) VALUES (%1);");
+  if (PgConnection::handle())
+    return PgConnection::execParams(stage.arg("$1"),
+                                    QList<QByteArray>() << payload, errMsg);
+
+  XSqlQuery insert;
+  insert.prepare(stage.arg(":payload"));
+  insert.bindValue(":payload", payload);
+  if (! insert.exec())
+  {
+    errMsg = insert.lastError().databaseText();
+    return -2;
+  }
+
+  return 0;
+}
+
+/** Stage an oversized payload without sending it as one giant
+    parameter. The payload is streamed with a binary COPY into the
+    updater_payload_chunk temporary table one piece at a time and the
+    updater_payload row is then assembled from the pieces on the server,
+    so neither side has to hold a second copy of the whole message.
+*/
+int Loadable::stageChunks(const QByteArray &payload, QString &errMsg)
+{
+  XSqlQuery create;
+  if ((! _stagingCreated &&
+       (! create.exec("CREATE TEMPORARY TABLE IF NOT EXISTS updater_payload ("
+                      "  payload_data BYTEA);") ||
+        ! create.exec("CREATE TEMPORARY TABLE IF NOT EXISTS updater_payload_chunk ("
+                      "  chunk_seq  INTEGER,"
+                      "  chunk_data BYTEA);"))) ||
+      ! create.exec("DELETE FROM updater_payload_chunk;"))
+  {
+    errMsg = create.lastError().databaseText();
+    return -1;
+  }
+
+  int result = PgConnection::copyStart("COPY updater_payload_chunk"
+                                       "  FROM STDIN WITH BINARY;", errMsg);
+  if (result < 0)
+    return result;
+
+  result = PgConnection::copyPut(PgConnection::binaryCopyHeader(), errMsg);
+  for (int seq = 0, offset = 0;
+       result == 0 && offset < payload.size();
+       seq++, offset += payloadChunkSize)
+  {
+    QByteArray seqdata;
+    seqdata.append((char)((seq >> 24) & 0xff));
+    seqdata.append((char)((seq >> 16) & 0xff));
+    seqdata.append((char)((seq >>  8) & 0xff));
+    seqdata.append((char)( seq        & 0xff));
+
+    QByteArray tuple;
+    PgConnection::appendBinaryTuple(tuple, QList<QByteArray>() << seqdata
+                     << QByteArray::fromRawData(payload.constData() + offset,
+                                 qMin(payloadChunkSize, payload.size() - offset)));
+    result = PgConnection::copyPut(tuple, errMsg);
+  }
+  if (result == 0)
+    result = PgConnection::copyPut(PgConnection::binaryCopyTrailer(), errMsg);
+
+  QString endErr;
+  int endResult = PgConnection::copyEnd(endErr, result < 0);
+  if (result == 0 && endResult < 0)
+  {
+    errMsg = endErr;
+    result = endResult;
+  }
+  if (result < 0)
+    return result;
+
+  XSqlQuery assemble;
+  if (! assemble.exec("WITH old AS (DELETE FROM updater_payload)"
+                      " INSERT INTO updater_payload (payload_data)"
+                      " SELECT string_agg(chunk_data, ''::BYTEA ORDER BY chunk_seq)"
+                      "   FROM updater_payload_chunk;") ||
+      ! assemble.exec("DELETE FROM updater_payload_chunk;"))
+  {
+    errMsg = assemble.lastError().databaseText();
+    return -6;
+  }
+
+  if (DEBUG)
+    qDebug("Loadable::stageChunks() streamed %d bytes in %d pieces",
+           payload.size(), (payload.size() + payloadChunkSize - 1) / payloadChunkSize);
+
+  return 0;
+}
+
 QDomElement Loadable::createElement(QDomDocument & doc)
 {
   QDomElement elem = doc.createElement(_nodename);
@@ -128,32 +367,26 @@ QDomElement Loadable::createElement(QDomDocument & doc)
 int Loadable::writeToDB(const QByteArray &pdata, const QString pkgname,
                         QString &errMsg, ParameterList &params)
 {
-  const char *fileContent = pdata.data();
+  if (usesSource())
+  {
+    QString stageErr;
+    if (stagePayload(_prepared ? _payload : pdata, stageErr) < 0)
+    {
+      errMsg = _sqlerrtxt.arg(_filename).arg(stageErr).arg(QString());
+      return -6;
+    }
+    params.append("source", QString("(SELECT convert_from(payload_data, '%1')"
+                                    "   FROM updater_payload)")
+                            .arg(sourceEncoding()));
+  }
 
   params.append("name",   _name);
   params.append("type",   _pkgitemtype);
-  params.append("source", QString::fromLocal8Bit(fileContent));
   params.append("notes",  _comment);
 
   // alter the name of the loadable's table if necessary
-  QString destschema = "public";
-  QString prefix;
-  if (_schema.isEmpty()        &&   pkgname.isEmpty())
-    ;   // leave it alone
-  else if (_schema.isEmpty()   && ! pkgname.isEmpty())
-  {
-    prefix = "pkg";
-    destschema = pkgname;
-  }
-  else if ("public" == _schema &&   pkgname.isEmpty())
-    ;   // leave it alone
-  else if ("public" == _schema && ! pkgname.isEmpty())
-    prefix = "public.";
-  else if (! _schema.isEmpty())
-  {
-    prefix = _schema + ".pkg";
-    destschema = _schema;
-  }
+  QString destschema;
+  QString prefix = tablePrefix(pkgname, destschema);
 
   if (! prefix.isEmpty())
   {
@@ -20,6 +20,15 @@
 
 class QDomDocument;
 class QDomElement;
+class Loadable;
+
+/* Writes a group of loadables of the same kind in one round trip.
+   Returns 0 on success and a negative number on failure, in which case
+   the caller may fall back to calling each loadable's writeToDB().
+ */
+typedef int (*LoadableBulkWriter)(const QList<Loadable*> &items,
+                                  const QList<QByteArray> &data,
+                                  const QString pkgname, QString &errMsg);
 
 #define TR(a) QObject::tr(a)
 
@@ -41,6 +50,7 @@ class Loadable
     virtual int     grade()    const { return _grade; }
     virtual bool    isValid()  const { return !_nodename.isEmpty() &&
                                               !_name.isEmpty();}
+    virtual bool    isPrepared() const { return _prepared; }
     virtual QString name()     const { return _name; }
     virtual QString nodename() const { return _nodename; }
     virtual Script::OnError onError() const { return _onError; }
@@ -52,8 +62,15 @@ class Loadable
     virtual void    setOnError(Script::OnError onError) { _onError = onError; }
     virtual void    setSystem(const bool p)             { _system = p; }
     virtual bool    system()   const { return _system; }
+    virtual QString tablePrefix(const QString &pkgname, QString &destschema) const;
     virtual int writeToDB(const QByteArray &pdata, const QString pkgname,
                           QString &errMsg) = 0;
+    int         prepare(const QByteArray &pdata, QString &errMsg);
+
+    static int  chunkThreshold()                    { return _chunkThreshold; }
+    static void setChunkThreshold(int bytes)        { _chunkThreshold = bytes; }
+    static int  createStagingTables(QString &errMsg);
+    static bool setSourceEncoding(const QString &encoding);
 
     static QRegExp trueRegExp;
     static QRegExp falseRegExp;
@@ -71,14 +88,28 @@ class Loadable
     QString      _name;
     QString      _nodename;
     Script::OnError _onError;
+    QByteArray   _payload;
     QString      _pkgitemtype;
+    bool         _prepared;
+    QString      _prepareErr;
+    int          _prepareResult;
     QString      _schema;
+    QString      _source;
     bool         _system;
     MetaSQLQuery *_updateMql;
 
+    virtual int prepareData(const QByteArray &pdata, QString &errMsg);
+    virtual QString sourceEncoding() const { return _sourceEncoding; }
+    virtual bool    usesSource()     const { return true; }
     virtual int writeToDB(const QByteArray &pdata, const QString pkgname,
                           QString &errMsg, ParameterList &params);
 
+    static int stagePayload(const QByteArray &payload, QString &errMsg);
+    static int stageChunks(const QByteArray &payload, QString &errMsg);
+
+    static int          _chunkThreshold;
+    static QString      _sourceEncoding;
+    static bool         _stagingCreated;
     static QString      _sqlerrtxt;
 };
 
@@ -0,0 +1,148 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "loadablepreparer.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include "loadable.h"
+
+#define DEBUG false
+
+class LoadablePrepareTask : public QRunnable
+{
+  public:
+    LoadablePrepareTask(LoadablePreparer *preparer, Loadable *item)
+      : _item(item),
+        _preparer(preparer)
+    {
+    }
+
+    virtual void run()
+    {
+      _preparer->run(_item);
+    }
+
+  protected:
+    Loadable         *_item;
+    LoadablePreparer *_preparer;
+};
+
+/** Create a preparer with its own pool of maxThreads threads, or one
+    thread per processor if maxThreads is not positive.
+*/
+LoadablePreparer::LoadablePreparer(int maxThreads)
+{
+  if (maxThreads > 0)
+    _pool.setMaxThreadCount(maxThreads);
+}
+
+LoadablePreparer::~LoadablePreparer()
+{
+  cancel();
+}
+
+/** Queue item to be prepared with the given file contents. Items are
+    started in the order they are added.
+*/
+void LoadablePreparer::add(Loadable *item, const QByteArray &data)
+{
+  if (! item || item->isPrepared())
+    return;
+
+  {
+    QMutexLocker locker(&_mutex);
+    if (_state.contains(item))
+      return;
+    _state.insert(item, Queued);
+    _data.insert(item, data);
+  }
+  _pool.start(new LoadablePrepareTask(this, item));
+}
+
+/** Drop the items that have not been started yet and wait for the rest.
+    Loadables that were dropped prepare themselves when they are written.
+*/
+void LoadablePreparer::cancel()
+{
+  {
+    QMutexLocker locker(&_mutex);
+    QHash<Loadable*, State>::iterator it;
+    for (it = _state.begin(); it != _state.end(); ++it)
+    {
+      if (it.value() == Queued)
+        it.value() = Done;
+    }
+    _data.clear();
+  }
+  _pool.waitForDone();
+}
+
+/** Block until item has been prepared. If no worker has picked it up yet
+    the calling thread prepares it rather than wait its turn.
+*/
+void LoadablePreparer::wait(Loadable *item)
+{
+  QMutexLocker locker(&_mutex);
+  if (! _state.contains(item))
+    return;
+
+  if (_state.value(item) == Queued)
+  {
+    _state.insert(item, Running);
+    locker.unlock();
+    prepare(item);
+    return;
+  }
+
+  while (_state.value(item) != Done)
+    _finished.wait(&_mutex);
+}
+
+bool LoadablePreparer::claim(Loadable *item)
+{
+  QMutexLocker locker(&_mutex);
+  if (_state.value(item, Done) != Queued)
+    return false;
+  _state.insert(item, Running);
+  return true;
+}
+
+void LoadablePreparer::finish(Loadable *item)
+{
+  QMutexLocker locker(&_mutex);
+  _state.insert(item, Done);
+  _data.remove(item);
+  _finished.wakeAll();
+}
+
+void LoadablePreparer::run(Loadable *item)
+{
+  if (claim(item))
+    prepare(item);
+}
+
+void LoadablePreparer::prepare(Loadable *item)
+{
+  QByteArray data;
+  {
+    QMutexLocker locker(&_mutex);
+    data = _data.value(item);
+  }
+
+  QString errMsg;
+  int result = item->prepare(data, errMsg);
+  if (DEBUG)
+    qDebug("LoadablePreparer::prepare(%s) returned %d %s",
+           qPrintable(item->filename()), result, qPrintable(errMsg));
+
+  finish(item);
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __LOADABLEPREPARER_H__
+#define __LOADABLEPREPARER_H__
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+class Loadable;
+
+/* Runs Loadable::prepare() on a pool of worker threads so parsing and
+   encoding overlap with the database work of earlier items. Call wait()
+   before writing a loadable to the database.
+ */
+class LoadablePreparer
+{
+  public:
+    LoadablePreparer(int maxThreads = -1);
+    virtual ~LoadablePreparer();
+
+    virtual void add(Loadable *item, const QByteArray &data);
+    virtual void cancel();
+    virtual void wait(Loadable *item);
+
+  protected:
+    enum State { Queued, Running, Done };
+
+    QHash<Loadable*, QByteArray> _data;
+    QWaitCondition               _finished;
+    QMutex                       _mutex;
+    QThreadPool                  _pool;
+    QHash<Loadable*, State>      _state;
+
+    virtual bool claim(Loadable *item);
+    virtual void finish(Loadable *item);
+    virtual void prepare(Loadable *item);
+    virtual void run(Loadable *item);
+
+    friend class LoadablePrepareTask;
+};
+
+#endif
@@ -77,7 +77,7 @@ LoadAppUI::LoadAppUI(const QDomElement &elem, const bool system,
   }
 }
 
-int LoadAppUI::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+int LoadAppUI::prepareData(const QByteArray &pdata, QString &errMsg)
 {
   int errLine = 0;
   int errCol = 0;
@@ -98,7 +98,7 @@ int LoadAppUI::writeToDB(const QByteArray &pdata, const QString pkgname, QString
   }
 
   if (DEBUG)
-    qDebug("LoadAppUI::writeToDB() name before looking for class node: %s",
+    qDebug("LoadAppUI::prepareData() name before looking for class node: %s",
            qPrintable(_name));
   QDomElement n = root.firstChildElement("class");
   if (n.isNull())
@@ -110,9 +110,18 @@ int LoadAppUI::writeToDB(const QByteArray &pdata, const QString pkgname, QString
   }
   _name = n.text();
   if (DEBUG)
-    qDebug("LoadAppUI::writeToDB() name after looking for class node: %s",
+    qDebug("LoadAppUI::prepareData() name after looking for class node: %s",
            qPrintable(_name));
 
+  return Loadable::prepareData(pdata, errMsg);
+}
+
+int LoadAppUI::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+{
+  int result = prepare(pdata, errMsg);
+  if (result < 0)
+    return result;
+
   _minMql = new MetaSQLQuery("SELECT MIN(uiform_order) AS min "
                    "FROM uiform "
                    "WHERE (uiform_name=<? value('name') ?>);");
@@ -129,7 +138,7 @@ int LoadAppUI::writeToDB(const QByteArray &pdata, const QString pkgname, QString
   _updateMql = new MetaSQLQuery("UPDATE <? literal('tablename') ?> "
                       "   SET uiform_order=<? value('grade') ?>, "
                       "       uiform_enabled=<? value('enabled') ?>,"
-                      "       uiform_source=<? value('source') ?>,"
+                      "       uiform_source=<? literal('source') ?>,"
                       "       uiform_notes=<? value('notes') ?> "
                       " WHERE (uiform_id=<? value('id') ?>) "
                       "RETURNING uiform_id AS id;");
@@ -141,7 +150,7 @@ int LoadAppUI::writeToDB(const QByteArray &pdata, const QString pkgname, QString
                       ") VALUES ("
                       "    DEFAULT, <? value('name') ?>,"
                       "    <? value('grade') ?>, <? value('enabled') ?>,"
-                      "    <? value('source') ?>,"
+                      "    <? literal('source') ?>,"
                       "    <? value('notes') ?>) "
                       "RETURNING uiform_id AS id;");
 
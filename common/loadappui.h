@@ -27,6 +27,8 @@ class LoadAppUI : public Loadable
 
   protected:
     bool _enabled;
+
+    virtual int prepareData(const QByteArray &pdata, QString &errMsg);
 };
 
 #endif
@@ -11,11 +11,14 @@
 #include "loadcmd.h"
 
 #include <QDomDocument>
+#include <QHash>
+#include <QMap>
 #include <QSqlError>
 #include <QStringList>
 #include <QVariant>     // used by XSqlQuery::bindValue()
 
 #include "loadable.h"
+#include "sqlarray.h"
 #include "xsqlquery.h"
 
 #define DEBUG false
@@ -30,6 +33,7 @@ LoadCmd::LoadCmd(const QString &nodename, const QString &name,
   _executable = executable;
   _module     = module;
   _privname   = privname;
+  _privChanged= true;
   _title      = title;
   _pkgitemtype= "D";
 }
@@ -39,6 +43,7 @@ LoadCmd::LoadCmd(const QDomElement &elem, const bool system,
   : Loadable(elem, system, msg, fatal)
 {
   _pkgitemtype= "D";
+  _privChanged= true;
 
   // name isn't required, at least according to the db and guiclient
 
@@ -120,7 +125,7 @@ QDomElement LoadCmd::createElement(QDomDocument &doc)
     for (int i = 0; i < _args.size(); i++)
     {
       QDomElement argElem = doc.createElement("arg");
-      elem.setAttribute("value", _args.at(i));
+      argElem.setAttribute("value", _args.at(i));
       elem.appendChild(argElem);
     }
   }
@@ -131,6 +136,7 @@ QDomElement LoadCmd::createElement(QDomDocument &doc)
 int LoadCmd::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
 {
   Q_UNUSED(pdata);
+  _privChanged = true;  // without the old values, assume the worst
   _selectMql = new MetaSQLQuery("SELECT cmd_id, -1, -1"
                       "  FROM <? literal('tablename') ?> "
                       " WHERE (cmd_name=<? value('name') ?>);");
@@ -168,19 +174,8 @@ int LoadCmd::writeToDB(const QByteArray &pdata, const QString pkgname, QString &
     return cmdid;
 
   // alter the name of the loadable's table if necessary
-  QString prefix;
-  if (_schema.isEmpty()        &&   pkgname.isEmpty())
-    ;   // leave it alone
-  else if (_schema.isEmpty()   && ! pkgname.isEmpty())
-    prefix = "pkg";
-  else if ("public" == _schema &&   pkgname.isEmpty())
-    ;   // leave it alone
-  else if ("public" == _schema && ! pkgname.isEmpty())
-    prefix = "public.";
-  else if (! _schema.isEmpty() &&   pkgname.isEmpty())
-    prefix = _schema + ".pkg";
-  else if (! _schema.isEmpty() && ! pkgname.isEmpty())
-    prefix = _schema + ".pkg";
+  QString destschema;
+  QString prefix = tablePrefix(pkgname, destschema);
 
   XSqlQuery delargs;
   delargs.prepare(QString("DELETE FROM %1cmdarg WHERE (cmdarg_cmd_id=:cmd_id);")
@@ -215,3 +210,204 @@ int LoadCmd::writeToDB(const QByteArray &pdata, const QString pkgname, QString &
 
   return cmdid;
 }
+
+/** Write a set of custom commands and their arguments with three statements
+    per destination table instead of four or more per command: one to
+    update or insert all of the commands, one to delete the old arguments
+    of the commands that already existed, and one to insert all of the new
+    arguments. The result is the same as calling writeToDB() on each
+    command in turn.
+
+    Commands without a name cannot be matched to the rows inserted for
+    them, so if there are any this returns an error and the caller should
+    fall back to writeToDB().
+
+    @return 0 on success, a negative number on failure
+*/
+int LoadCmd::bulkWriteToDB(const QList<Loadable*> &items,
+                           const QList<QByteArray> &data,
+                           const QString pkgname, QString &errMsg)
+{
+  Q_UNUSED(data);
+
+  // group by destination table; a later command with the same name
+  // replaces an earlier one, just as it would when written one by one
+  QStringList                         prefixes;
+  QMap<QString, QList<LoadCmd*> >     cmds;
+  QMap<QString, QHash<QString, int> > byname;
+  foreach (Loadable *item, items)
+  {
+    LoadCmd *cmd = dynamic_cast<LoadCmd*>(item);
+    if (! cmd)
+    {
+      errMsg = TR("Internal error: %1 is not a custom command.")
+                 .arg(item->name());
+      return -1;
+    }
+    if (cmd->name().isEmpty())
+    {
+      errMsg = TR("Custom commands without names must be loaded one at a time.");
+      return -1;
+    }
+
+    QString destschema;
+    QString prefix = cmd->tablePrefix(pkgname, destschema);
+    if (! prefixes.contains(prefix))
+      prefixes.append(prefix);
+    if (byname[prefix].contains(cmd->name()))
+      cmds[prefix][byname[prefix].value(cmd->name())] = cmd;
+    else
+    {
+      byname[prefix].insert(cmd->name(), cmds[prefix].size());
+      cmds[prefix].append(cmd);
+    }
+  }
+
+  foreach (QString prefix, prefixes)
+  {
+    QList<LoadCmd*> list = cmds.value(prefix);
+    QStringList names, modules, titles, descrips, privnames, executables;
+    foreach (LoadCmd *cmd, list)
+    {
+      names       << cmd->_name;
+      modules     << cmd->_module;
+      titles      << cmd->_title;
+      descrips    << cmd->_comment;
+      privnames   << cmd->_privname;
+      executables << cmd->_executable;
+    }
+
+    XSqlQuery upsert;
+    upsert.prepare(QString("WITH src AS ("
+                   "  SELECT i AS seq, names[i] AS name, modules[i] AS module,"
+                   "         titles[i] AS title, descrips[i] AS descrip,"
+                   "         privnames[i] AS privname,"
+                   "         executables[i] AS executable,"
+                   "         (SELECT cmd_id FROM %1cmd"
+                   "           WHERE cmd_name=names[i] LIMIT 1) AS cmd_id,"
+                   "         (SELECT cmd_module FROM %1cmd"
+                   "           WHERE cmd_name=names[i] LIMIT 1) AS old_module,"
+                   "         (SELECT cmd_privname FROM %1cmd"
+                   "           WHERE cmd_name=names[i] LIMIT 1) AS old_privname"
+                   "    FROM " +
+                   sqlArrayRows(QStringList() << "names TEXT[]"
+                                              << "modules TEXT[]"
+                                              << "titles TEXT[]"
+                                              << "descrips TEXT[]"
+                                              << "privnames TEXT[]"
+                                              << "executables TEXT[]") +
+                   "), upd AS ("
+                   "  UPDATE %1cmd AS dest"
+                   "     SET cmd_module=src.module, cmd_title=src.title,"
+                   "         cmd_privname=src.privname,"
+                   "         cmd_executable=src.executable,"
+                   "         cmd_descrip=src.descrip"
+                   "    FROM src"
+                   "   WHERE dest.cmd_id=src.cmd_id"
+                   "  RETURNING src.seq, dest.cmd_id"
+                   "), ins AS ("
+                   "  INSERT INTO %1cmd (cmd_module, cmd_title, cmd_descrip,"
+                   "                     cmd_privname, cmd_executable, cmd_name)"
+                   "  SELECT module, title, descrip, privname, executable, name"
+                   "    FROM src"
+                   "   WHERE cmd_id IS NULL"
+                   "   ORDER BY seq"
+                   "  RETURNING cmd_id, cmd_name"
+                   ") SELECT upd.seq, upd.cmd_id, TRUE AS existed,"
+                   "         (src.old_privname IS DISTINCT FROM src.privname"
+                   "          OR src.old_module IS DISTINCT FROM src.module) AS privchanged"
+                   "    FROM upd JOIN src ON (src.seq=upd.seq)"
+                   "  UNION ALL"
+                   "  SELECT src.seq, ins.cmd_id, FALSE,"
+                   "         COALESCE(src.privname, '') <> ''"
+                   "    FROM ins JOIN src ON (src.name=ins.cmd_name"
+                   "                      AND src.cmd_id IS NULL);").arg(prefix));
+    upsert.bindValue(":names",       toSqlArray(names));
+    upsert.bindValue(":modules",     toSqlArray(modules));
+    upsert.bindValue(":titles",      toSqlArray(titles));
+    upsert.bindValue(":descrips",    toSqlArray(descrips));
+    upsert.bindValue(":privnames",   toSqlArray(privnames));
+    upsert.bindValue(":executables", toSqlArray(executables));
+    if (! upsert.exec())
+    {
+      QSqlError err = upsert.lastError();
+      errMsg = _sqlerrtxt.arg(prefix + "cmd").arg(err.driverText()).arg(err.databaseText());
+      return -7;
+    }
+
+    QHash<int, int> cmdids;     // seq -> cmd_id
+    QList<int>      existing;
+    while (upsert.next())
+    {
+      int seq = upsert.value("seq").toInt();
+      cmdids.insert(seq, upsert.value("cmd_id").toInt());
+      if (seq >= 1 && seq <= list.size())
+        list.at(seq - 1)->_privChanged = upsert.value("privchanged").toBool();
+      if (upsert.value("existed").toBool())
+        existing.append(upsert.value("cmd_id").toInt());
+    }
+    if (cmdids.size() != list.size())
+    {
+      errMsg = TR("Saved %1 custom commands in %2cmd but expected %3.")
+                 .arg(cmdids.size()).arg(prefix).arg(list.size());
+      return -7;
+    }
+
+    if (! existing.isEmpty())
+    {
+      XSqlQuery delargs;
+      delargs.prepare(QString("DELETE FROM %1cmdarg"
+                              " WHERE (cmdarg_cmd_id = ANY (CAST(:cmd_ids AS INTEGER[])));")
+                              .arg(prefix));
+      delargs.bindValue(":cmd_ids", toSqlArray(existing));
+      if (! delargs.exec())
+      {
+        QSqlError err = delargs.lastError();
+        errMsg = _sqlerrtxt.arg(prefix + "cmdarg").arg(err.driverText()).arg(err.databaseText());
+        return -8;
+      }
+    }
+
+    QList<int>  argcmds;
+    QList<int>  argorders;
+    QStringList args;
+    for (int seq = 1; seq <= list.size(); seq++)
+    {
+      LoadCmd *cmd = list.at(seq - 1);
+      for (int i = 0; i < cmd->_args.size(); i++)
+      {
+        argcmds   << cmdids.value(seq);
+        argorders << i;
+        args      << cmd->_args.at(i);
+      }
+    }
+
+    if (! args.isEmpty())
+    {
+      XSqlQuery insargs;
+      insargs.prepare(QString("INSERT INTO %1cmdarg (cmdarg_cmd_id, cmdarg_order,"
+                              "                      cmdarg_arg)"
+                              " SELECT cmd_ids[i], orders[i], args[i]"
+                              "   FROM " +
+                              sqlArrayRows(QStringList() << "cmd_ids INTEGER[]"
+                                                         << "orders INTEGER[]"
+                                                         << "args TEXT[]") +
+                              "  ORDER BY i;").arg(prefix));
+      insargs.bindValue(":cmd_ids", toSqlArray(argcmds));
+      insargs.bindValue(":orders",  toSqlArray(argorders));
+      insargs.bindValue(":args",    toSqlArray(args));
+      if (! insargs.exec())
+      {
+        QSqlError err = insargs.lastError();
+        errMsg = _sqlerrtxt.arg(prefix + "cmdarg").arg(err.driverText()).arg(err.databaseText());
+        return -9;
+      }
+    }
+
+    if (DEBUG)
+      qDebug("LoadCmd::bulkWriteToDB() wrote %d commands (%d existed) and %d args to %scmd",
+             list.size(), existing.size(), args.size(), qPrintable(prefix));
+  }
+
+  return 0;
+}
@@ -31,12 +31,20 @@ class LoadCmd : public Loadable
                                         && !_title.isEmpty()
                                         && !_executable.isEmpty(); }
 
+    virtual bool privChanged() const { return _privChanged; }
     virtual int writeToDB(const QByteArray &, const QString pkgname, QString &errMsg);
 
+    static int bulkWriteToDB(const QList<Loadable*> &items,
+                             const QList<QByteArray> &data,
+                             const QString pkgname, QString &errMsg);
+
   protected:
+    virtual bool usesSource() const { return false; }
+
     QStringList _args;
     QString     _executable;
     QString     _module;
+    bool        _privChanged;   // may need updateCustomPrivs()
     QString     _privname;
     QString     _title;
 };
@@ -12,13 +12,18 @@
 
 #include <QBuffer>
 #include <QDomElement>
+#include <QHash>
 #include <QImage>
+#include <QImageReader>
 #include <QImageWriter>
+#include <QMap>
 #include <QSqlError>
 #include <QVariant>     // used by XSqlQuery::bindValue()
 
-#include <quuencode.h>
+#include <string.h>
 
+#include "pgconnection.h"
+#include "xuuencode.h"
 #include "xsqlquery.h"
 
 #define DEBUG false
@@ -69,7 +74,51 @@ LoadImage::LoadImage(const QDomElement &elem, const bool system,
 
 }
 
-int LoadImage::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+/** Identify an image from its first few bytes. Returns the Qt format name
+    of the image or an empty string if the data do not look like an image
+    Qt can read.
+*/
+QByteArray LoadImage::imageFormat(const QByteArray &pdata)
+{
+  static const struct {
+    const char *magic;
+    int         length;
+    const char *format;
+  } signatures[] = {
+    { "\211PNG\r\n\032\n", 8, "png"  },
+    { "\377\330\377",      3, "jpeg" },
+    { "GIF87a",            6, "gif"  },
+    { "GIF89a",            6, "gif"  },
+    { "BM",                2, "bmp"  },
+    { "II*\0",             4, "tiff" },
+    { "MM\0*",             4, "tiff" },
+    { "/* XPM */",         9, "xpm"  }
+  };
+
+  for (unsigned int i = 0; i < sizeof(signatures) / sizeof(signatures[0]); i++)
+  {
+    if (pdata.size() >= signatures[i].length &&
+        memcmp(pdata.constData(), signatures[i].magic, signatures[i].length) == 0)
+      return signatures[i].format;
+  }
+
+  // anything else the image plugins recognize
+  QBuffer buffer;
+  buffer.setData(pdata);
+  buffer.open(QIODevice::ReadOnly);
+  return QImageReader::imageFormat(&buffer);
+}
+
+/** Convert the image file contents to the uuencoded form stored in the
+    image table. Files that are already uuencoded are passed through and
+    everything else is checked to make sure it is an image before its
+    original bytes are uuencoded. An image is only decoded and written
+    out again, as the loader always used to do, if the file extension
+    names a different format Qt can write; otherwise the stored image is
+    exactly the file in the package.
+*/
+int LoadImage::encode(const QByteArray &pdata, QByteArray &encodeddata,
+                      QString &errMsg)
 {
   if (pdata.isEmpty())
   {
@@ -78,50 +127,89 @@ int LoadImage::writeToDB(const QByteArray &pdata, const QString pkgname, QString
     return -2;
   }
 
-  QByteArray encodeddata;
   if (DEBUG)
-    qDebug("LoadImage::writeToDB(): image starts with %s",
+    qDebug("LoadImage::encode(): image starts with %s",
            pdata.left(10).data());
   if (QString(pdata.left(pdata.indexOf("\n"))).contains(QRegExp("^\\s*begin \\d+ \\S+")))
   {
-    if (DEBUG) qDebug("LoadImage::writeToDB() image is already uuencoded");
+    if (DEBUG) qDebug("LoadImage::encode() image is already uuencoded");
     encodeddata = pdata;
   }
   else
   {
-    // there's just GOT to be a better way to do this
-    QImageWriter imageIo;
-    QBuffer      imageBuffer;
-
-    imageBuffer.open(QIODevice::ReadWrite);
-    imageIo.setDevice(&imageBuffer);
-    imageIo.setFormat(_filename.right(_filename.size() -
-                                      _filename.lastIndexOf(".") - 1).toLatin1());
+    QByteArray format = imageFormat(pdata);
     if (DEBUG)
-      qDebug("LoadImage::writeToDB() image has format %s",
-             imageIo.format().data());
-    QImage image;
-    image.loadFromData(pdata);
-    if (!imageIo.write(image))
+      qDebug("LoadImage::encode() image has format %s", format.data());
+    if (format.isEmpty())
     {
       errMsg = TR("<font color=orange>Error processing image %1: "
-                           "<br>%2</font>")
-                .arg(_name).arg(imageIo.errorString());
+                           "<br>%2 is not in a recognized image format.</font>")
+                .arg(_name).arg(_filename);
       return -3;
     }
 
-    imageBuffer.close();
-    encodeddata = QUUEncode(imageBuffer).toLatin1();
-    if (DEBUG) qDebug("LoadImage::writeToDB() image was uuencoded: %s",
+    QByteArray suffix = _filename.mid(_filename.lastIndexOf(".") + 1)
+                                 .toLower().toLatin1();
+    if (suffix == "jpg")
+      suffix = "jpeg";
+    else if (suffix == "tif")
+      suffix = "tiff";
+
+    if (suffix != format &&
+        QImageWriter::supportedImageFormats().contains(suffix))
+    {
+      if (DEBUG)
+        qDebug("LoadImage::encode() converting %s image to %s",
+               format.data(), suffix.data());
+      QImageWriter imageIo;
+      QBuffer      imageBuffer;
+
+      imageBuffer.open(QIODevice::ReadWrite);
+      imageIo.setDevice(&imageBuffer);
+      imageIo.setFormat(suffix);
+      QImage image;
+      image.loadFromData(pdata);
+      if (!imageIo.write(image))
+      {
+        errMsg = TR("<font color=orange>Error processing image %1: "
+                             "<br>%2</font>")
+                  .arg(_name).arg(imageIo.errorString());
+        return -3;
+      }
+      imageBuffer.close();
+      encodeddata = XUUEncode(imageBuffer.data());
+    }
+    else
+      encodeddata = XUUEncode(pdata);
+    if (DEBUG) qDebug("LoadImage::encode() image was uuencoded: %s",
                       encodeddata.left(160).data());
   }
 
+  return 0;
+}
+
+int LoadImage::prepareData(const QByteArray &pdata, QString &errMsg)
+{
+  int result = encode(pdata, _encoded, errMsg);
+  if (result < 0)
+    return result;
+
+  _payload = _encoded;
+  return 0;
+}
+
+int LoadImage::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+{
+  int result = prepare(pdata, errMsg);
+  if (result < 0)
+    return result;
+
   _selectMql = new MetaSQLQuery("SELECT image_id, -1, -1"
                       "  FROM <? literal('tablename') ?> "
                       " WHERE (image_name=<? value('name') ?>);");
 
   _updateMql = new MetaSQLQuery("UPDATE <? literal('tablename') ?> "
-                      "   SET image_data=<? value('source') ?>,"
+                      "   SET image_data=<? literal('source') ?>,"
                       "       image_descrip=<? value('notes') ?>"
                       " WHERE (image_id=<? value('id') ?>)"
                       " RETURNING image_id AS id;");
@@ -130,12 +218,216 @@ int LoadImage::writeToDB(const QByteArray &pdata, const QString pkgname, QString
                       "   image_id, image_name, image_data, image_descrip"
                       ") VALUES ("
                       "  DEFAULT, <? value('name') ?>,"
-                      "  <? value('source') ?>,"
+                      "  <? literal('source') ?>,"
                       "  <? value('notes') ?>"
                       ") RETURNING image_id AS id;");
 
   ParameterList params;
   params.append("tablename", "image");
 
-  return Loadable::writeToDB(encodeddata, pkgname, errMsg, params);
+  return Loadable::writeToDB(_encoded, pkgname, errMsg, params);
+}
+
+/* Stream a batch of prepared images into a temporary table with binary
+   COPY, one image at a time so the COPY stream is never held in memory as
+   a whole, and merge them into the destination table in one statement:
+   each image whose name already exists is updated and the rest are
+   inserted in the order given.
+ */
+int LoadImage::copyImages(const QString &tablename,
+                          const QList<LoadImage*> &images, QString &errMsg)
+{
+  XSqlQuery stage;
+  if (! stage.exec("CREATE TEMPORARY TABLE updater_imageload ("
+                   "  imageload_seq     INTEGER,"
+                   "  imageload_name    TEXT,"
+                   "  imageload_descrip TEXT,"
+                   "  imageload_data    TEXT"
+                   ") ON COMMIT DROP;"))
+  {
+    QSqlError err = stage.lastError();
+    errMsg = _sqlerrtxt.arg(tablename).arg(err.driverText()).arg(err.databaseText());
+    return -4;
+  }
+
+  QString copyErr;
+  int     copied = 0;
+  int     result = PgConnection::copyStart("COPY updater_imageload"
+                                           "  FROM STDIN WITH BINARY;",
+                                           copyErr);
+  bool    started = (result == 0);
+  if (started)
+    result = PgConnection::copyPut(PgConnection::binaryCopyHeader(), copyErr);
+  for (int i = 0; i < images.size() && result == 0; i++)
+  {
+    LoadImage *image = images.at(i);
+
+    QByteArray seq;
+    seq.append((char)((i >> 24) & 0xff));
+    seq.append((char)((i >> 16) & 0xff));
+    seq.append((char)((i >>  8) & 0xff));
+    seq.append((char)( i        & 0xff));
+
+    QList<QByteArray> fields;
+    fields << seq
+           << image->name().toUtf8()
+           << (image->comment().isNull() ? QByteArray()
+                                         : image->comment().toUtf8())
+           << image->_encoded;
+    QByteArray tuple;
+    PgConnection::appendBinaryTuple(tuple, fields);
+    result = PgConnection::copyPut(tuple, copyErr);
+    copied += tuple.size();
+  }
+  if (result == 0)
+    result = PgConnection::copyPut(PgConnection::binaryCopyTrailer(), copyErr);
+  if (started)
+  {
+    QString endErr;
+    int endResult = PgConnection::copyEnd(endErr, result < 0);
+    if (result == 0 && endResult < 0)
+    {
+      copyErr = endErr;
+      result  = endResult;
+    }
+  }
+
+  if (DEBUG)
+    qDebug("LoadImage::copyImages() copied %d images (%d bytes) for %s",
+           images.size(), copied, qPrintable(tablename));
+
+  if (result < 0)
+  {
+    errMsg = _sqlerrtxt.arg(tablename).arg(copyErr).arg(QString());
+    return -5;
+  }
+
+  // the update and insert see the same snapshot, so each staged image
+  // is either updated in place or inserted, never both
+  XSqlQuery merge;
+  if (! merge.exec(QString("WITH src AS ("
+                   "  SELECT imageload_seq, imageload_name,"
+                   "         imageload_descrip, imageload_data,"
+                   "         (SELECT image_id FROM %1"
+                   "           WHERE image_name=imageload_name"
+                   "           LIMIT 1) AS image_id"
+                   "    FROM updater_imageload"
+                   "), upd AS ("
+                   "  UPDATE %1 AS dest"
+                   "     SET image_data=src.imageload_data,"
+                   "         image_descrip=src.imageload_descrip"
+                   "    FROM src"
+                   "   WHERE dest.image_id=src.image_id"
+                   "  RETURNING dest.image_id"
+                   ") INSERT INTO %1 (image_name, image_data, image_descrip)"
+                   "  SELECT imageload_name, imageload_data, imageload_descrip"
+                   "    FROM src"
+                   "   WHERE image_id IS NULL"
+                   "   ORDER BY imageload_seq;").arg(tablename)) ||
+      ! merge.exec("DROP TABLE updater_imageload;"))
+  {
+    QSqlError err = merge.lastError();
+    errMsg = _sqlerrtxt.arg(tablename).arg(err.driverText()).arg(err.databaseText());
+    return -6;
+  }
+
+  return 0;
+}
+
+/** Write a set of images with a handful of statements instead of a select
+    plus an update or insert per image. The encoded images are streamed
+    into a temporary table with binary COPY and merged into each
+    destination table in one statement, so the result is the same as
+    calling writeToDB() on each image in turn: an image whose name already
+    exists is updated and the rest are inserted in package order. When the
+    package has the same name twice, the image is inserted where the name
+    first appears and holds the data of the last one, as it would be if
+    the second writeToDB() updated what the first inserted.
+
+    Images over Loadable::chunkThreshold() go through writeToDB(), which
+    stages them in pieces. The images before each of them are merged first
+    so the package order is kept.
+
+    The caller should wrap this in a savepoint and fall back to calling
+    writeToDB() on each image if it fails, which also gives the per-image
+    error messages this function cannot.
+
+    @return 0 on success, a negative number on failure
+*/
+int LoadImage::bulkWriteToDB(const QList<Loadable*> &items,
+                             const QList<QByteArray> &data,
+                             const QString pkgname, QString &errMsg)
+{
+  if (items.size() != data.size())
+  {
+    errMsg = TR("Internal error: %1 images but %2 files.")
+               .arg(items.size()).arg(data.size());
+    return -1;
+  }
+
+  // group the images by destination table; a later image with the same
+  // name takes the place of the earlier one
+  QStringList                   tables;
+  QMap<QString, QList<int> >    rows;
+  QMap<QString, QHash<QString, int> > byname;   // name -> position in rows
+  for (int i = 0; i < items.size(); i++)
+  {
+    LoadImage *image = dynamic_cast<LoadImage*>(items.at(i));
+    if (! image)
+    {
+      errMsg = TR("Internal error: %1 is not an image.")
+                 .arg(items.at(i)->filename());
+      return -1;
+    }
+
+    int result = image->prepare(data.at(i), errMsg);
+    if (result < 0)
+      return result;
+
+    QString destschema;
+    QString tablename = image->tablePrefix(pkgname, destschema) + "image";
+    if (! tables.contains(tablename))
+      tables.append(tablename);
+    if (byname[tablename].contains(image->name()))
+      rows[tablename][byname[tablename].value(image->name())] = i;
+    else
+    {
+      byname[tablename].insert(image->name(), rows[tablename].size());
+      rows[tablename].append(i);
+    }
+  }
+
+  foreach (QString tablename, tables)
+  {
+    QList<LoadImage*> batch;
+    foreach (int i, rows.value(tablename))
+    {
+      LoadImage *image = static_cast<LoadImage*>(items.at(i));
+      if (chunkThreshold() <= 0 || image->_encoded.size() <= chunkThreshold())
+      {
+        batch.append(image);
+        continue;
+      }
+
+      if (! batch.isEmpty())
+      {
+        int result = copyImages(tablename, batch, errMsg);
+        if (result < 0)
+          return result;
+        batch.clear();
+      }
+      int result = image->writeToDB(data.at(i), pkgname, errMsg);
+      if (result < 0)
+        return result;
+    }
+
+    if (! batch.isEmpty())
+    {
+      int result = copyImages(tablename, batch, errMsg);
+      if (result < 0)
+        return result;
+    }
+  }
+
+  return 0;
 }
@@ -23,7 +23,22 @@ class LoadImage : public Loadable
     LoadImage(const QDomElement &, const bool system,
               QStringList &, QList<bool> &);
 
+    virtual int encode(const QByteArray &pdata, QByteArray &encoded,
+                       QString &errMsg);
     virtual int writeToDB(const QByteArray &, const QString pkgname, QString &);
+
+    static QByteArray imageFormat(const QByteArray &pdata);
+    static int bulkWriteToDB(const QList<Loadable*> &items,
+                             const QList<QByteArray> &data,
+                             const QString pkgname, QString &errMsg);
+
+  protected:
+    QByteArray _encoded;
+
+    virtual int prepareData(const QByteArray &pdata, QString &errMsg);
+
+    static int copyImages(const QString &tablename,
+                          const QList<LoadImage*> &images, QString &errMsg);
 };
 
 #endif
@@ -15,6 +15,7 @@
 #include <QVariant>     // used by XSqlQuery::bindValue()
 
 #include "metasql.h"
+#include "servercapabilities.h"
 #include "xsqlquery.h"
 
 #define DEBUG false
@@ -57,7 +58,7 @@ LoadMetasql::LoadMetasql(const QDomElement &elem, const bool system,
 
 }
 
-int LoadMetasql::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+int LoadMetasql::prepareData(const QByteArray &pdata, QString &errMsg)
 {
   if (pdata.isEmpty())
   {
@@ -77,19 +78,19 @@ int LoadMetasql::writeToDB(const QByteArray &pdata, const QString pkgname, QStri
   for (int i = 0; i < lines.size(); i++)
   {
     if (DEBUG)
-      qDebug("LoadMetasql::writeToDB looking at %s", qPrintable(lines.at(i)));
+      qDebug("LoadMetasql::prepareData looking at %s", qPrintable(lines.at(i)));
 
     if (groupRE.indexIn(lines.at(i)) >= 0)
     {
       _group = groupRE.cap(2).trimmed();
       if (DEBUG)
-        qDebug("LoadMetasql::writeToDB() found group %s", qPrintable(_group));
+        qDebug("LoadMetasql::prepareData() found group %s", qPrintable(_group));
     }
     else if (nameRE.indexIn(lines.at(i)) >= 0)
     {
       _name = nameRE.cap(2).trimmed();
       if (DEBUG)
-        qDebug("LoadMetasql::writeToDB() found name %s", qPrintable(_name));
+        qDebug("LoadMetasql::prepareData() found name %s", qPrintable(_name));
     }
     else if (notesRE.indexIn(lines.at(i)) >= 0)
     {
@@ -97,15 +98,25 @@ int LoadMetasql::writeToDB(const QByteArray &pdata, const QString pkgname, QStri
       while (dashdashRE.indexIn(lines.at(++i)) >= 0)
         _comment += " " + dashdashRE.cap(2).trimmed();
       if (DEBUG)
-        qDebug("LoadMetasql::writeToDB() found notes %s", qPrintable(_comment));
+        qDebug("LoadMetasql::prepareData() found notes %s", qPrintable(_comment));
     }
   }
 
   if (DEBUG)
-    qDebug("LoadMetasql::writeToDB(): name %s group %s notes %s\n%s",
+    qDebug("LoadMetasql::prepareData(): name %s group %s notes %s\n%s",
            qPrintable(_name), qPrintable(_group), qPrintable(_comment),
            qPrintable(metasqlStr));
 
+  _source = metasqlStr;
+  return 0;
+}
+
+int LoadMetasql::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+{
+  int result = prepare(pdata, errMsg);
+  if (result < 0)
+    return result;
+
   QString destschema = "public";
   if (_schema.isEmpty()        &&   pkgname.isEmpty())
     ;   // leave it alone
@@ -116,7 +127,16 @@ int LoadMetasql::writeToDB(const QByteArray &pdata, const QString pkgname, QStri
   else if (! _schema.isEmpty())
     destschema = _schema;
 
-  XSqlQuery gradedsavepoint("SAVEPOINT savemetasql_graded;");
+  /* older databases have a saveMetasql() without the grade argument.
+     the server's capabilities say which one to call; if they are not known
+     try the graded one and fall back to the other.
+   */
+  int  saveargs = ServerCapabilities::functionArgs("saveMetasql");
+  bool trial    = (saveargs < 0);
+  XSqlQuery gradedsavepoint;
+  if (trial)
+    gradedsavepoint.exec("SAVEPOINT savemetasql_graded;");
+
   MetaSQLQuery upsertm("SELECT saveMetasql(<? value('group') ?>,"
                        "       <? value('name') ?>,  <? value('notes') ?>,"
                        "       <? value('query') ?>,"
@@ -130,29 +150,30 @@ int LoadMetasql::writeToDB(const QByteArray &pdata, const QString pkgname, QStri
   upsertp.append("group", _group);
   upsertp.append("name",  _name);
   upsertp.append("notes", _comment);
-  upsertp.append("query", metasqlStr);
+  upsertp.append("query", _source);
   upsertp.append("system",_system);
   upsertp.append("schema",destschema);
   upsertp.append("grade", _grade);
+  if (! trial && saveargs < 7)
+    upsertp.append("skipgrade");
 
   int metasqlid = -1;
 
   XSqlQuery upsert = upsertm.toQuery(upsertp);
-  if (upsert.first())
-    metasqlid = upsert.value(0).toInt();
-  else if (upsert.lastError().type() != QSqlError::NoError)
+  if (trial && upsert.lastError().type() != QSqlError::NoError)
   {
     XSqlQuery gradedrollback("ROLLBACK TO SAVEPOINT savemetasql_graded;");
     upsertp.append("skipgrade");
     upsert = upsertm.toQuery(upsertp);
-    if (upsert.first())
-      metasqlid = upsert.value(0).toInt();
-    if (upsert.lastError().type() != QSqlError::NoError)
-    {
-      QSqlError err = upsert.lastError();
-      errMsg = _sqlerrtxt.arg(_filename).arg(err.driverText()).arg(err.databaseText());
-      return -6;
-    }
+  }
+
+  if (upsert.first())
+    metasqlid = upsert.value(0).toInt();
+  else if (upsert.lastError().type() != QSqlError::NoError)
+  {
+    QSqlError err = upsert.lastError();
+    errMsg = _sqlerrtxt.arg(_filename).arg(err.driverText()).arg(err.databaseText());
+    return -6;
   }
   else
   {
@@ -167,7 +188,7 @@ int LoadMetasql::writeToDB(const QByteArray &pdata, const QString pkgname, QStri
               .arg("saveMetasql").arg(metasqlid);
     return -5;
   }
-  else
+  else if (trial)
     XSqlQuery gradedrelease("RELEASE SAVEPOINT savemetasql_graded;");
 
   if (DEBUG)
@@ -33,6 +33,8 @@ class LoadMetasql : public Loadable
 
   protected:
     QString _group;
+
+    virtual int prepareData(const QByteArray &pdata, QString &errMsg);
 };
 
 #endif
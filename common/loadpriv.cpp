@@ -11,13 +11,18 @@
 #include "loadpriv.h"
 
 #include <QDomDocument>
+#include <QHash>
+#include <QMap>
 #include <QSqlError>
 #include <QVariant>     // used by XSqlQuery::bindValue()
 
+#include "sqlarray.h"
 #include "xsqlquery.h"
 
 #include "loadable.h"
 
+#define DEBUG false
+
 LoadPriv::LoadPriv(const QString &nodename,
                    const QString &name, const QString &module,
                    const bool system, const QString &comment)
@@ -106,3 +111,111 @@ int LoadPriv::writeToDB(const QByteArray &pdata, const QString pkgname, QString
 
   return Loadable::writeToDB(QByteArray(), pkgname, errMsg, params);
 }
+
+/** Write all of the privileges with one statement per destination table
+    instead of a lookup and an upsert per privilege.
+
+    @return 0 on success or a negative number on failure, in which case
+            the caller should roll back and write them one at a time to
+            get a message for each failure
+*/
+int LoadPriv::bulkWriteToDB(const QList<Loadable*> &items,
+                            const QList<QByteArray> &data,
+                            const QString pkgname, QString &errMsg)
+{
+  Q_UNUSED(data);
+
+  // group by destination table; a later privilege with the same name
+  // replaces an earlier one, just as it would when written one by one
+  QStringList                         prefixes;
+  QMap<QString, QList<LoadPriv*> >    privs;
+  QMap<QString, QHash<QString, int> > byname;
+  foreach (Loadable *item, items)
+  {
+    LoadPriv *priv = dynamic_cast<LoadPriv*>(item);
+    if (! priv)
+    {
+      errMsg = TR("Internal error: %1 is not a privilege.").arg(item->name());
+      return -1;
+    }
+    if (! priv->isValid())
+    {
+      errMsg = TR("Privileges without names or modules must be loaded one "
+                  "at a time.");
+      return -1;
+    }
+
+    QString destschema;
+    QString prefix = priv->tablePrefix(pkgname, destschema);
+    if (! prefixes.contains(prefix))
+      prefixes.append(prefix);
+    if (byname[prefix].contains(priv->name()))
+      privs[prefix][byname[prefix].value(priv->name())] = priv;
+    else
+    {
+      byname[prefix].insert(priv->name(), privs[prefix].size());
+      privs[prefix].append(priv);
+    }
+  }
+
+  foreach (QString prefix, prefixes)
+  {
+    QList<LoadPriv*> list = privs.value(prefix);
+    QStringList names, modules, descrips;
+    foreach (LoadPriv *priv, list)
+    {
+      names    << priv->_name;
+      modules  << priv->_module;
+      descrips << priv->_comment;
+    }
+
+    XSqlQuery upsert;
+    upsert.prepare(QString("WITH src AS ("
+                   "  SELECT i AS seq, names[i] AS name, modules[i] AS module,"
+                   "         descrips[i] AS descrip,"
+                   "         (SELECT priv_id FROM %1priv"
+                   "           WHERE priv_name=names[i] LIMIT 1) AS priv_id"
+                   "    FROM " +
+                   sqlArrayRows(QStringList() << "names TEXT[]"
+                                              << "modules TEXT[]"
+                                              << "descrips TEXT[]") +
+                   "), upd AS ("
+                   "  UPDATE %1priv AS dest"
+                   "     SET priv_module=src.module, priv_descrip=src.descrip"
+                   "    FROM src"
+                   "   WHERE dest.priv_id=src.priv_id"
+                   "  RETURNING src.seq"
+                   "), ins AS ("
+                   "  INSERT INTO %1priv (priv_module, priv_name, priv_descrip)"
+                   "  SELECT module, name, descrip"
+                   "    FROM src"
+                   "   WHERE priv_id IS NULL"
+                   "   ORDER BY seq"
+                   "  RETURNING priv_id"
+                   ") SELECT (SELECT COUNT(*) FROM upd) AS updated,"
+                   "         (SELECT COUNT(*) FROM ins) AS inserted;").arg(prefix));
+    upsert.bindValue(":names",    toSqlArray(names));
+    upsert.bindValue(":modules",  toSqlArray(modules));
+    upsert.bindValue(":descrips", toSqlArray(descrips));
+    if (! upsert.exec() || ! upsert.first())
+    {
+      QSqlError err = upsert.lastError();
+      errMsg = _sqlerrtxt.arg(prefix + "priv").arg(err.driverText()).arg(err.databaseText());
+      return -7;
+    }
+
+    int written = upsert.value("updated").toInt() + upsert.value("inserted").toInt();
+    if (written != list.size())
+    {
+      errMsg = TR("Saved %1 privileges in %2priv but expected %3.")
+                 .arg(written).arg(prefix).arg(list.size());
+      return -7;
+    }
+
+    if (DEBUG)
+      qDebug("LoadPriv::bulkWriteToDB() wrote %d privileges (%d existed) to %spriv",
+             list.size(), upsert.value("updated").toInt(), qPrintable(prefix));
+  }
+
+  return 0;
+}
@@ -28,7 +28,13 @@ class LoadPriv : public Loadable
 
     virtual int writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg);
 
+    static int bulkWriteToDB(const QList<Loadable*> &items,
+                             const QList<QByteArray> &data,
+                             const QString pkgname, QString &errMsg);
+
   protected:
+    virtual bool usesSource() const { return false; }
+
     QString _module;
 };
 
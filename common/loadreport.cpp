@@ -11,25 +11,32 @@
 #include "loadreport.h"
 
 #include <QDomDocument>
+#include <QHash>
 #include <QMessageBox>
+#include <QSet>
 #include <QSqlError>
 #include <QVariant>     // used by XSqlQuery::bindValue()
 #include <limits.h>
 
+#include "sqlarray.h"
 #include "xsqlquery.h"
 
+#define DEBUG false
+
 LoadReport::LoadReport(const QString &name, const int grade, const bool system,
                        const QString &comment, const QString &filename)
   : Loadable("loadreport", name, grade, system, comment, filename)
 {
-  _pkgitemtype = "R";
+  _gradeResolved = false;
+  _pkgitemtype   = "R";
 }
 
 LoadReport::LoadReport(const QDomElement & elem, const bool system,
                        QStringList &msg, QList<bool> &fatal)
   : Loadable(elem, system, msg, fatal)
 {
-  _pkgitemtype = "R";
+  _gradeResolved = false;
+  _pkgitemtype   = "R";
 
   if (elem.nodeName() != "loadreport")
   {
@@ -39,7 +46,7 @@ LoadReport::LoadReport(const QDomElement & elem, const bool system,
   }
 }
 
-int LoadReport::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+int LoadReport::prepareData(const QByteArray &pdata, QString &errMsg)
 {
   int errLine = 0;
   int errCol  = 0;
@@ -68,7 +75,6 @@ int LoadReport::writeToDB(const QByteArray &pdata, const QString pkgname, QStrin
     else if(n.nodeName() == "description")
       _comment = n.firstChild().nodeValue();
   }
-  QString report_src = doc.toString();
 
   if(_filename.isEmpty())
   {
@@ -78,10 +84,20 @@ int LoadReport::writeToDB(const QByteArray &pdata, const QString pkgname, QStrin
     return -3;
   }
 
+  return Loadable::prepareData(pdata, errMsg);
+}
+
+int LoadReport::writeToDB(const QByteArray &pdata, const QString pkgname, QString &errMsg)
+{
+  int result = prepare(pdata, errMsg);
+  if (result < 0)
+    return result;
+
   /* the following block avoids
       ERROR:  duplicate key violates unique constraint "report_name_grade_idx"
+     unless resolveGrades() has already done it for the whole package
    */
-  if (! pkgname.isEmpty())
+  if (! pkgname.isEmpty() && ! _gradeResolved)
   {
     // if there's a version of the report that's not part of this pkg
     XSqlQuery select;
@@ -141,7 +157,7 @@ int LoadReport::writeToDB(const QByteArray &pdata, const QString pkgname, QStrin
 
   _updateMql = new MetaSQLQuery("UPDATE <? literal('tablename') ?> "
                       "   SET report_descrip=<? value('notes') ?>, "
-                      "       report_source=<? value('source') ?> "
+                      "       report_source=<? literal('source') ?> "
                       " WHERE (report_id=<? value('id') ?>) "
                       "RETURNING report_id AS id;");
 
@@ -150,7 +166,7 @@ int LoadReport::writeToDB(const QByteArray &pdata, const QString pkgname, QStrin
                       "    report_grade, report_source, report_descrip"
                       ") VALUES ("
                       "    DEFAULT, <? value('name') ?>,"
-                      "    <? value('grade') ?>, <? value('source') ?>,"
+                      "    <? value('grade') ?>, <? literal('source') ?>,"
                       "    <? value('notes') ?>) "
                       "RETURNING report_id AS id;");
 
@@ -159,3 +175,130 @@ int LoadReport::writeToDB(const QByteArray &pdata, const QString pkgname, QStrin
 
   return Loadable::writeToDB(pdata, pkgname, errMsg, params);
 }
+
+/** Move every report in a package that collides with a same-name,
+    same-grade report from another package or the core application to
+    the next free grade, as writeToDB() does one report at a time.
+
+    One query finds the colliding reports and, for each of them, as many
+    free grades as the package has reports of that name. The grades are
+    then handed out here in package order so two reports of the same
+    name cannot claim the same free grade. Reports that fail to prepare
+    are left for writeToDB() to report.
+
+    @return 0 on success or a negative number if the query failed, in
+            which case writeToDB() checks each report itself
+*/
+int LoadReport::resolveGrades(const QList<Loadable*> &reports,
+                              const QList<QByteArray> &data,
+                              const QString pkgname, QString &errMsg)
+{
+  if (DEBUG)
+    qDebug("LoadReport::resolveGrades(%d reports, %s)",
+           reports.size(), qPrintable(pkgname));
+
+  if (pkgname.isEmpty())
+    return 0;
+
+  QList<LoadReport*> batch;
+  QStringList        names;
+  QList<int>         grades;
+  for (int i = 0; i < reports.size() && i < data.size(); i++)
+  {
+    LoadReport *report = dynamic_cast<LoadReport*>(reports.at(i));
+    QString     prepErr;
+    if (report && report->prepare(data.at(i), prepErr) >= 0)
+    {
+      batch.append(report);
+      names.append(report->_name);
+      grades.append(report->_grade);
+    }
+  }
+  if (batch.isEmpty())
+    return 0;
+
+  XSqlQuery gradeq;
+  gradeq.prepare("SELECT b.i, b.collides,"
+                 "       CASE WHEN b.collides THEN"
+                 "         ARRAY(SELECT sequence_value"
+                 "                 FROM sequence"
+                 "                WHERE ((sequence_value>=b.grades[b.i])"
+                 "                  AND  NOT EXISTS(SELECT 1"
+                 "                                    FROM report"
+                 "                                   WHERE ((report_name=b.names[b.i])"
+                 "                                     AND  (report_grade=sequence_value))))"
+                 "                ORDER BY sequence_value"
+                 "                LIMIT (SELECT COUNT(*)"
+                 "                         FROM unnest(b.names) AS n(name)"
+                 "                        WHERE (n.name=b.names[b.i])))"
+                 "       END AS free"
+                 "  FROM (SELECT a.*,"
+                 "               EXISTS(SELECT 1"
+                 "                        FROM report r"
+                 "                        JOIN pg_class c ON (r.tableoid=c.oid)"
+                 "                        JOIN pg_namespace n ON (relnamespace=n.oid)"
+                 "                       WHERE ((report_name=a.names[a.i])"
+                 "                         AND  (report_grade=a.grades[a.i])"
+                 "                         AND  (nspname<>a.pkgname))) AS collides"
+                 "          FROM " +
+                 sqlArrayRows(QStringList() << "names TEXT[]"
+                                            << "grades INTEGER[]"
+                                            << "pkgname TEXT") +
+                 "       ) AS b"
+                 " ORDER BY b.i;");
+  gradeq.bindValue(":names",   toSqlArray(names));
+  gradeq.bindValue(":grades",  toSqlArray(grades));
+  gradeq.bindValue(":pkgname", pkgname);
+  gradeq.exec();
+
+  QHash<int, QList<int> > freeGrades;
+  while (gradeq.next())
+  {
+    if (! gradeq.value(1).toBool())
+      continue;
+    QList<int> values;
+    QString    list = gradeq.value(2).toString();
+    list.remove('{').remove('}');
+    foreach (QString grade, list.split(',', QString::SkipEmptyParts))
+      values.append(grade.toInt());
+    freeGrades.insert(gradeq.value(0).toInt() - 1, values);
+  }
+  if (gradeq.lastError().type() != QSqlError::NoError)
+  {
+    QSqlError err = gradeq.lastError();
+    errMsg = _sqlerrtxt.arg(batch.first()->filename())
+                       .arg(err.driverText()).arg(err.databaseText());
+    return -8;
+  }
+
+  QHash<QString, QSet<int> > claimed;
+  for (int i = 0; i < batch.size(); i++)
+  {
+    if (! freeGrades.contains(i))
+      claimed[names.at(i)].insert(grades.at(i));
+  }
+
+  for (int i = 0; i < batch.size(); i++)
+  {
+    LoadReport *report = batch.at(i);
+    if (freeGrades.contains(i))
+    {
+      report->_grade = 0;       // as writeToDB() does when no grade is free
+      foreach (int grade, freeGrades.value(i))
+      {
+        if (! claimed.value(names.at(i)).contains(grade))
+        {
+          report->_grade = grade;
+          break;
+        }
+      }
+      claimed[names.at(i)].insert(report->_grade);
+      if (DEBUG)
+        qDebug("LoadReport::resolveGrades() %s grade %d -> %d",
+               qPrintable(names.at(i)), grades.at(i), report->_grade);
+    }
+    report->_gradeResolved = true;
+  }
+
+  return 0;
+}
@@ -24,6 +24,15 @@ class LoadReport : public Loadable
                QStringList &, QList<bool> &);
 
     virtual int writeToDB(const QByteArray &, const QString pkgname, QString &);
+
+    static int resolveGrades(const QList<Loadable*> &reports,
+                             const QList<QByteArray> &data,
+                             const QString pkgname, QString &errMsg);
+
+  protected:
+    bool _gradeResolved;
+
+    virtual int prepareData(const QByteArray &pdata, QString &errMsg);
 };
 
 #endif
@@ -13,6 +13,7 @@
 #include <QDomDocument>
 #include <QList>
 #include <QMessageBox>
+#include <QRegExp>
 #include <QSqlError>
 #include <QVariant>
 
@@ -39,12 +40,18 @@
 #define DEBUG false
 
 Package::Package(const QString & id)
-  : _id(id)
+  : _id(id),
+    _itemTimeout(0),
+    _online(false),
+    _timeout(0)
 {
 }
 
 Package::Package(const QDomElement & elem, QStringList &msgList,
                  QList<bool> &fatalList, XAbstractMessageHandler *handler)
+  : _itemTimeout(0),
+    _online(false),
+    _timeout(0)
 {
   if (elem.tagName() != "package")
   {
@@ -89,6 +96,52 @@ Package::Package(const QDomElement & elem, QStringList &msgList,
   _developer = elem.attribute("developer");
   _descrip = elem.attribute("descrip");
 
+  if (elem.hasAttribute("triggermode"))
+  {
+    _triggerMode = elem.attribute("triggermode").toLower();
+    if (_triggerMode != "altertable" && _triggerMode != "replica")
+    {
+      msgList << TR("The package element has an unknown triggermode '%1'. "
+                    "The alter triggers will be disabled table by table.")
+                  .arg(elem.attribute("triggermode"));
+      fatalList << false;
+      _triggerMode = QString();
+    }
+  }
+
+  QStringList timeouts;
+  timeouts << "itemtimeout" << "timeout";
+  foreach (QString attr, timeouts)
+  {
+    if (! elem.hasAttribute(attr))
+      continue;
+    bool ok = false;
+    int  seconds = elem.attribute(attr).toInt(&ok);
+    if (! ok || seconds < 0)
+    {
+      msgList << TR("The package element has a '%1' attribute that is not "
+                    "a number of seconds. There will be no time limit.")
+                  .arg(attr);
+      fatalList << false;
+    }
+    else if (attr == "itemtimeout")
+      _itemTimeout = seconds;
+    else
+      _timeout = seconds;
+  }
+
+  if (elem.hasAttribute("online"))
+  {
+    if (elem.attribute("online").contains(QRegExp("^t(rue)?$", Qt::CaseInsensitive)))
+      _online = true;
+    else if (! elem.attribute("online").contains(QRegExp("^f(alse)?$", Qt::CaseInsensitive)))
+    {
+      msgList << TR("The package element has an 'online' attribute that is "
+                    "neither 'true' nor 'false'. Using 'false'.");
+      fatalList << false;
+    }
+  }
+
   if (DEBUG)
     qDebug("Package::Package() - _name '%s', _developer '%s' => system %d",
            qPrintable(_name), qPrintable(_developer), system());
@@ -113,6 +166,7 @@ Package::Package(const QDomElement & elem, QStringList &msgList,
   }
 
   QStringList reportedErrorTags;
+  QString     lastFile;         // a checkpoint follows this file by default
 
   QDomNodeList nList = elem.childNodes();
   for(int n = 0; n < nList.count(); ++n)
@@ -150,6 +204,30 @@ Package::Package(const QDomElement & elem, QStringList &msgList,
       _finalscripts.append(new FinalScript(elemThis, msgList, fatalList));
     else if(elemThis.tagName() == "initscript")
       _initscripts.append(new InitScript(elemThis, msgList, fatalList));
+    else if (elemThis.tagName() == "checkpoint")
+    {
+      Checkpoint checkpoint;
+      checkpoint.name  = elemThis.attribute("name");
+      checkpoint.after = elemThis.attribute("after", lastFile);
+      bool duplicate = false;
+      foreach (Checkpoint c, _checkpoints)
+        duplicate = duplicate || c.name == checkpoint.name;
+
+      if (checkpoint.name.isEmpty() || duplicate)
+      {
+        msgList << TR("Every checkpoint must have a name of its own. The "
+                      "checkpoint '%1' will be ignored.").arg(checkpoint.name);
+        fatalList << false;
+      }
+      else if (checkpoint.after.isEmpty())
+      {
+        msgList << TR("The checkpoint '%1' does not follow any file. It "
+                      "will be ignored.").arg(checkpoint.name);
+        fatalList << false;
+      }
+      else
+        _checkpoints.append(checkpoint);
+    }
     else if(elemThis.tagName() == "comment" || nList.item(n).isComment())
       // Package <comment> tag or XML comment - Do nothing
       bool comments = true;  
@@ -163,6 +241,9 @@ Package::Package(const QDomElement & elem, QStringList &msgList,
                            .arg(elemThis.tagName()));
       reportedErrorTags << elemThis.tagName();
     }
+
+    if (elemThis.tagName() != "checkpoint" && elemThis.hasAttribute("file"))
+      lastFile = elemThis.attribute("file");
   }
 
   if (DEBUG)
@@ -182,6 +263,7 @@ Package::Package(const QDomElement & elem, QStringList &msgList,
     qDebug("_images:        %d", _images.size());
     qDebug("_prerequisites: %d", _prerequisites.size());
     qDebug("_scripts:       %d", _scripts.size());
+    qDebug("_checkpoints:   %d", _checkpoints.size());
   }
 }
 
@@ -199,6 +281,14 @@ QDomElement Package::createElement(QDomDocument & doc)
   QDomElement elem = doc.createElement("package");
   elem.setAttribute("id", _id);
   elem.setAttribute("version", _pkgversion.toString());
+  if (! _triggerMode.isEmpty())
+    elem.setAttribute("triggermode", _triggerMode);
+  if (_online)
+    elem.setAttribute("online", "true");
+  if (_itemTimeout > 0)
+    elem.setAttribute("itemtimeout", _itemTimeout);
+  if (_timeout > 0)
+    elem.setAttribute("timeout", _timeout);
 
   foreach (Prerequisite *i, _prerequisites)
     elem.appendChild(i->createElement(doc));
@@ -245,6 +335,14 @@ QDomElement Package::createElement(QDomDocument & doc)
   foreach (Script *i, _finalscripts)
     elem.appendChild(i->createElement(doc));
 
+  foreach (Checkpoint i, _checkpoints)
+  {
+    QDomElement checkpoint = doc.createElement("checkpoint");
+    checkpoint.setAttribute("name",  i.name);
+    checkpoint.setAttribute("after", i.after);
+    elem.appendChild(checkpoint);
+  }
+
   return elem;
 }
 
@@ -398,6 +496,17 @@ bool Package::containsView(const QString &pname) const
   return false;
 }
 
+/** Return true if the package holds no SQL scripts of any kind, only
+    items the updater writes to existing tables.
+*/
+bool Package::loadablesOnly() const
+{
+  return _initscripts.isEmpty() && _scripts.isEmpty()  &&
+         _functions.isEmpty()   && _tables.isEmpty()   &&
+         _triggers.isEmpty()    && _views.isEmpty()    &&
+         _finalscripts.isEmpty();
+}
+
 int Package::writeToDB(QString &errMsg)
 {
   XSqlQuery select;
@@ -24,6 +24,15 @@ class Prerequisite;
 class Script;
 class XAbstractMessageHandler;
 
+/* A stage boundary declared with <checkpoint name="..." after="file"/>.
+   The update commits its work so far once the file has been applied.
+ */
+struct Checkpoint
+{
+  QString name;
+  QString after;
+};
+
 class Package
 {
   public:
@@ -40,7 +49,11 @@ class Package
 
     QString developer() const { return _developer; }
     QString name()      const { return _name; }
+    int      itemTimeout() const { return _itemTimeout; }
+    bool     online()   const { return _online; }
+    int      timeout()  const { return _timeout; }
     bool     system()   const;
+    QString triggerMode() const { return _triggerMode; }
     XVersion version()  const { return _pkgversion; }
 
     QList<Script*>       _functions;
@@ -58,6 +71,7 @@ class Package
     QList<Script*>       _finalscripts;
     QList<Script*>       _initscripts;
     QList<Loadable*>     _reports;
+    QList<Checkpoint>    _checkpoints;
 
     bool containsAppScript(const QString &name)    const;
     bool containsAppUI(const QString &name)        const;
@@ -74,14 +88,19 @@ class Package
     bool containsTable(const QString &name)        const;
     bool containsTrigger(const QString &name)      const;
     bool containsView(const QString &name)         const;
+    bool loadablesOnly()                           const;
 
   protected:
     QString     _developer;
     QString     _descrip;
     QString     _id;
     XVersion    _pkgversion;
+    int         _itemTimeout;   // seconds, 0 for no limit
     QString     _name;
     QString     _notes;
+    bool        _online;
+    int         _timeout;       // seconds for the whole update, 0 for none
+    QString     _triggerMode;
 };
 
 #endif
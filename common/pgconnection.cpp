@@ -0,0 +1,477 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "pgconnection.h"
+
+#include <QObject>
+#include <QSqlDriver>
+#include <QVariant>
+#include <QVector>
+
+#include <QElapsedTimer>
+
+#include <libpq-fe.h>
+#include <stdlib.h>
+#ifdef Q_OS_WIN
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#endif
+
+#define DEBUG false
+
+static const int copyChunkSize = 65536;
+static const int waitInterval  = 100;   // milliseconds between waiting() calls
+
+QString         PgConnection::_lastSqlState;
+PgWaitListener *PgConnection::_waitListener = 0;
+
+// remember the SQLSTATE of a failed result for lastSqlState()
+static void noteSqlState(QString &lastSqlState, const PGresult *res)
+{
+  const char *state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+  lastSqlState = state ? QString::fromLatin1(state) : QString();
+}
+
+static void appendInt16(QByteArray &buffer, qint16 value)
+{
+  buffer.append((char)((value >> 8) & 0xff));
+  buffer.append((char)( value       & 0xff));
+}
+
+static void appendInt32(QByteArray &buffer, qint32 value)
+{
+  buffer.append((char)((value >> 24) & 0xff));
+  buffer.append((char)((value >> 16) & 0xff));
+  buffer.append((char)((value >>  8) & 0xff));
+  buffer.append((char)( value        & 0xff));
+}
+
+/** Return the libpq connection for the given database or 0 if the database
+    is not using the QPSQL driver.
+*/
+PGconn *PgConnection::handle(const QSqlDatabase &db)
+{
+  if (! db.isValid() || ! db.isOpen() || ! db.driver())
+    return 0;
+
+  QVariant v = db.driver()->handle();
+  if (v.isValid() && qstrcmp(v.typeName(), "PGconn*") == 0)
+    return *static_cast<PGconn **>(v.data());
+
+  return 0;
+}
+
+/** Return true if the default connection is inside a transaction block. */
+bool PgConnection::inTransaction()
+{
+  PGconn *conn = handle();
+  return conn && PQtransactionStatus(conn) == PQTRANS_INTRANS;
+}
+
+/** Return the SQLSTATE of the error from the most recent exec(),
+    execParams() or COPY, or an empty string if it succeeded. Errors
+    from XSqlQuery do not change it.
+*/
+QString PgConnection::lastSqlState()
+{
+  return _lastSqlState;
+}
+
+/** Forget the SQLSTATE of the last failure, so lastSqlState() only
+    reports errors from calls made after this.
+*/
+void PgConnection::clearSqlState()
+{
+  _lastSqlState.clear();
+}
+
+/** Ask the server to cancel whatever the default connection is running.
+    The statement, if there is one, fails with SQLSTATE 57014. This is
+    safe to call while PgConnection::exec() is waiting for a result.
+*/
+int PgConnection::cancel(QString &errMsg)
+{
+  PGconn *conn = handle();
+  if (! conn)
+  {
+    errMsg = QObject::tr("The database connection does not support "
+                         "cancelling a statement.");
+    return -1;
+  }
+
+  PGcancel *cancelHandle = PQgetCancel(conn);
+  if (! cancelHandle)
+  {
+    errMsg = QString::fromUtf8(PQerrorMessage(conn));
+    return -2;
+  }
+
+  char buffer[256];
+  int  result = 0;
+  if (! PQcancel(cancelHandle, buffer, sizeof(buffer)))
+  {
+    errMsg = QString::fromUtf8(buffer);
+    result = -3;
+  }
+  PQfreeCancel(cancelHandle);
+
+  return result;
+}
+
+/** Set the object told while exec() waits for the server. There is only
+    one. Without a listener exec() simply blocks until the server answers.
+*/
+void PgConnection::setWaitListener(PgWaitListener *listener)
+{
+  _waitListener = listener;
+}
+
+/* Wait until PQgetResult() will not block, telling the listener how long
+   the statement has been running every waitInterval milliseconds.
+ */
+static void waitForResult(PGconn *conn, PgWaitListener *listener,
+                          QElapsedTimer &timer)
+{
+  if (! listener)
+    return;
+
+  while (PQisBusy(conn))
+  {
+    int sock = PQsocket(conn);
+    if (sock < 0)
+      return;
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = waitInterval * 1000;
+    if (select(sock + 1, &readable, 0, 0, &timeout) < 0 ||
+        ! PQconsumeInput(conn))
+      return;                   // let PQgetResult() report the problem
+
+    if (PQisBusy(conn))
+      listener->waiting(timer.elapsed());
+  }
+}
+
+/** Run a single statement on the default connection with the extended
+    query protocol, sending the bytes as they are. The server treats them
+    as text in the client encoding. If the statement is a COPY ... FROM
+    STDIN it is fed copyData. The wait listener, if any, is told every so
+    often while the server works on the statement.
+
+    @param sql      the statement, which must be NUL-terminated
+    @param copyData the data for a COPY ... FROM STDIN, in text format
+    @param errMsg   set to the server's error message on failure
+    @param errPos   if not 0, set to the 1-based character position in sql
+                    the server reported the error at, or 0 if it did not
+    @param sqlState if not 0, set to the SQLSTATE of the server's error,
+                    or an empty string if there was none
+    @return 0 on success, a negative number on failure
+*/
+int PgConnection::exec(const QByteArray &sql, const QByteArray &copyData,
+                       QString &errMsg, int *errPos, QString *sqlState)
+{
+  if (errPos)
+    *errPos = 0;
+  if (sqlState)
+    sqlState->clear();
+  _lastSqlState.clear();
+
+  PGconn *conn = handle();
+  if (! conn)
+  {
+    errMsg = QObject::tr("The database connection does not support "
+                         "direct execution.");
+    return -1;
+  }
+
+  if (! PQsendQueryParams(conn, sql.constData(), 0, 0, 0, 0, 0, 0))
+  {
+    errMsg = QString::fromUtf8(PQerrorMessage(conn));
+    return -2;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+
+  int result = 0;
+  PGresult *res;
+  waitForResult(conn, _waitListener, timer);
+  while ((res = PQgetResult(conn)))
+  {
+    switch (PQresultStatus(res))
+    {
+      case PGRES_COMMAND_OK:
+      case PGRES_TUPLES_OK:
+      case PGRES_EMPTY_QUERY:
+        break;
+
+      case PGRES_COPY_IN:
+        for (int offset = 0; offset < copyData.size() && result == 0;
+             offset += copyChunkSize)
+        {
+          if (PQputCopyData(conn, copyData.constData() + offset,
+                            qMin(copyChunkSize, copyData.size() - offset)) != 1)
+          {
+            errMsg = QString::fromUtf8(PQerrorMessage(conn));
+            result = -4;
+          }
+        }
+        PQputCopyEnd(conn, result == 0 ? 0 : "aborted by the updater");
+        break;
+
+      case PGRES_COPY_OUT:
+      {
+        char *buffer = 0;
+        while (PQgetCopyData(conn, &buffer, 0) > 0)
+          PQfreemem(buffer);
+        break;
+      }
+
+      default:
+        if (result == 0)
+        {
+          errMsg = QString::fromUtf8(PQresultErrorMessage(res));
+          result = -3;
+          const char *pos = PQresultErrorField(res, PG_DIAG_STATEMENT_POSITION);
+          if (errPos && pos)
+            *errPos = atoi(pos);
+          noteSqlState(_lastSqlState, res);
+          if (sqlState)
+            *sqlState = _lastSqlState;
+        }
+        break;
+    }
+    PQclear(res);
+    waitForResult(conn, _waitListener, timer);
+  }
+
+  if (DEBUG)
+    qDebug("PgConnection::exec() sent %d bytes and %d of data, returning %d",
+           sql.size(), copyData.size(), result);
+
+  return result;
+}
+
+/** Run a COPY ... FROM STDIN statement on the default connection, feeding
+    it the given data.
+
+    @param sql    the COPY statement
+    @param data   the complete COPY stream, in whatever format sql names
+    @param errMsg set to the server's error message on failure
+    @return 0 on success, a negative number on failure
+*/
+int PgConnection::copyIn(const QString &sql, const QByteArray &data,
+                         QString &errMsg)
+{
+  int result = copyStart(sql, errMsg);
+  if (result < 0)
+    return result;
+
+  result = copyPut(data, errMsg);
+
+  QString endErr;
+  int endResult = copyEnd(endErr, result < 0);
+  if (result == 0 && endResult < 0)
+  {
+    errMsg = endErr;
+    result = endResult;
+  }
+
+  if (DEBUG)
+    qDebug("PgConnection::copyIn(%s) sent %d bytes, returning %d",
+           qPrintable(sql), data.size(), result);
+
+  return result;
+}
+
+/** Start a COPY ... FROM STDIN statement on the default connection.
+    The caller sends the data piece by piece with copyPut() and must
+    finish with copyEnd(), even if a copyPut() fails, so a stream of any
+    size can be sent without holding all of it in memory at once.
+
+    @param sql    the COPY statement
+    @param errMsg set to the server's error message on failure
+    @return 0 on success, a negative number on failure
+*/
+int PgConnection::copyStart(const QString &sql, QString &errMsg)
+{
+  PGconn *conn = handle();
+  if (! conn)
+  {
+    errMsg = QObject::tr("The database connection does not support COPY.");
+    return -1;
+  }
+
+  _lastSqlState.clear();
+  PGresult *res = PQexec(conn, sql.toUtf8().constData());
+  if (PQresultStatus(res) != PGRES_COPY_IN)
+  {
+    noteSqlState(_lastSqlState, res);
+    errMsg = QString::fromUtf8(PQresultErrorMessage(res));
+    PQclear(res);
+    return -2;
+  }
+  PQclear(res);
+
+  return 0;
+}
+
+/** Send the next part of the COPY stream started with copyStart(). */
+int PgConnection::copyPut(const QByteArray &data, QString &errMsg)
+{
+  PGconn *conn = handle();
+  if (! conn)
+  {
+    errMsg = QObject::tr("The database connection does not support COPY.");
+    return -1;
+  }
+
+  for (int offset = 0; offset < data.size(); offset += copyChunkSize)
+  {
+    if (PQputCopyData(conn, data.constData() + offset,
+                      qMin(copyChunkSize, data.size() - offset)) != 1)
+    {
+      errMsg = QString::fromUtf8(PQerrorMessage(conn));
+      return -3;
+    }
+  }
+
+  return 0;
+}
+
+/** Finish the COPY stream started with copyStart() and collect the
+    server's verdict. If abort is true the server is told to discard
+    everything sent so far and the COPY fails.
+*/
+int PgConnection::copyEnd(QString &errMsg, bool abort)
+{
+  PGconn *conn = handle();
+  if (! conn)
+  {
+    errMsg = QObject::tr("The database connection does not support COPY.");
+    return -1;
+  }
+
+  int result = 0;
+  if (PQputCopyEnd(conn, abort ? "aborted by the updater" : 0) != 1)
+  {
+    errMsg = QString::fromUtf8(PQerrorMessage(conn));
+    result = -4;
+  }
+
+  PGresult *res;
+  while ((res = PQgetResult(conn)))
+  {
+    if (PQresultStatus(res) != PGRES_COMMAND_OK && result == 0)
+    {
+      noteSqlState(_lastSqlState, res);
+      errMsg = QString::fromUtf8(PQresultErrorMessage(res));
+      result = -5;
+    }
+    PQclear(res);
+  }
+
+  return result;
+}
+
+/** Run a single statement on the default connection with its parameters
+    sent in binary format straight from the given buffers, so large values
+    are neither copied nor converted to and from QString on the way.
+    Each parameter must be in the binary representation of the type the
+    server infers for it, which for bytea is the raw bytes. A null
+    QByteArray is sent as SQL NULL.
+
+    @param sql    the statement, using $1, $2, ... as placeholders
+    @param params the parameter values
+    @param errMsg set to the server's error message on failure
+    @return 0 on success, a negative number on failure
+*/
+int PgConnection::execParams(const QString &sql, const QList<QByteArray> &params,
+                             QString &errMsg)
+{
+  PGconn *conn = handle();
+  if (! conn)
+  {
+    errMsg = QObject::tr("The database connection does not support "
+                         "binary parameters.");
+    return -1;
+  }
+
+  QVector<const char *> values(params.size());
+  QVector<int>          lengths(params.size());
+  QVector<int>          formats(params.size());
+  for (int i = 0; i < params.size(); i++)
+  {
+    values[i]  = params.at(i).isNull() ? 0 : params.at(i).constData();
+    lengths[i] = params.at(i).size();
+    formats[i] = 1;
+  }
+
+  _lastSqlState.clear();
+  PGresult *res = PQexecParams(conn, sql.toUtf8().constData(), params.size(),
+                               0, values.constData(), lengths.constData(),
+                               formats.constData(), 0);
+  int result = 0;
+  if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+      PQresultStatus(res) != PGRES_TUPLES_OK)
+  {
+    noteSqlState(_lastSqlState, res);
+    errMsg = QString::fromUtf8(PQresultErrorMessage(res));
+    result = -2;
+  }
+  PQclear(res);
+
+  if (DEBUG)
+    qDebug("PgConnection::execParams(%s) sent %d parameters, returning %d",
+           qPrintable(sql), params.size(), result);
+
+  return result;
+}
+
+QByteArray PgConnection::binaryCopyHeader()
+{
+  QByteArray header("PGCOPY\n\377\r\n\0", 11);
+  appendInt32(header, 0);       // flags
+  appendInt32(header, 0);       // header extension length
+  return header;
+}
+
+QByteArray PgConnection::binaryCopyTrailer()
+{
+  QByteArray trailer;
+  appendInt16(trailer, -1);
+  return trailer;
+}
+
+/** Append one row to a binary COPY stream. Each field must already be in
+    the binary representation of its column type, which for text columns
+    is simply the string in the client encoding. A null QByteArray is sent
+    as SQL NULL.
+*/
+void PgConnection::appendBinaryTuple(QByteArray &buffer,
+                                     const QList<QByteArray> &fields)
+{
+  appendInt16(buffer, fields.size());
+  foreach (QByteArray field, fields)
+  {
+    if (field.isNull())
+      appendInt32(buffer, -1);
+    else
+    {
+      appendInt32(buffer, field.size());
+      buffer.append(field);
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __PGCONNECTION_H__
+#define __PGCONNECTION_H__
+
+#include <QByteArray>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+
+typedef struct pg_conn PGconn;
+
+/* Told every so often while PgConnection::exec() waits for the server,
+   so the caller can keep the window alive and cancel a statement that
+   has run too long.
+ */
+class PgWaitListener
+{
+  public:
+    virtual ~PgWaitListener() {}
+    virtual void waiting(qint64 msecs) = 0;
+};
+
+/* Direct access to the libpq connection underneath the QPSQL driver for
+   the few things QSqlQuery cannot do. Everything runs on the same session
+   and inside the same transaction as the XSqlQuerys around it.
+ */
+class PgConnection
+{
+  public:
+    static PGconn *handle(const QSqlDatabase &db = QSqlDatabase::database());
+    static bool    inTransaction();
+    static int     cancel(QString &errMsg);
+    static QString lastSqlState();
+    static void    clearSqlState();
+    static void    setWaitListener(PgWaitListener *listener);
+
+    static int copyIn(const QString &sql, const QByteArray &data,
+                      QString &errMsg);
+    static int copyStart(const QString &sql, QString &errMsg);
+    static int copyPut(const QByteArray &data, QString &errMsg);
+    static int copyEnd(QString &errMsg, bool abort = false);
+    static int exec(const QByteArray &sql, const QByteArray &copyData,
+                    QString &errMsg, int *errPos = 0, QString *sqlState = 0);
+    static int execParams(const QString &sql, const QList<QByteArray> &params,
+                          QString &errMsg);
+
+    static QByteArray binaryCopyHeader();
+    static QByteArray binaryCopyTrailer();
+    static void       appendBinaryTuple(QByteArray &buffer,
+                                        const QList<QByteArray> &fields);
+
+  protected:
+    static QString         _lastSqlState;
+    static PgWaitListener *_waitListener;
+};
+
+#endif
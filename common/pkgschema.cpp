@@ -14,6 +14,7 @@
 #include <QSqlError>
 #include <QVariant>     // used by XSqlQuery::bindValue()
 
+#include <servercapabilities.h>
 #include <xsqlquery.h>
 
 #define TR(a) QObject::tr(a)
@@ -45,6 +46,9 @@ int PkgSchema::create(QString &errMsg)
     return -1;
   }
 
+  if (ServerCapabilities::hasSchema(_name))
+    return setPath(errMsg);
+
   int namespaceoid;
   XSqlQuery create;
   // Issue 8835: This SQL looks for an existing schema first.  Would be best if the createPkgSchema 
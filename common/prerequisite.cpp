@@ -11,10 +11,18 @@
 #include "prerequisite.h"
 
 #include <QDomDocument>
+#include <QHash>
 #include <QList>
+#include <QRunnable>
+#include <QSet>
+#include <QSqlDatabase>
 #include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+#include <QThreadPool>
 #include <QVariant>
 
+#include "sqlarray.h"
 #include "xabstractmessagehandler.h"
 #include "xsqlquery.h"
 
@@ -22,6 +30,8 @@
 
 #define DEBUG false
 
+int Prerequisite::_queryTimeout = 60;
+
 QString Prerequisite::_sqlerrtxt = TR("The following error was "
                                       "encountered while trying to "
                                       "check the prerequisite %1:"
@@ -263,6 +273,362 @@ QStringList Prerequisite::typeList(bool includeNone)
   return list;
 }
 
+struct PrerequisiteResult
+{
+  bool    met;
+  QString errMsg;
+};
+
+// results of Query and Dependency checks for this session; see clearCache().
+// a failure is only kept until met() reports it, so it is checked again
+// the next time instead of outliving whatever caused it
+static QHash<QString, PrerequisiteResult> _cache;
+
+/* Runs one Query prerequisite on its own connection so several can run at
+   once. QSqlDatabase connections belong to the thread that creates them,
+   so the connection is made, used, and removed in run(). The connection
+   is given the settings the main session has made, search_path among
+   them, so the query sees what it would see there; if any of them cannot
+   be copied the task gives up as though the connection had not opened.
+ */
+class PrerequisiteQueryTask : public QRunnable
+{
+  public:
+    PrerequisiteQueryTask(const QString &connection, const QString &sql,
+                          const QSqlDatabase &db, int timeout,
+                          const QStringList &setnames,
+                          const QStringList &setvalues)
+      : gotRow(false),
+        opened(false),
+        returnVal(false),
+        _connection(connection),
+        _database(db.databaseName()),
+        _driver(db.driverName()),
+        _host(db.hostName()),
+        _options(db.connectOptions()),
+        _password(db.password()),
+        _port(db.port()),
+        _setnames(setnames),
+        _setvalues(setvalues),
+        _sql(sql),
+        _timeout(timeout),
+        _user(db.userName())
+    {
+      setAutoDelete(false);
+    }
+
+    virtual void run()
+    {
+      {
+        QSqlDatabase db = QSqlDatabase::addDatabase(_driver, _connection);
+        db.setDatabaseName(_database);
+        db.setHostName(_host);
+        db.setPort(_port);
+        db.setUserName(_user);
+        db.setPassword(_password);
+        db.setConnectOptions(_options);
+        opened = db.open();
+        if (opened)
+        {
+          QSqlQuery query(db);
+          query.exec("SET standard_conforming_strings TO true;");
+          query.prepare("SELECT set_config(:name, :value, false);");
+          for (int i = 0; opened && i < _setnames.size(); i++)
+          {
+            query.bindValue(":name",  _setnames.at(i));
+            query.bindValue(":value", _setvalues.at(i));
+            opened = query.exec();
+          }
+        }
+        if (opened)
+        {
+          QSqlQuery query(db);
+          if (_timeout > 0)
+            query.exec(QString("SET statement_timeout TO %1;").arg(_timeout * 1000));
+          query.exec(_sql);
+          if (query.first())
+          {
+            gotRow    = true;
+            returnVal = query.value(0).toBool();
+          }
+          else
+            gotRow = false;
+          error = query.lastError();
+        }
+        if (db.isOpen())
+          db.close();
+        }
+      }
+      QSqlDatabase::removeDatabase(_connection);
+    }
+
+    QSqlError error;
+    bool      gotRow;
+    bool      opened;
+    bool      returnVal;
+
+  protected:
+    QString _connection;
+    QString _database;
+    QString _driver;
+    QString _host;
+    QString _options;
+    QString _password;
+    int     _port;
+    QStringList _setnames;
+    QStringList _setvalues;
+    QString _sql;
+    int     _timeout;
+    QString _user;
+};
+
+/** Check all of the Query and Dependency prerequisites in list at once and
+    remember the results so met() does not have to go back to the database.
+    The Dependency checks are folded into a single query. The Query checks
+    run concurrently, each on its own connection with the main session's
+    settings and each limited to queryTimeout() seconds. If a connection
+    cannot be opened or given those settings that check is left for met()
+    to run on the main connection.
+
+    Checks that pass are remembered for the rest of the session, so
+    opening the same package again or another package with the same
+    prerequisites does not check them again, until clearCache() is called.
+    Failures and timeouts are only remembered until met() reports them.
+*/
+void Prerequisite::checkAll(const QList<Prerequisite*> &list)
+{
+  QList<Prerequisite*> deps;
+  QList<Prerequisite*> queries;
+  QSet<QString>        keys;
+  foreach (Prerequisite *p, list)
+  {
+    QString key = p->cacheKey();
+    if (key.isEmpty() || _cache.contains(key) || keys.contains(key))
+      continue;
+    keys.insert(key);
+    if (p->_type == Dependency)
+      deps.append(p);
+    else if (p->_type == Query)
+      queries.append(p);
+  }
+
+  // a new connection starts from the server's defaults, so copy what
+  // this session has SET; ALTER ROLE and ALTER DATABASE settings apply
+  // to every connection anyway
+  QStringList setnames;
+  QStringList setvalues;
+  if (! queries.isEmpty())
+  {
+    XSqlQuery settingsq("SELECT name, current_setting(name) AS value"
+                        "  FROM pg_settings"
+                        " WHERE source = 'session'"
+                        "   AND context IN ('user', 'superuser')"
+                        "   AND name NOT IN ('transaction_isolation',"
+                        "                    'transaction_read_only',"
+                        "                    'transaction_deferrable');");
+    while (settingsq.next())
+    {
+      setnames  << settingsq.value("name").toString();
+      setvalues << settingsq.value("value").toString();
+    }
+    if (settingsq.lastError().type() != QSqlError::NoError)
+    {
+      if (DEBUG)
+        qDebug("Prerequisite::checkAll() could not read the session settings: %s",
+               qPrintable(settingsq.lastError().databaseText()));
+      queries.clear();          // met() will run them on this connection
+    }
+  }
+
+  QThreadPool                    pool;
+  QList<PrerequisiteQueryTask *> tasks;
+  QSqlDatabase db = QSqlDatabase::database();
+  if (! queries.isEmpty())
+  {
+    pool.setMaxThreadCount(qMin(queries.size(), qMax(QThread::idealThreadCount(), 2)));
+    for (int i = 0; i < queries.size(); i++)
+    {
+      PrerequisiteQueryTask *task =
+        new PrerequisiteQueryTask(QString("prerequisite%1").arg(i),
+                                  queries.at(i)->_query, db, _queryTimeout,
+                                  setnames, setvalues);
+      tasks.append(task);
+      pool.start(task);
+    }
+  }
+
+  // meanwhile check the dependencies on the main connection
+  if (! deps.isEmpty())
+  {
+    QStringList names, versions, developers;
+    foreach (Prerequisite *p, deps)
+    {
+      names      << p->_dependency->name();
+      versions   << (p->_dependency->version().isEmpty() ?
+                     QString() : p->_dependency->version());
+      developers << (p->_dependency->developer().isEmpty() ?
+                     QString() : p->_dependency->developer());
+    }
+
+    XSqlQuery query;
+    query.prepare("SELECT i, EXISTS(SELECT 1"
+                  "                   FROM pkghead"
+                  "                  WHERE ((pkghead_name=names[i])"
+                  "                    AND  (versions[i] IS NULL"
+                  "                          OR pkghead_version=versions[i])"
+                  "                    AND  (developers[i] IS NULL"
+                  "                          OR pkghead_developer=developers[i])"
+                  "                  )) AS met"
+                  "  FROM " +
+                  sqlArrayRows(QStringList() << "names TEXT[]"
+                                             << "versions TEXT[]"
+                                             << "developers TEXT[]") +
+                  ";");
+    query.bindValue(":names",      toSqlArray(names));
+    query.bindValue(":versions",   toSqlArray(versions));
+    query.bindValue(":developers", toSqlArray(developers));
+    if (query.exec())
+    {
+      while (query.next())
+      {
+        Prerequisite *p = deps.value(query.value("i").toInt() - 1);
+        if (! p)
+          continue;
+        PrerequisiteResult result;
+        result.met = query.value("met").toBool();
+        if (! result.met)
+          result.errMsg = p->dependencyMessage();
+        _cache.insert(p->cacheKey(), result);
+      }
+    }
+    else if (DEBUG)
+      qDebug("Prerequisite::checkAll() dependency check failed: %s",
+             qPrintable(query.lastError().databaseText()));
+  }
+
+  pool.waitForDone();
+  for (int i = 0; i < tasks.size(); i++)
+  {
+    PrerequisiteQueryTask *task = tasks.at(i);
+    Prerequisite          *p    = queries.at(i);
+    if (task->opened)
+    {
+      PrerequisiteResult result;
+      result.met = false;
+      if (task->gotRow)
+      {
+        result.met    = task->returnVal;
+        result.errMsg = p->_message;
+      }
+      else if (task->error.type() != QSqlError::NoError)
+        result.errMsg = _sqlerrtxt.arg(p->_name).arg(task->error.databaseText())
+                                  .arg(task->error.driverText());
+      else
+        result.errMsg = p->_message;
+      _cache.insert(p->cacheKey(), result);
+    }
+    else if (DEBUG)
+      qDebug("Prerequisite::checkAll() could not open a connection for %s",
+             qPrintable(p->_name));
+    delete task;
+  }
+}
+
+/** Forget the results of earlier prerequisite checks. Call this after
+    committing changes to the database, since they may change the results.
+*/
+void Prerequisite::clearCache()
+{
+  _cache.clear();
+}
+
+/** The maximum number of seconds checkAll() lets a Query prerequisite run,
+    or 0 for no limit.
+*/
+int Prerequisite::queryTimeout()
+{
+  return _queryTimeout;
+}
+
+void Prerequisite::setQueryTimeout(int seconds)
+{
+  _queryTimeout = seconds;
+}
+
+QString Prerequisite::cacheKey() const
+{
+  QSqlDatabase db = QSqlDatabase::database();
+  QString server = QString("%1:%2/%3 ").arg(db.hostName()).arg(db.port())
+                                       .arg(db.databaseName());
+  if (_type == Query)
+    return server + "Q " + _query;
+  else if (_type == Dependency && _dependency)
+    return server + "D " + _dependency->name() + "\n" +
+           _dependency->version() + "\n" + _dependency->developer();
+  return QString();
+}
+
+bool Prerequisite::checkQuery(QString &errMsg)
+{
+  bool returnVal = false;
+
+  XSqlQuery query;
+  query.exec(_query);
+  if (query.first())
+  {
+    returnVal = query.value(0).toBool();
+    errMsg    = _message;
+  }
+  else if (query.lastError().type() != QSqlError::NoError)
+    errMsg = _sqlerrtxt.arg(_name).arg(query.lastError().databaseText())
+                       .arg(query.lastError().driverText());
+  else
+  {
+    returnVal = false;
+    errMsg    = _message;
+  }
+
+  return returnVal;
+}
+
+bool Prerequisite::checkDependency(QString &errMsg)
+{
+  QString sql = "SELECT * FROM pkghead WHERE ((pkghead_name=:name) ";
+  if (! _dependency->version().isEmpty())
+    sql += "AND (pkghead_version=:version) ";
+  if (! _dependency->developer().isEmpty())
+    sql += "AND (pkghead_developer=:developer) ";
+  sql += ");";
+
+  XSqlQuery query;
+  query.prepare(sql);
+  query.bindValue(":name",      _dependency->name());
+  query.bindValue(":version",   _dependency->version());
+  query.bindValue(":developer", _dependency->developer());
+  query.exec();
+  if (query.first())
+    return true;
+  else if (query.lastError().type() != QSqlError::NoError)
+    errMsg = _sqlerrtxt.arg(_name).arg(query.lastError().databaseText())
+                       .arg(query.lastError().driverText());
+  else
+    errMsg = dependencyMessage();
+
+  return false;
+}
+
+QString Prerequisite::dependencyMessage()
+{
+  return TR("%1<br>The prerequisite %2 has not been met. It "
+                     "requires that the package %3 (version %4, "
+                     "developer %5) be installed first.")
+            .arg(_message).arg(_name).arg(_dependency->name())
+            .arg(_dependency->version().isEmpty() ?
+                 TR("Unspecified") : _dependency->version())
+            .arg(_dependency->developer().isEmpty() ?
+                 TR("Unspecified") : _dependency->developer());
+}
+
 bool Prerequisite::met(QString &errMsg, XAbstractMessageHandler *handler)
 {
   if (DEBUG)
@@ -277,27 +643,21 @@ bool Prerequisite::met(QString &errMsg, XAbstractMessageHandler *handler)
 
   bool returnVal = false;
 
+  QString key = cacheKey();
+  if (! key.isEmpty() && _cache.contains(key))
+  {
+    PrerequisiteResult result = _cache.value(key);
+    if (! result.met)
+      _cache.remove(key);
+    errMsg = result.errMsg;
+    return result.met;
+  }
+
   switch (_type)
   {
     case Query:
-      {
-      XSqlQuery query;
-      query.exec(_query);
-      if (query.first())
-      {
-        returnVal = query.value(0).toBool();
-        errMsg    = _message;
-      }
-      else if (query.lastError().type() != QSqlError::NoError)
-        errMsg = _sqlerrtxt.arg(_name).arg(query.lastError().databaseText())
-                           .arg(query.lastError().driverText());
-      else
-      {
-        returnVal = false;
-        errMsg    = _message;
-      }
+      returnVal = checkQuery(errMsg);
       break;
-      }
 
     case License:
       returnVal = handler->question(TR("<h1>Do you accept this license agreement?</h1><br/>%1")
@@ -309,36 +669,8 @@ bool Prerequisite::met(QString &errMsg, XAbstractMessageHandler *handler)
       break;
 
     case Dependency:
-      {
-      QString sql = "SELECT * FROM pkghead WHERE ((pkghead_name=:name) ";
-      if (! _dependency->version().isEmpty())
-        sql += "AND (pkghead_version=:version) ";
-      if (! _dependency->developer().isEmpty())
-        sql += "AND (pkghead_developer=:developer) ";
-      sql += ");";
-
-      XSqlQuery query;
-      query.prepare(sql);
-      query.bindValue(":name",      _dependency->name());
-      query.bindValue(":version",   _dependency->version());
-      query.bindValue(":developer", _dependency->developer());
-      query.exec();
-      if (query.first())
-        returnVal = true;
-      else if (query.lastError().type() != QSqlError::NoError)
-        errMsg = _sqlerrtxt.arg(_name).arg(query.lastError().databaseText())
-                           .arg(query.lastError().driverText());
-      else
-        errMsg = TR("%1<br>The prerequisite %2 has not been met. It "
-                             "requires that the package %3 (version %4, "
-                             "developer %5) be installed first.")
-                    .arg(_message).arg(_name).arg(_dependency->name())
-                    .arg(_dependency->version().isEmpty() ?
-                         TR("Unspecified") : _dependency->version())
-                    .arg(_dependency->developer().isEmpty() ?
-                         TR("Unspecified") : _dependency->developer());
+      returnVal = checkDependency(errMsg);
       break;
-      }
 
     default:
       errMsg = TR("Encountered an unknown Prerequisite type. "
@@ -347,9 +679,125 @@ bool Prerequisite::met(QString &errMsg, XAbstractMessageHandler *handler)
       break;
   }
 
+  if (! key.isEmpty() && returnVal)
+  {
+    PrerequisiteResult result;
+    result.met    = returnVal;
+    result.errMsg = errMsg;
+    _cache.insert(key, result);
+  }
+
   return returnVal;
 }
 
+/** Record all of the package dependencies in list with one statement
+    instead of several queries per dependency. Existing pkgdep records are
+    left alone and missing ones are inserted. If any of the packages
+    depended on cannot be found nothing is recorded, errMsgs gets one
+    message for each missing package, and this returns a negative number.
+*/
+int Prerequisite::writeAllToDB(const QList<Prerequisite*> &list,
+                               const QString pkgname, QStringList &errMsgs)
+{
+  if (DEBUG)
+    qDebug("Prerequisite::writeAllToDB(%d, %s, &errMsgs)",
+           list.size(), qPrintable(pkgname));
+
+  QList<Prerequisite*> deps;
+  QStringList names, versions, developers;
+  foreach (Prerequisite *p, list)
+  {
+    if (p->_type != Dependency || ! p->_dependency)
+      continue;
+    deps       << p;
+    names      << p->_dependency->name();
+    versions   << (p->_dependency->version().isEmpty() ?
+                   QString() : p->_dependency->version());
+    developers << (p->_dependency->developer().isEmpty() ?
+                   QString() : p->_dependency->developer());
+  }
+
+  if (pkgname.isEmpty() || deps.isEmpty())
+    return 0;
+
+  XSqlQuery upsert;
+  upsert.prepare("WITH pkg AS ("
+                 "  SELECT pkghead_id FROM pkghead WHERE (pkghead_name=:pkgname)"
+                 "), dep AS ("
+                 "  SELECT i, (SELECT pkghead_id"
+                 "               FROM pkghead"
+                 "              WHERE ((pkghead_name=names[i])"
+                 "                AND  (versions[i] IS NULL"
+                 "                      OR pkghead_version=versions[i])"
+                 "                AND  (developers[i] IS NULL"
+                 "                      OR pkghead_developer=developers[i]))"
+                 "              ORDER BY pkghead_version DESC LIMIT 1) AS parent_id"
+                 "    FROM " +
+                 sqlArrayRows(QStringList() << "names TEXT[]"
+                                            << "versions TEXT[]"
+                                            << "developers TEXT[]") +
+                 "), ins AS ("
+                 "  INSERT INTO pkgdep (pkgdep_id, pkgdep_pkghead_id,"
+                 "                      pkgdep_parent_pkghead_id)"
+                 "  SELECT NEXTVAL('pkgdep_pkgdep_id_seq'), pkghead_id, parent_id"
+                 "    FROM (SELECT DISTINCT pkg.pkghead_id, dep.parent_id"
+                 "            FROM pkg, dep"
+                 "           WHERE NOT EXISTS(SELECT 1 FROM dep WHERE parent_id IS NULL)"
+                 "             AND NOT EXISTS(SELECT 1 FROM pkgdep"
+                 "                             WHERE ((pkgdep_pkghead_id=pkg.pkghead_id)"
+                 "                               AND  (pkgdep_parent_pkghead_id=dep.parent_id)))"
+                 "         ) AS newdep"
+                 "  RETURNING pkgdep_id"
+                 ") SELECT i, parent_id, (SELECT pkghead_id FROM pkg) AS pkghead_id"
+                 "    FROM dep"
+                 "   ORDER BY i;");
+  upsert.bindValue(":pkgname",    pkgname);
+  upsert.bindValue(":names",      toSqlArray(names));
+  upsert.bindValue(":versions",   toSqlArray(versions));
+  upsert.bindValue(":developers", toSqlArray(developers));
+  if (! upsert.exec())
+  {
+    QSqlError err = upsert.lastError();
+    foreach (Prerequisite *p, deps)
+      errMsgs.append(_sqlerrtxt.arg(p->_name).arg(err.databaseText())
+                                .arg(err.driverText()));
+    return -1;
+  }
+
+  int result = 0;
+  while (upsert.next())
+  {
+    Prerequisite *p = deps.value(upsert.value("i").toInt() - 1);
+    if (! p)
+      continue;
+    if (upsert.value("pkghead_id").isNull())
+    {
+      errMsgs.append(TR("Could not record the dependency %1 because the "
+                        "record for package %2 was not found.")
+                       .arg(p->_name).arg(pkgname));
+      result = -2;
+    }
+    else if (upsert.value("parent_id").isNull())
+    {
+      errMsgs.append(TR("Could not record the dependency %1 of package %2 "
+                        "on package %3 (version %4, developer %5) because "
+                        "the record for %6 was not found.")
+                    .arg(p->_name).arg(pkgname).arg(p->_dependency->name())
+                    .arg(p->_dependency->version().isEmpty() ?
+                         TR("Unspecified") : p->_dependency->version())
+                    .arg(p->_dependency->developer().isEmpty() ?
+                         TR("Unspecified") : p->_dependency->developer())
+                    .arg(p->_dependency->name()));
+      result = -3;
+    }
+  }
+
+  if (DEBUG)
+    qDebug("Prerequisite::writeAllToDB() returning %d", result);
+
+  return result;
+}
+
 int Prerequisite::writeToDB(const QString pkgname, QString &errMsg)
 {
   if (DEBUG)
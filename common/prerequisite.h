@@ -84,6 +84,13 @@ class Prerequisite
     virtual bool met(QString &errMsg, XAbstractMessageHandler *handler);
     virtual int  writeToDB(const QString, QString &);
 
+    static void checkAll(const QList<Prerequisite*> &list);
+    static int  writeAllToDB(const QList<Prerequisite*> &list,
+                             const QString pkgname, QStringList &errMsgs);
+    static void clearCache();
+    static int  queryTimeout();
+    static void setQueryTimeout(int seconds);
+
     QString name() const { return _name; }
     void setName(const QString & name) { _name = name; }
 
@@ -106,6 +113,11 @@ class Prerequisite
     static QStringList typeList(bool includeNone = true);
 
   protected:
+    virtual QString cacheKey() const;
+    virtual bool    checkDependency(QString &errMsg);
+    virtual bool    checkQuery(QString &errMsg);
+    virtual QString dependencyMessage();
+
     DependsOn  *_dependency;
     QString    _message;
     QString    _name;
@@ -114,6 +126,7 @@ class Prerequisite
     
     QList<PrerequisiteProvider> _providers;
 
+    static int     _queryTimeout;
     static QString _sqlerrtxt;
 };
 
@@ -12,19 +12,27 @@
 
 #include <QDebug>
 #include <QDomDocument>
+#include <QElapsedTimer>
+#include <QRegExp>
 #include <QSqlError>
+#include <QTextCodec>
 
 #include "metasql.h"
+#include "pgconnection.h"
+#include "sqlsplitter.h"
 #include "xsqlquery.h"
 
 #define DEBUG false
 
+ScriptListener *Script::_listener    = 0;
+QTextCodec     *Script::_sourceCodec = 0;  // 0 for the locale's codec
+
 QString Script::_sqlerrtxt = TR("The following error was encountered "
                                          "while trying to import %1 into the "
                                          "database:<br><pre>%2<br>%3</pre>");
 
 Script::Script(const QString & name, OnError onError, const QString & comment)
-  : _name(name), _comment(comment), _onError(onError)
+  : _name(name), _comment(comment), _onError(onError), _runOnce(false)
 {
 }
 
@@ -35,6 +43,7 @@ Script::Script(const QDomElement & elem, QStringList &msg, QList<bool> &fatal)
     _name = elem.attribute("file");
   _onError = nameToOnError(elem.attribute("onerror"));
   _comment = elem.text();
+  readRunOnce(elem, msg, fatal);
 
   if (_name.isEmpty())
   {
@@ -59,6 +68,8 @@ QDomElement Script::createElement(QDomDocument & doc)
   elem.setAttribute("name", _name);
   elem.setAttribute("file", _name);
   elem.setAttribute("onerror", onErrorToName(_onError));
+  if (_runOnce)
+    elem.setAttribute("runonce", "true");
 
   if(!_comment.isEmpty())
     elem.appendChild(doc.createTextNode(_comment));
@@ -66,6 +77,28 @@ QDomElement Script::createElement(QDomDocument & doc)
   return elem;
 }
 
+/* A runonce script is recorded in the updater ledger when it succeeds and
+   is skipped by later updates unless its contents change. Used by the
+   constructors of Script and its subclasses that read a QDomElement.
+ */
+void Script::readRunOnce(const QDomElement &elem, QStringList &msg,
+                         QList<bool> &fatal)
+{
+  _runOnce = false;
+  if (elem.hasAttribute("runonce"))
+  {
+    if (elem.attribute("runonce").contains(QRegExp("^t(rue)?$", Qt::CaseInsensitive)))
+      _runOnce = true;
+    else if (! elem.attribute("runonce").contains(QRegExp("^f(alse)?$", Qt::CaseInsensitive)))
+    {
+      msg.append(TR("Node %1 '%2' has a 'runonce' attribute that is "
+                    "neither 'true' nor 'false'. Using 'false'.")
+                 .arg(elem.nodeName()).arg(_name));
+      fatal.append(false);
+    }
+  }
+}
+
 QString Script::onErrorToName(OnError onError)
 {
   QString str = "Default";
@@ -112,9 +145,12 @@ int Script::writeToDB(const QByteArray &pdata, const QString annotation, Paramet
     return -1;
   }
 
-  const char *data = pdata.data();
+  if (PgConnection::inTransaction())
+    return writeStatements(toClientEncoding(pdata), errMsg);
+
+  QTextCodec *codec = _sourceCodec ? _sourceCodec : QTextCodec::codecForLocale();
   XSqlQuery create;
-  create.exec(QString::fromLocal8Bit(data));
+  create.exec(codec->toUnicode(pdata));
   if (create.lastError().type() != QSqlError::NoError)
   {
     errMsg = _sqlerrtxt.arg(filename())
@@ -125,3 +161,146 @@ int Script::writeToDB(const QByteArray &pdata, const QString annotation, Paramet
 
   return 0;
 }
+
+/** Send the script to the server one statement at a time, straight from
+    the archive's buffer. This keeps memory use to the script itself plus
+    its largest statement, however large the script is, instead of
+    converting the whole script to a QString for the driver to convert
+    back again. The script must be in the client encoding, UTF-8; see
+    toClientEncoding().
+
+    Each statement goes through the extended query protocol, so an error
+    names the line it happened on, and the listener, if any, hears about
+    each statement as it finishes and can stop the script before the
+    next one starts.
+
+    Separate statements only behave like the script sent in one piece
+    inside a transaction block, where a failure in any of them aborts them
+    all.
+*/
+int Script::writeStatements(const QByteArray &pdata, QString &errMsg)
+{
+  int total = 0;
+  if (_listener)
+  {
+    SqlSplitter counter(pdata);
+    while (! counter.atEnd())
+    {
+      counter.next();
+      if (! counter.isBlank())
+        total++;
+    }
+  }
+
+  SqlSplitter   splitter(pdata);
+  QByteArray    statement;
+  QElapsedTimer timer;
+  int           count = 0;
+  while (! splitter.atEnd())
+  {
+    QByteArray next = splitter.next();
+    if (splitter.isBlank())
+      continue;
+
+    statement.resize(0);
+    statement.append(next);     // PQsendQueryParams needs a terminating NUL
+    count++;
+
+    if (_listener && _listener->stopRequested())
+    {
+      errMsg = _sqlerrtxt.arg(filename())
+                         .arg(TR("The update was stopped."))
+                         .arg(TR("before statement %1 starting at line %2")
+                              .arg(count).arg(splitter.line()));
+      return -4;
+    }
+
+    QString execErr;
+    int     errPos = 0;
+    timer.start();
+    if (PgConnection::exec(statement, splitter.copyData(), execErr, &errPos) < 0)
+    {
+      int errLine = errPos > 0 ? splitter.lineAt(errPos) : splitter.line();
+      errMsg = _sqlerrtxt.arg(filename())
+                         .arg(execErr)
+                         .arg(TR("at line %1, in statement %2 starting at line %3")
+                              .arg(errLine).arg(count).arg(splitter.line()));
+      return -3;
+    }
+    qint64 elapsed = timer.elapsed();
+
+    if (DEBUG)
+      qDebug("Script::writeStatements() %s statement %d at line %d took %lldms",
+             qPrintable(filename()), count, splitter.line(), elapsed);
+    if (_listener)
+      _listener->statementDone(this, count, total, splitter.line(), elapsed);
+  }
+
+  return 0;
+}
+
+/* PostgreSQL encoding names and the Qt codecs for them, where the names
+   differ. WINnnnn maps to windows-nnnn.
+ */
+static const struct {
+  const char *pgname;
+  const char *qtname;
+} encodingNames[] = {
+  { "UTF8",       "UTF-8"       }, { "LATIN1",     "ISO-8859-1"  },
+  { "LATIN2",     "ISO-8859-2"  }, { "LATIN3",     "ISO-8859-3"  },
+  { "LATIN4",     "ISO-8859-4"  }, { "LATIN5",     "ISO-8859-9"  },
+  { "LATIN6",     "ISO-8859-10" }, { "LATIN7",     "ISO-8859-13" },
+  { "LATIN8",     "ISO-8859-14" }, { "LATIN9",     "ISO-8859-15" },
+  { "LATIN10",    "ISO-8859-16" }, { "ISO_8859_5", "ISO-8859-5"  },
+  { "ISO_8859_6", "ISO-8859-6"  }, { "ISO_8859_7", "ISO-8859-7"  },
+  { "ISO_8859_8", "ISO-8859-8"  }, { "KOI8R",      "KOI8-R"      },
+  { "KOI8U",      "KOI8-U"      }, { "WIN866",     "IBM866"      },
+  { "SJIS",       "Shift_JIS"   }, { "EUC_JP",     "EUC-JP"      },
+  { "EUC_KR",     "EUC-KR"      }, { "BIG5",       "Big5"        },
+  { "GBK",        "GBK"         }, { "GB18030",    "GB18030"     }
+};
+
+/** Set the encoding of the scripts in the packages, by its PostgreSQL
+    name, such as WIN1252 or LATIN1. Until this is called scripts are
+    taken to be in the local 8-bit encoding, as older updaters did.
+
+    @return false if Qt has no codec for the encoding
+*/
+bool Script::setSourceEncoding(const QString &encoding)
+{
+  QString    name   = encoding.toUpper();
+  QByteArray qtname = name.toLatin1();
+  for (unsigned int i = 0; i < sizeof(encodingNames) / sizeof(*encodingNames); i++)
+  {
+    if (name == encodingNames[i].pgname)
+      qtname = encodingNames[i].qtname;
+  }
+  if (name.contains(QRegExp("^WIN\\d+$")) && name != "WIN866")
+    qtname = "windows-" + name.mid(3).toLatin1();
+
+  QTextCodec *codec = QTextCodec::codecForName(qtname);
+  if (! codec)
+    return false;
+  _sourceCodec = codec;
+  return true;
+}
+
+/** Return the script text in the client encoding, UTF-8. Scripts in
+    another source encoding (see setSourceEncoding()) are converted;
+    UTF-8 scripts are returned without a copy.
+*/
+QByteArray Script::toClientEncoding(const QByteArray &data)
+{
+  QTextCodec *codec = _sourceCodec ? _sourceCodec : QTextCodec::codecForLocale();
+  if (! codec || codec->mibEnum() == 106)       // UTF-8
+    return data;
+  return codec->toUnicode(data).toUtf8();
+}
+
+/** Set the object told about each statement of a script as it finishes.
+    There is only one for all scripts.
+*/
+void Script::setListener(ScriptListener *listener)
+{
+  _listener = listener;
+}
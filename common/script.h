@@ -18,6 +18,20 @@
 
 class QDomDocument;
 class QDomElement;
+class QTextCodec;
+class Script;
+
+/* Hears about the progress of a script that is applied a statement at a
+   time. Set one with Script::setListener().
+ */
+class ScriptListener
+{
+  public:
+    virtual ~ScriptListener() {}
+    virtual void statementDone(Script *script, int statement, int total,
+                               int line, qint64 msecs) = 0;
+    virtual bool stopRequested() { return false; }
+};
 
 #define TR(a) QObject::tr(a)
 
@@ -52,17 +66,30 @@ class Script
     virtual QString comment() const { return _comment; }
     virtual void setComment(const QString & comment) { _comment = comment; }
 
+    virtual bool runOnce() const { return _runOnce; }
+    virtual void setRunOnce(bool runOnce) { _runOnce = runOnce; }
+
     virtual int writeToDB(const QByteArray &data, const QString pkgname, ParameterList &params, QString &errMsg);
 
     static QString onErrorToName(OnError);
     static OnError nameToOnError(const QString &);
     static QStringList onErrorList(bool includeDefault = true);
+    static void setListener(ScriptListener *listener);
+    static bool setSourceEncoding(const QString &encoding);
+    static QByteArray toClientEncoding(const QByteArray &data);
 
   protected:
     QString _name;
     QString _comment;
     OnError _onError;
+    bool    _runOnce;       // skip if the updater ledger has this version
+    static ScriptListener *_listener;
+    static QTextCodec     *_sourceCodec;
     static QString _sqlerrtxt;
+
+    virtual void readRunOnce(const QDomElement &elem, QStringList &msg,
+                             QList<bool> &fatal);
+    virtual int  writeStatements(const QByteArray &data, QString &errMsg);
 };
 
 #endif
@@ -0,0 +1,809 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "scriptschedule.h"
+
+#include <QObject>
+#include <ctype.h>
+
+#include "createdbobj.h"
+#include "createfunction.h"
+#include "script.h"
+#include "sqlsplitter.h"
+
+#define DEBUG false
+
+/* Split SQL text into lower-cased identifiers and the handful of
+   punctuation marks needed to find qualified names and statement
+   boundaries. Comments are skipped and string literals become a single
+   token starting with a quote. The bodies of dollar-quoted strings are
+   scanned because that is where function definitions refer to tables
+   and other functions, with a $( token where each body starts and a $)
+   token where it ends, so callers can tell what runs when a function is
+   called from what runs when it is created.
+ */
+static QList<QByteArray> tokenize(const QByteArray &sql)
+{
+  QList<QByteArray> tokens;
+  QList<QByteArray> tags;       // the dollar quotes still open
+  const char *start = sql.constData();
+  const char *end   = start + sql.size();
+  const char *p     = start;
+
+  while (p < end)
+  {
+    unsigned char c = *p;
+    if (c == '-' && p + 1 < end && p[1] == '-')
+    {
+      while (p < end && *p != '\n')
+        p++;
+    }
+    else if (c == '/' && p + 1 < end && p[1] == '*')
+    {
+      int depth = 1;
+      p += 2;
+      while (p < end && depth > 0)
+      {
+        if (*p == '/' && p + 1 < end && p[1] == '*')
+        {
+          depth++;
+          p += 2;
+        }
+        else if (*p == '*' && p + 1 < end && p[1] == '/')
+        {
+          depth--;
+          p += 2;
+        }
+        else
+          p++;
+      }
+    }
+    else if (c == '\'')
+    {
+      bool escapes = (! tokens.isEmpty() && tokens.last() == "e" &&
+                      p > start && (p[-1] == 'e' || p[-1] == 'E'));
+      if (escapes)
+        tokens.removeLast();
+      const char *q = ++p;
+      while (p < end)
+      {
+        if (escapes && *p == '\\' && p + 1 < end)
+          p += 2;
+        else if (*p == '\'' && p + 1 < end && p[1] == '\'')
+          p += 2;
+        else if (*p == '\'')
+          break;
+        else
+          p++;
+      }
+      tokens.append("'" + QByteArray(q, p - q).toLower());
+      if (p < end)
+        p++;
+    }
+    else if (c == '"')
+    {
+      QByteArray ident;
+      p++;
+      while (p < end)
+      {
+        if (*p == '"' && p + 1 < end && p[1] == '"')
+        {
+          ident += '"';
+          p += 2;
+        }
+        else if (*p == '"')
+        {
+          p++;
+          break;
+        }
+        else
+          ident += *p++;
+      }
+      tokens.append(ident.toLower());
+    }
+    else if (c == '$')
+    {
+      // $1 is a positional parameter, $$ and $tag$ delimit a string
+      // whose contents we scan as if they were plain SQL
+      const char *q = p + 1;
+      while (q < end && (isalnum((unsigned char)*q) || *q == '_'))
+        q++;
+      if (q < end && *q == '$' && ! isdigit((unsigned char)p[1]))
+      {
+        QByteArray tag(p, q + 1 - p);
+        if (! tags.isEmpty() && tags.last() == tag)
+        {
+          tags.removeLast();
+          tokens.append("$)");
+        }
+        else
+        {
+          tags.append(tag);
+          tokens.append("$(");
+        }
+        p = q + 1;
+      }
+      else
+        p = q;
+    }
+    else if (isalpha(c) || c == '_' || (c & 0x80))
+    {
+      const char *q = p;
+      while (q < end && (isalnum((unsigned char)*q) || *q == '_' ||
+                         *q == '$' || (*q & 0x80)))
+        q++;
+      tokens.append(QByteArray(p, q - p).toLower());
+      p = q;
+    }
+    else if (isdigit(c))
+    {
+      const char *q = p;
+      while (q < end && (isalnum((unsigned char)*q) || *q == '.'))
+        q++;
+      tokens.append(QByteArray(p, q - p));
+      p = q;
+    }
+    else if (c == '.' || c == ';' || c == '(' || c == ')' || c == ',' ||
+             c == '=')
+    {
+      tokens.append(QByteArray(1, c));
+      p++;
+    }
+    else
+      p++;
+  }
+
+  return tokens;
+}
+
+static bool isIdentifier(const QByteArray &token)
+{
+  return ! token.isEmpty() && token != "." && token != ";" &&
+         token != "("      && token != ")" && token != "," && token != "=" &&
+         token.at(0) != '$' && token.at(0) != '\'' &&
+         ! isdigit((unsigned char)token.at(0));
+}
+
+/* Return the language named by the LANGUAGE clause of the CREATE FUNCTION
+   or CREATE PROCEDURE statement that tokens[from] is part of, or an empty
+   string if it has none.
+ */
+static QByteArray functionLanguage(const QList<QByteArray> &tokens, int from)
+{
+  int depth = 0;                // inside a dollar-quoted body
+  for (int i = from; i < tokens.size(); i++)
+  {
+    const QByteArray &tok = tokens.at(i);
+    if (tok == "$(")
+      depth++;
+    else if (tok == "$)")
+      depth--;
+    else if (depth == 0 && tok == ";")
+      break;
+    else if (depth == 0 && tok == "language" && i + 1 < tokens.size())
+    {
+      QByteArray language = tokens.at(i + 1);
+      return language.startsWith('\'') ? language.mid(1) : language;
+    }
+  }
+  return QByteArray();
+}
+
+/* Count the arguments between the parenthesis at tokens[open] and its
+   match, or return -1 if it is never closed.
+ */
+static int argCount(const QList<QByteArray> &tokens, int open)
+{
+  int depth = 0;
+  int args  = 0;
+  for (int i = open; i < tokens.size(); i++)
+  {
+    const QByteArray &tok = tokens.at(i);
+    if (tok == "(")
+      depth++;
+    else if (tok == ")" && --depth == 0)
+      return args;
+    else if (depth == 1 && tok == ",")
+      args = qMax(args, 1) + 1;  // the first argument may have no token
+    else if (depth == 1 && args == 0)
+      args = 1;
+    else if (tok == ";")
+      break;
+  }
+  return -1;
+}
+
+/* Return the numbers of arguments a call of the named function can pass
+   to the definitions of it in the given SQL, or -1 for a definition
+   that can take varying numbers (defaults or VARIADIC) or could not be
+   parsed.
+ */
+static QSet<int> functionArities(const QByteArray &sql, const QString &name)
+{
+  QList<QByteArray> tokens;
+  SqlSplitter       splitter(sql);
+  while (! splitter.atEnd())
+    tokens += tokenize(splitter.next());
+
+  QByteArray fname = name.toLower().toUtf8();
+  QSet<int>  arities;
+  for (int i = 0; i + 2 < tokens.size(); i++)
+  {
+    if (tokens.at(i) != "create")
+      continue;
+    int j = i + 1;
+    if (j + 1 < tokens.size() && tokens.at(j) == "or" &&
+        tokens.at(j + 1) == "replace")
+      j += 2;
+    if (j + 1 >= tokens.size() || tokens.at(j) != "function")
+      continue;
+    j++;
+    if (j + 2 < tokens.size() && tokens.at(j + 1) == ".")
+      j += 2;
+    if (j + 1 >= tokens.size() || tokens.at(j) != fname ||
+        tokens.at(j + 1) != "(")
+      continue;
+
+    int  depth    = 0;
+    int  arity    = 0;
+    bool varying  = false;
+    bool argstart = true;
+    bool closed   = false;
+    for (j++; j < tokens.size() && ! closed; j++)
+    {
+      const QByteArray &tok = tokens.at(j);
+      if (tok == "(")
+        depth++;
+      else if (tok == ")")
+        closed = (--depth == 0);
+      else if (depth == 1 && tok == ",")
+        argstart = true;
+      else if (depth == 1 && argstart)
+      {
+        argstart = false;
+        if (tok == "variadic")
+          varying = true;
+        if (tok != "out")
+          arity++;
+      }
+      else if (depth == 1 && (tok == "default" || tok == "="))
+        varying = true;
+    }
+    arities.insert(closed && ! varying ? arity : -1);
+  }
+
+  if (arities.isEmpty())
+    arities.insert(-1);
+  return arities;
+}
+
+ScriptSchedule::ScriptSchedule()
+  : _phasecount(0),
+    _reordered(false)
+{
+}
+
+ScriptSchedule::~ScriptSchedule()
+{
+}
+
+/** Append a group of scripts to the schedule. Phases are kept in the order
+    they are added and serve as the tie-breaker when the dependency graph
+    does not force an order, so a correctly ordered package is applied
+    exactly as it is written.
+*/
+void ScriptSchedule::addPhase(const QList<Script*> &scripts)
+{
+  foreach (Script *s, scripts)
+  {
+    _index.insert(s, _manifest.size());
+    _phase.insert(s, _phasecount);
+    _manifest.append(s);
+  }
+  _phasecount++;
+}
+
+int ScriptSchedule::phase(Script *script) const
+{
+  return _phase.value(script, -1);
+}
+
+QList<Script*> ScriptSchedule::dependencies(Script *script) const
+{
+  return _before.values(script);
+}
+
+/** Return the names of the database objects the given SQL needs to exist
+    when it runs.
+    Only qualified names and names where a relation or function must be
+    are counted, so column and variable names that happen to match an
+    object do not: names after FROM, JOIN, INTO, UPDATE, TABLE, REFERENCES and the like
+    (and after the commas of a FROM or TRUNCATE list), and the target of
+    ON in statements such as CREATE TRIGGER, are returned as name or
+    schema.name. Function calls are returned as name( and as name(n)
+    with the number of arguments, with the schema if the call has one.
+    The objects being created or dropped by a statement are not
+    references. Neither are the names in the body of a function written
+    in anything but SQL, since the server only looks those up when the
+    function is called; SQL function bodies and DO blocks are checked or
+    run at once, so their names are included.
+*/
+QSet<QString> ScriptSchedule::referencedObjects(const QByteArray &sql)
+{
+  static QSet<QByteArray> createModifiers;
+  static QSet<QByteArray> objectKinds;
+  static QSet<QByteArray> blockStarts;
+  static QSet<QByteArray> relationIntros;
+  static QSet<QByteArray> listEnds;
+  if (createModifiers.isEmpty())
+  {
+    createModifiers << "or" << "replace" << "temp" << "temporary"
+                    << "unlogged" << "materialized" << "constraint"
+                    << "recursive" << "global" << "local" << "unique";
+    objectKinds     << "table" << "view" << "function" << "trigger"
+                    << "index" << "sequence" << "type" << "aggregate"
+                    << "domain" << "rule" << "schema" << "procedure";
+    blockStarts     << "begin" << "then" << "else" << "loop" << "declare";
+    relationIntros  << "from" << "join" << "into" << "update" << "table"
+                    << "references" << "only" << "truncate" << "view"
+                    << "lock" << "inherits" << "setof" << "returns"
+                    << "exists" << "copy";
+    listEnds        << "where" << "group" << "order" << "having" << "limit"
+                    << "offset" << "union" << "except" << "intersect"
+                    << "on" << "using" << "set" << "values" << "select"
+                    << "returning" << "window" << "for" << "(" << ")";
+  }
+
+  // tokenize statement by statement so COPY data is not mistaken for SQL
+  QList<QByteArray> tokens;
+  SqlSplitter       splitter(sql);
+  while (! splitter.atEnd())
+    tokens += tokenize(splitter.next());
+
+  QSet<QString>     refs;
+  bool stmtstart = true;
+  bool dropping  = false;
+  bool ddl       = false;       // ON names a table, not a join condition
+  bool inList    = false;       // after a FROM or TRUNCATE relation
+  bool runtime   = false;       // function bodies are only run when called
+
+  for (int i = 0; i < tokens.size(); i++)
+  {
+    const QByteArray &tok = tokens.at(i);
+    if (tok == "$(" && runtime)
+    {
+      for (int depth = 0; i < tokens.size(); i++)
+      {
+        if (tokens.at(i) == "$(")
+          depth++;
+        else if (tokens.at(i) == "$)" && --depth == 0)
+          break;
+      }
+      stmtstart = false;
+      continue;
+    }
+    if (tok == ";" || tok == "$(" || blockStarts.contains(tok))
+    {
+      stmtstart = true;
+      dropping  = false;
+      ddl       = false;
+      inList    = false;
+      runtime   = runtime && tok != ";";
+      continue;
+    }
+    if (tok == "$)")
+    {
+      stmtstart = false;
+      continue;
+    }
+
+    if (stmtstart && tok == "drop")
+    {
+      stmtstart = false;
+      dropping  = true;
+      ddl       = true;
+      continue;
+    }
+
+    if (stmtstart && (tok == "alter" || tok == "comment" ||
+                      tok == "grant" || tok == "revoke"))
+      ddl = true;
+
+    if (stmtstart && tok == "create")
+    {
+      ddl = true;
+      int j = i + 1;
+      while (j < tokens.size() && createModifiers.contains(tokens.at(j)))
+        j++;
+      if (j < tokens.size() && objectKinds.contains(tokens.at(j)))
+      {
+        runtime = (tokens.at(j) == "function" || tokens.at(j) == "procedure") &&
+                  functionLanguage(tokens, j) != "sql";
+        j++;
+        if (j + 2 < tokens.size() && tokens.at(j) == "if" &&
+            tokens.at(j + 1) == "not" && tokens.at(j + 2) == "exists")
+          j += 3;
+        if (j < tokens.size() && isIdentifier(tokens.at(j)))
+          j++;
+        if (j + 1 < tokens.size() && tokens.at(j) == "." &&
+            isIdentifier(tokens.at(j + 1)))
+          j += 2;
+        i = j - 1;
+      }
+      stmtstart = false;
+      continue;
+    }
+
+    stmtstart = false;
+    if (dropping)
+    {
+      if (tok == "on")  // DROP TRIGGER x ON tbl still needs tbl
+        dropping = false;
+      continue;
+    }
+
+    if (inList && listEnds.contains(tok))
+      inList = false;
+    if (tok == "as" || tok == "select")   // CREATE VIEW ... AS SELECT ... ON
+      ddl = false;
+    if (! isIdentifier(tok) || (i > 0 && tokens.at(i - 1) == "."))
+      continue;
+
+    QByteArray prev     = i > 0 ? tokens.at(i - 1) : QByteArray();
+    bool       relation = relationIntros.contains(prev) ||
+                          (prev == "on" && ddl) || (prev == "," && inList) ||
+                          (prev == "(" && i > 1 && tokens.at(i - 2) == "inherits");
+    if (relationIntros.contains(tok) || tok == "if" || (tok == "on" && ddl))
+      continue;
+
+    QByteArray name = tok;
+    int        end  = i + 1;
+    if (i + 2 < tokens.size() && tokens.at(i + 1) == "." &&
+        isIdentifier(tokens.at(i + 2)))
+    {
+      name = tok + "." + tokens.at(i + 2);
+      end  = i + 3;
+    }
+
+    if (relation || end == i + 3)
+      refs.insert(QString::fromUtf8(name));
+    if (relation && (prev == "from" || prev == "join" || prev == "truncate" ||
+                     prev == "only" || prev == ","))
+      inList = true;
+    if (end < tokens.size() && tokens.at(end) == "(")
+    {
+      refs.insert(QString::fromUtf8(name + "("));
+      int args = argCount(tokens, end);
+      if (args >= 0)
+        refs.insert(QString::fromUtf8(name + "(") + QString::number(args) + ")");
+    }
+    i = end - 1;
+  }
+
+  return refs;
+}
+
+// table lock modes from weakest to strongest, as far as lockedTables() cares
+static const char *lockModes[] = {
+  "SHARE UPDATE EXCLUSIVE", "SHARE", "SHARE ROW EXCLUSIVE", "ACCESS EXCLUSIVE"
+};
+
+/** Return whichever of two table lock modes blocks everything the other
+    does. An empty mode is weaker than any other.
+*/
+QString ScriptSchedule::strongerLock(const QString &a, const QString &b)
+{
+  int rankA = -1;
+  int rankB = -1;
+  for (unsigned int i = 0; i < sizeof(lockModes) / sizeof(*lockModes); i++)
+  {
+    if (a == lockModes[i]) rankA = i;
+    if (b == lockModes[i]) rankB = i;
+  }
+  return rankA >= rankB ? a : b;
+}
+
+/** Return the tables the given SQL takes a strong lock on, each with the
+    lock mode the strongest statement needs: ACCESS EXCLUSIVE for the
+    targets of ALTER TABLE, DROP TABLE, TRUNCATE and DROP TRIGGER ... ON,
+    SHARE ROW EXCLUSIVE for CREATE TRIGGER ... ON and SHARE for
+    CREATE INDEX ... ON (SHARE UPDATE EXCLUSIVE if CONCURRENTLY).
+    Names are returned lower-cased, schema-qualified if the SQL qualifies
+    them. Statements inside DO blocks and function bodies are included,
+    so the result may name tables that are never touched.
+*/
+QMap<QString, QString> ScriptSchedule::lockedTables(const QByteArray &sql)
+{
+  static QSet<QByteArray> blockStarts;
+  if (blockStarts.isEmpty())
+    blockStarts << "begin" << "then" << "else" << "loop" << "declare";
+
+  QList<QByteArray> tokens;
+  SqlSplitter       splitter(sql);
+  while (! splitter.atEnd())
+    tokens += tokenize(splitter.next());
+
+  QMap<QString, QString> tables;
+  bool stmtstart = true;
+  for (int i = 0; i < tokens.size(); i++)
+  {
+    const QByteArray &tok = tokens.at(i);
+    if (tok == ";" || tok == "$(" || blockStarts.contains(tok))
+    {
+      stmtstart = true;
+      continue;
+    }
+    if (! stmtstart)
+      continue;
+    stmtstart = false;
+
+    // find where the table name starts, if this statement has one
+    int     j        = i + 1;
+    bool    multiple = false;   // DROP TABLE and TRUNCATE take a list
+    QString mode("ACCESS EXCLUSIVE");
+    if ((tok == "alter" || tok == "drop") && j < tokens.size() &&
+        tokens.at(j) == "table")
+    {
+      multiple = (tok == "drop");
+      j++;
+    }
+    else if (tok == "truncate")
+    {
+      multiple = true;
+      if (j < tokens.size() && tokens.at(j) == "table")
+        j++;
+    }
+    else if ((tok == "create" || tok == "drop") && j < tokens.size())
+    {
+      while (j < tokens.size() && (tokens.at(j) == "unique" ||
+                                   tokens.at(j) == "constraint" ||
+                                   tokens.at(j) == "or" ||
+                                   tokens.at(j) == "replace"))
+        j++;
+      if (j >= tokens.size() ||
+          (tokens.at(j) != "index" && tokens.at(j) != "trigger"))
+        continue;
+      if (tok == "create" && tokens.at(j) == "index")
+        mode = (j + 1 < tokens.size() && tokens.at(j + 1) == "concurrently")
+               ? "SHARE UPDATE EXCLUSIVE" : "SHARE";
+      else if (tok == "create")
+        mode = "SHARE ROW EXCLUSIVE";
+      while (j < tokens.size() && tokens.at(j) != "on" && tokens.at(j) != ";")
+        j++;
+      if (j >= tokens.size() || tokens.at(j) != "on")
+        continue;
+      j++;
+    }
+    else
+      continue;
+
+    if (j + 1 < tokens.size() && tokens.at(j) == "if" && tokens.at(j + 1) == "exists")
+      j += 2;
+    do
+    {
+      if (j < tokens.size() && tokens.at(j) == "only")
+        j++;
+      if (j >= tokens.size() || ! isIdentifier(tokens.at(j)))
+        break;
+      QString table;
+      if (j + 2 < tokens.size() && tokens.at(j + 1) == "." &&
+          isIdentifier(tokens.at(j + 2)))
+      {
+        table = QString::fromUtf8(tokens.at(j) + "." + tokens.at(j + 2));
+        j += 3;
+      }
+      else
+        table = QString::fromUtf8(tokens.at(j++));
+      tables.insert(table, strongerLock(tables.value(table), mode));
+    } while (multiple && j + 1 < tokens.size() && tokens.at(j++) == ",");
+  }
+
+  return tables;
+}
+
+/* Return the scripts in the topological order of the given dependencies
+   that stays closest to the phase and manifest order, leaving out any
+   script caught in a cycle. If level is given, it is set to how many
+   scripts must run before each one, following the longest chain.
+ */
+QList<Script*> ScriptSchedule::sortScripts(const QMultiHash<Script*, Script*> &after,
+                                           QHash<Script*, int> *level) const
+{
+  QHash<Script*, int> pending;
+  foreach (Script *s, _manifest)
+    foreach (Script *next, after.values(s))
+      pending[next]++;
+
+  QMap<int, Script*> ready;
+  foreach (Script *s, _manifest)
+  {
+    if (level)
+      level->insert(s, 0);
+    if (pending.value(s) == 0)
+      ready.insert(_index.value(s), s);
+  }
+
+  QList<Script*> sorted;
+  while (! ready.isEmpty())
+  {
+    Script *s = ready.begin().value();
+    ready.erase(ready.begin());
+    sorted.append(s);
+
+    foreach (Script *next, after.values(s))
+    {
+      if (level && level->value(next) < level->value(s) + 1)
+        (*level)[next] = level->value(s) + 1;
+      if (--pending[next] == 0)
+        ready.insert(_index.value(next), next);
+    }
+  }
+
+  return sorted;
+}
+
+/** Build the dependency graph and compute the schedule.
+
+    Each CreateDBObj other than a trigger declares the object named in
+    the package.xml. A script that needs an object declared by another
+    script while it is being applied, as referencedObjects() finds them,
+    must run after it. Names used only inside PL/pgSQL and other non-SQL
+    function bodies are looked up when the function is called, so they
+    neither move a script nor get reported. The schedule is the topological order that
+    stays closest to the phase and manifest order; scripts whose position
+    changes are reported in msgList so the package author can fix the
+    package.xml. The dependencies between scripts caught in a cycle are
+    ignored, so they keep their manifest order among themselves and
+    scripts that depend on any of them still follow them all.
+
+    @return the number of messages added to msgList
+*/
+int ScriptSchedule::build(const QMap<QString, QByteArray> &files,
+                          const QString &prefix, const QString &pkgname,
+                          QStringList &msgList)
+{
+  int msgcount = msgList.size();
+
+  _before.clear();
+  _order.clear();
+  _readySets.clear();
+  _reordered = false;
+
+  QList<Script*>   declarers;
+  QStringList      declnames;
+  QStringList      declqualified;
+  QList<QSet<int> > declarities;        // empty for tables and views
+  foreach (Script *s, _manifest)
+  {
+    CreateDBObj *obj = dynamic_cast<CreateDBObj*>(s);
+    if (obj && obj->pkgitemtype() != "G" && ! obj->name().isEmpty())
+    {
+      declarers.append(s);
+      declnames.append(obj->name().toLower());
+      declqualified.append(obj->destSchema(pkgname).toLower() + "." +
+                           obj->name().toLower());
+      if (dynamic_cast<CreateFunction*>(s))
+        declarities.append(functionArities(files.value(prefix + s->filename()),
+                                           obj->name()));
+      else
+        declarities.append(QSet<int>());
+    }
+  }
+
+  QMultiHash<Script*, Script*> after;
+  foreach (Script *s, _manifest)
+  {
+    QSet<QString> refs = referencedObjects(files.value(prefix + s->filename()));
+    for (int d = 0; d < declarers.size(); d++)
+    {
+      Script *owner = declarers.at(d);
+      if (owner == s || _before.contains(s, owner))
+        continue;
+
+      QStringList wanted;
+      if (declarities.at(d).isEmpty())
+        wanted << declnames.at(d) << declqualified.at(d);
+      foreach (int arity, declarities.at(d))
+      {
+        QString args = arity < 0 ? QString("(") : QString("(%1)").arg(arity);
+        wanted << declnames.at(d) + args << declqualified.at(d) + args;
+      }
+
+      bool refers = false;
+      foreach (QString name, wanted)
+        refers = refers || refs.contains(name);
+      if (refers)
+      {
+        if (DEBUG)
+          qDebug("ScriptSchedule::build() %s depends on %s",
+                 qPrintable(s->filename()), qPrintable(owner->filename()));
+        _before.insert(s, owner);
+        after.insert(owner, s);
+      }
+    }
+  }
+
+  // scripts in a cycle can't all follow each other, so drop the
+  // dependencies between them and let them keep their manifest order
+  QSet<Script*> remaining = QSet<Script*>::fromList(_manifest);
+  foreach (Script *s, sortScripts(after))
+    remaining.remove(s);
+
+  QHash<Script*, QSet<Script*> > reached;  // scripts that must follow
+  foreach (Script *s, remaining)
+  {
+    QList<Script*> todo = after.values(s);
+    while (! todo.isEmpty())
+    {
+      Script *next = todo.takeFirst();
+      if (remaining.contains(next) && ! reached[s].contains(next))
+      {
+        reached[s].insert(next);
+        todo += after.values(next);
+      }
+    }
+  }
+
+  QStringList cyclic;
+  foreach (Script *s, _manifest)
+  {
+    foreach (Script *owner, _before.values(s))
+    {
+      if (reached.value(s).contains(owner))     // owner depends on s too
+      {
+        _before.remove(s, owner);
+        after.remove(owner, s);
+        if (! cyclic.contains(s->filename()))
+          cyclic.append(s->filename());
+      }
+    }
+  }
+
+  QHash<Script*, int> level;
+  _order = sortScripts(after, &level);
+
+  int maxlevel = -1;
+  foreach (Script *s, _order)
+    maxlevel = qMax(maxlevel, level.value(s));
+
+  if (! cyclic.isEmpty())
+    msgList.append(TR("The scripts %1 depend on each other in a cycle and "
+                      "will be applied in package.xml order.")
+                   .arg(cyclic.join(", ")));
+
+  QSet<QString> reported;
+  foreach (Script *s, _manifest)
+  {
+    foreach (Script *owner, _before.values(s))
+    {
+      if (_index.value(owner) > _index.value(s) &&
+          ! reported.contains(s->filename() + "\n" + owner->filename()))
+      {
+        reported.insert(s->filename() + "\n" + owner->filename());
+        msgList.append(TR("%1 refers to %2 (%3), which is listed later in "
+                          "the package. %1 will be applied after %3.")
+                       .arg(s->filename(), owner->name(), owner->filename()));
+      }
+    }
+  }
+
+  for (int i = 0; i <= maxlevel; i++)
+    _readySets.append(QList<Script*>());
+  foreach (Script *s, _order)
+    _readySets[level.value(s)].append(s);
+
+  _reordered = (_order != _manifest);
+
+  if (DEBUG)
+    qDebug("ScriptSchedule::build() %d scripts in %d ready sets, reordered %d",
+           _order.size(), _readySets.size(), _reordered);
+
+  return msgList.size() - msgcount;
+}
@@ -0,0 +1,61 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __SCRIPTSCHEDULE_H__
+#define __SCRIPTSCHEDULE_H__
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+class Script;
+
+#define TR(a) QObject::tr(a)
+
+class ScriptSchedule
+{
+  public:
+    ScriptSchedule();
+    virtual ~ScriptSchedule();
+
+    virtual void addPhase(const QList<Script*> &scripts);
+    virtual int  build(const QMap<QString, QByteArray> &files,
+                       const QString &prefix, const QString &pkgname,
+                       QStringList &msgList);
+
+    virtual QList<Script*>         dependencies(Script *script) const;
+    virtual bool                   isReordered() const { return _reordered; }
+    virtual QList<Script*>         order()       const { return _order; }
+    virtual int                    phase(Script *script) const;
+    virtual QList<QList<Script*> > readySets()   const { return _readySets; }
+
+    static QMap<QString, QString> lockedTables(const QByteArray &sql);
+    static QSet<QString>          referencedObjects(const QByteArray &sql);
+    static QString                strongerLock(const QString &a, const QString &b);
+
+  protected:
+    QList<Script*> sortScripts(const QMultiHash<Script*, Script*> &after,
+                               QHash<Script*, int> *level = 0) const;
+
+    QMultiHash<Script*, Script*> _before;     // script -> scripts it follows
+    QHash<Script*, int>          _index;      // position in phase+manifest order
+    QList<Script*>               _manifest;
+    QList<Script*>               _order;
+    QHash<Script*, int>          _phase;
+    int                          _phasecount;
+    QList<QList<Script*> >       _readySets;
+    bool                         _reordered;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "servercapabilities.h"
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QSqlError>
+#include <QStringList>
+#include <QVariant>
+
+#include "pgconnection.h"
+#include "sqlarray.h"
+#include "xsqlquery.h"
+
+#define TR(a) QObject::tr(a)
+
+#define DEBUG false
+
+// the functions and tables the updater asks about
+static const char *probedFunctions[] = {
+  "createpkgschema", "dropifexists", "geteffectivextuser", "savemetasql", 0
+};
+static const char *probedTables[] = {
+  "public.updaterhist", "public.updaterledger", 0
+};
+
+// the facts for this session; see clearCache()
+static bool                _known   = false;
+static int                 _version = 0;
+static QHash<QString, int> _functions;  // name -> largest number of args
+static QSet<QString>       _schemas;    // lower case
+static QSet<QString>       _tables;     // schema.name
+
+/** Read the facts from the database with a single query.
+
+    @return 0 on success or -1 if the query failed, in which case the
+            facts stay unknown and errMsg says why
+*/
+int ServerCapabilities::probe(QString &errMsg)
+{
+  QStringList functions;
+  for (int i = 0; probedFunctions[i]; i++)
+    functions.append(probedFunctions[i]);
+  QStringList tables;
+  for (int i = 0; probedTables[i]; i++)
+    tables.append(probedTables[i]);
+
+  XSqlQuery probeq;
+  probeq.prepare("SELECT 'version' AS kind,"
+                 "       current_setting('server_version_num') AS name, 0 AS args"
+                 " UNION ALL"
+                 " SELECT 'function', proname, CAST(MAX(pronargs) AS INTEGER)"
+                 "   FROM pg_proc"
+                 "  WHERE proname = ANY(CAST(:functions AS TEXT[]))"
+                 "  GROUP BY proname"
+                 " UNION ALL"
+                 " SELECT 'schema', LOWER(nspname), 0"
+                 "   FROM pg_namespace"
+                 " UNION ALL"
+                 " SELECT 'table', nspname || '.' || relname, 0"
+                 "   FROM pg_class"
+                 "   JOIN pg_namespace ON (relnamespace=pg_namespace.oid)"
+                 "  WHERE nspname || '.' || relname = ANY(CAST(:tables AS TEXT[]));");
+  probeq.bindValue(":functions", toSqlArray(functions));
+  probeq.bindValue(":tables",    toSqlArray(tables));
+  probeq.exec();
+  if (probeq.lastError().type() != QSqlError::NoError)
+  {
+    errMsg = TR("Could not read the database server's capabilities: %1")
+             .arg(probeq.lastError().databaseText());
+    return -1;
+  }
+
+  clearCache();
+  while (probeq.next())
+  {
+    QString kind = probeq.value("kind").toString();
+    QString name = probeq.value("name").toString();
+    if (kind == "version")
+      _version = name.toInt();
+    else if (kind == "function")
+      _functions.insert(name, probeq.value("args").toInt());
+    else if (kind == "schema")
+      _schemas.insert(name);
+    else if (kind == "table")
+      _tables.insert(name);
+  }
+  _known = true;
+
+  if (DEBUG)
+    qDebug("ServerCapabilities::probe() version %d, %d functions, "
+           "%d schemas, %d tables", _version, _functions.size(),
+           _schemas.size(), _tables.size());
+
+  return 0;
+}
+
+/** Forget the facts. Call this after committing changes to the database,
+    since they may change them.
+*/
+void ServerCapabilities::clearCache()
+{
+  _known   = false;
+  _version = 0;
+  _functions.clear();
+  _schemas.clear();
+  _tables.clear();
+}
+
+/** Return true if the facts have been read, reading them now if that is
+    safe.
+*/
+bool ServerCapabilities::isKnown()
+{
+  if (! _known && PgConnection::handle() && ! PgConnection::inTransaction())
+  {
+    QString errMsg;
+    if (probe(errMsg) < 0 && DEBUG)
+      qDebug("ServerCapabilities::isKnown() %s", qPrintable(errMsg));
+  }
+  return _known;
+}
+
+/** Return the server version as a number like 90603, or 0 if unknown. */
+int ServerCapabilities::serverVersion()
+{
+  return isKnown() ? _version : 0;
+}
+
+/** Return the largest number of arguments taken by a function with the
+    given name, or -1 if there is no such function or it was not probed.
+*/
+int ServerCapabilities::functionArgs(const QString &name)
+{
+  return isKnown() ? _functions.value(name.toLower(), -1) : -1;
+}
+
+bool ServerCapabilities::hasSchema(const QString &name)
+{
+  return isKnown() && _schemas.contains(name.toLower());
+}
+
+bool ServerCapabilities::hasTable(const QString &schema, const QString &name)
+{
+  return isKnown() && _tables.contains(schema + "." + name);
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __SERVERCAPABILITIES_H__
+#define __SERVERCAPABILITIES_H__
+
+#include <QString>
+
+/* Facts about the database server that the writers need to choose how to
+   talk to it: the server version, which of the functions the updater
+   calls exist and with how many arguments, which schemas exist, and
+   whether the updater's own tables are there. They are read with one
+   query and kept until clearCache() is called.
+
+   isKnown() only reads the facts outside of a transaction. A caller that
+   calls probe() inside one sees its own uncommitted changes, so it must
+   call clearCache() when the transaction ends, or a rollback leaves the
+   facts wrong. Until they have been read, isKnown() returns false and
+   callers should find out for themselves.
+ */
+class ServerCapabilities
+{
+  public:
+    static void clearCache();
+    static int  functionArgs(const QString &name);
+    static bool hasSchema(const QString &name);
+    static bool hasTable(const QString &schema, const QString &name);
+    static bool isKnown();
+    static int  probe(QString &errMsg);
+    static int  serverVersion();
+};
+
+#endif
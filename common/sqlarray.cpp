@@ -0,0 +1,56 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "sqlarray.h"
+
+QString toSqlArray(const QStringList &list)
+{
+  QString result("{");
+  for (int i = 0; i < list.size(); i++)
+  {
+    if (i > 0)
+      result += ",";
+    if (list.at(i).isNull())
+      result += "NULL";
+    else
+    {
+      QString elem = list.at(i);
+      elem.replace("\\", "\\\\").replace("\"", "\\\"");
+      result += "\"" + elem + "\"";
+    }
+  }
+  result += "}";
+
+  return result;
+}
+
+QString toSqlArray(const QList<int> &list)
+{
+  QStringList elems;
+  foreach (int i, list)
+    elems.append(QString::number(i));
+
+  return "{" + elems.join(",") + "}";
+}
+
+QString sqlArrayRows(const QStringList &columns, const QString &alias)
+{
+  QStringList casts;
+  foreach (QString column, columns)
+  {
+    QString name = column.section(' ', 0, 0);
+    casts.append(QString("CAST(:%1 AS %2) AS %1")
+                 .arg(name, column.section(' ', 1)));
+  }
+
+  return QString("(SELECT generate_series(1, array_length(%1, 1)) AS i, *"
+                 "   FROM (SELECT %2) AS arr) AS %3")
+           .arg(columns.value(0).section(' ', 0, 0), casts.join(", "), alias);
+}
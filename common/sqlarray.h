@@ -0,0 +1,33 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __SQLARRAY_H__
+#define __SQLARRAY_H__
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+/* Build PostgreSQL array literals to bind as a single query parameter,
+   for example CAST(:names AS TEXT[]). Null strings become NULL elements.
+ */
+QString toSqlArray(const QStringList &list);
+QString toSqlArray(const QList<int> &list);
+
+/* Return a subquery for a FROM clause that turns parallel arrays, bound
+   with toSqlArray(), into one row per element. Each column is given as
+   "name TYPE" and becomes CAST(:name AS TYPE) AS name, so the rows carry
+   the whole arrays and a column i counting from 1; refer to an element
+   as alias.name[alias.i]. The first column must be an array, since it
+   sets the number of rows; later ones may also be scalars.
+ */
+QString sqlArrayRows(const QStringList &columns, const QString &alias = "a");
+
+#endif
@@ -0,0 +1,391 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "sqlsplitter.h"
+
+#include <QRegExp>
+#include <QString>
+
+#include <ctype.h>
+
+#define DEBUG false
+
+static bool isIdentChar(char c)
+{
+  return isalnum((unsigned char)c) || c == '_' || c == '$' || (c & 0x80);
+}
+
+// is the word of the given length the given lower-case keyword?
+static bool isWord(const char *word, int length, const char *keyword)
+{
+  return length == (int)qstrlen(keyword) &&
+         qstrnicmp(word, keyword, length) == 0;
+}
+
+// skip white space, comments and stray semicolons
+static const char *skipBlank(const char *p, const char *end)
+{
+  while (p < end)
+  {
+    if (isspace((unsigned char)*p) || *p == ';')
+      p++;
+    else if (*p == '-' && p + 1 < end && p[1] == '-')
+    {
+      while (p < end && *p != '\n')
+        p++;
+    }
+    else if (*p == '/' && p + 1 < end && p[1] == '*')
+    {
+      int nesting = 1;
+      p += 2;
+      while (p < end && nesting > 0)
+      {
+        if (*p == '/' && p + 1 < end && p[1] == '*')
+        {
+          nesting++;
+          p += 2;
+        }
+        else if (*p == '*' && p + 1 < end && p[1] == '/')
+        {
+          nesting--;
+          p += 2;
+        }
+        else
+          p++;
+      }
+    }
+    else
+      break;
+  }
+  return p;
+}
+
+SqlSplitter::SqlSplitter(const QByteArray &sql)
+  : _line(1),
+    _linePos(0),
+    _startLine(1),
+    _sql(sql),
+    _pos(0)
+{
+}
+
+SqlSplitter::~SqlSplitter()
+{
+}
+
+/** Return the next word of a statement starting at pos and move pos past
+    it, skipping blanks and comments. Keywords and unquoted identifiers are
+    lower-cased, quoted identifiers keep their quotes, and anything else is
+    returned one character at a time. This is enough to recognize the
+    leading words of a statement; it does not understand string literals.
+
+    @param statement the SQL to read
+    @param pos       where to start reading and, on return, where the
+                     word ends
+    @param wordStart if not null, gets where the word begins
+    @return the word or an empty QByteArray at the end of the statement
+*/
+QByteArray SqlSplitter::nextWord(const QByteArray &statement, int &pos,
+                                 int *wordStart)
+{
+  const char *start = statement.constData();
+  const char *end   = start + statement.size();
+  const char *p     = skipBlank(start + qMin(pos, statement.size()), end);
+
+  if (wordStart)
+    *wordStart = p - start;
+
+  QByteArray result;
+  if (p >= end)
+    ;
+  else if (*p == '"')
+  {
+    const char *q = p + 1;
+    while (q < end && ! (*q == '"' && (q + 1 >= end || q[1] != '"')))
+      q += (*q == '"') ? 2 : 1;
+    q = qMin(q + 1, end);
+    result = QByteArray(p, q - p);
+    p = q;
+  }
+  else if (isIdentChar(*p) && ! isdigit((unsigned char)*p) && *p != '$')
+  {
+    const char *q = p;
+    while (q < end && isIdentChar(*q))
+      q++;
+    result = QByteArray(p, q - p).toLower();
+    p = q;
+  }
+  else
+    result = QByteArray(p++, 1);
+
+  pos = p - start;
+  return result;
+}
+
+/** Return the name the server stores for a word returned by nextWord().
+    Quoted identifiers lose their quotes and keep their case.
+*/
+QString SqlSplitter::identifier(const QByteArray &word)
+{
+  if (word.size() >= 2 && word.startsWith('"') && word.endsWith('"'))
+    return QString::fromUtf8(word.mid(1, word.size() - 2).replace("\"\"", "\""));
+  return QString::fromUtf8(word);
+}
+
+// is a word returned by nextWord() a name rather than punctuation?
+bool SqlSplitter::isIdentifier(const QByteArray &word)
+{
+  return ! word.isEmpty() &&
+         (word.at(0) == '"' || word.at(0) == '_' || (word.at(0) & 0x80) ||
+          isalpha((unsigned char)word.at(0)));
+}
+
+/** Return the next statement, including its terminating semicolon, and
+    move past it and any COPY data that follows it. The last statement in
+    the script may not have a semicolon.
+*/
+QByteArray SqlSplitter::next()
+{
+  _copyData = QByteArray();
+  if (atEnd())
+    return QByteArray();
+
+  int start = _pos;
+  _pos = statementEnd(start);
+
+  const char *sql  = _sql.constData();
+  const char *text = skipBlank(sql + start, sql + _pos);
+  for (; _linePos < start; _linePos++)
+    if (sql[_linePos] == '\n')
+      _line++;
+  _startLine = _line;
+  for (; _linePos < text - sql; _linePos++)
+    if (sql[_linePos] == '\n')
+      _line++;
+
+  _statement = QByteArray::fromRawData(sql + start, _pos - start);
+  if (isCopyFromStdin(_statement))
+  {
+    int dataStart = _pos;
+    int dataEnd   = _pos;
+    _pos = copyEnd(_pos, dataStart, dataEnd);
+    _copyData = QByteArray::fromRawData(_sql.constData() + dataStart,
+                                        dataEnd - dataStart);
+  }
+
+  if (DEBUG)
+    qDebug("SqlSplitter::next() statement at line %d is %d bytes, %d of data",
+           _line, _statement.size(), _copyData.size());
+
+  return _statement;
+}
+
+/** Return true if the last statement returned by next() holds nothing but
+    white space and comments, so there is no need to send it.
+*/
+bool SqlSplitter::isBlank() const
+{
+  const char *end = _statement.constData() + _statement.size();
+  return skipBlank(_statement.constData(), end) == end;
+}
+
+/** Return the line of the script holding the given 1-based character
+    position in the last statement returned by next(), as the server
+    reports the position of an error. Characters are counted as UTF-8,
+    the client encoding.
+*/
+int SqlSplitter::lineAt(int charpos) const
+{
+  int lines = _startLine;
+  int chars = 0;
+  for (int i = 0; i < _statement.size() && chars < charpos - 1; i++)
+  {
+    char c = _statement.at(i);
+    if ((c & 0xc0) != 0x80)
+      chars++;
+    if (c == '\n')
+      lines++;
+  }
+  return lines;
+}
+
+bool SqlSplitter::isCopyFromStdin(const QByteArray &statement) const
+{
+  const char *end = statement.constData() + statement.size();
+  const char *p   = skipBlank(statement.constData(), end);
+  if (end - p < 5 || qstrnicmp(p, "copy", 4) != 0 ||
+      ! isspace((unsigned char)p[4]))
+    return false;
+
+  // COPY statements are short so looking at a copy of the text is cheap
+  QString copy = QString::fromUtf8(p, end - p);
+  return QRegExp("\\sfrom\\s+stdin\\b", Qt::CaseInsensitive).indexIn(copy) >= 0;
+}
+
+/** Find the end of the COPY data that starts after the statement ending
+    at from. The data begins on the next line and runs to a line holding
+    only \. or to the end of the script.
+    @return the offset just past the end-of-data marker
+*/
+int SqlSplitter::copyEnd(int from, int &dataStart, int &dataEnd) const
+{
+  int nl = _sql.indexOf('\n', from);
+  if (nl < 0)
+  {
+    dataStart = dataEnd = _sql.size();
+    return _sql.size();
+  }
+
+  dataStart = nl + 1;
+  int p = dataStart;
+  while (p < _sql.size())
+  {
+    int eol = _sql.indexOf('\n', p);
+    int len = (eol < 0 ? _sql.size() : eol) - p;
+    if ((len == 2 || (len == 3 && _sql.at(p + 2) == '\r')) &&
+        _sql.at(p) == '\\' && _sql.at(p + 1) == '.')
+    {
+      dataEnd = p;
+      return eol < 0 ? _sql.size() : eol + 1;
+    }
+    p = (eol < 0) ? _sql.size() : eol + 1;
+  }
+
+  dataEnd = _sql.size();
+  return _sql.size();
+}
+
+/** Find the end of the statement that starts at from. The body of a
+    BEGIN ATOMIC ... END function (PostgreSQL 14 and later) holds
+    statements of its own, so semicolons do not count until the END that
+    matches it, allowing for CASE ... END inside.
+    @return the offset just past the statement's semicolon, or the size
+            of the script if the statement is not terminated
+*/
+int SqlSplitter::statementEnd(int from) const
+{
+  const char *sql    = _sql.constData();
+  int         end    = _sql.size();
+  int         depth  = 0;
+  int         blocks = 0;       // open BEGIN ATOMIC and CASE inside one
+  int         p      = from;
+  bool        begin  = false;   // the last word was BEGIN
+
+  while (p < end)
+  {
+    char c = sql[p];
+    if (c == '-' && p + 1 < end && sql[p + 1] == '-')
+    {
+      while (p < end && sql[p] != '\n')
+        p++;
+    }
+    else if (c == '/' && p + 1 < end && sql[p + 1] == '*')
+    {
+      int nesting = 1;
+      p += 2;
+      while (p < end && nesting > 0)
+      {
+        if (sql[p] == '/' && p + 1 < end && sql[p + 1] == '*')
+        {
+          nesting++;
+          p += 2;
+        }
+        else if (sql[p] == '*' && p + 1 < end && sql[p + 1] == '/')
+        {
+          nesting--;
+          p += 2;
+        }
+        else
+          p++;
+      }
+    }
+    else if (c == '\'')
+    {
+      bool escapes = (p > from && (sql[p - 1] == 'e' || sql[p - 1] == 'E') &&
+                      (p - 1 == from || ! isIdentChar(sql[p - 2])));
+      p++;
+      while (p < end)
+      {
+        if (escapes && sql[p] == '\\' && p + 1 < end)
+          p += 2;
+        else if (sql[p] == '\'' && p + 1 < end && sql[p + 1] == '\'')
+          p += 2;
+        else if (sql[p] == '\'')
+        {
+          p++;
+          break;
+        }
+        else
+          p++;
+      }
+    }
+    else if (c == '"')
+    {
+      p++;
+      while (p < end)
+      {
+        if (sql[p] == '"' && p + 1 < end && sql[p + 1] == '"')
+          p += 2;
+        else if (sql[p] == '"')
+        {
+          p++;
+          break;
+        }
+        else
+          p++;
+      }
+    }
+    else if (c == '$' && (p == from || ! isIdentChar(sql[p - 1])))
+    {
+      // $$ or $tag$ opens a string that runs to the same tag, $1 does not
+      int q = p + 1;
+      while (q < end && sql[q] != '$' && isIdentChar(sql[q]))
+        q++;
+      if (q < end && sql[q] == '$' && ! isdigit((unsigned char)sql[p + 1]))
+      {
+        QByteArray tag(sql + p, q - p + 1);
+        int close = _sql.indexOf(tag, q + 1);
+        p = (close < 0) ? end : close + tag.size();
+      }
+      else
+        p = q;
+    }
+    else if (isIdentChar(c))
+    {
+      int start = p;
+      while (p < end && isIdentChar(sql[p]))
+        p++;
+      if (begin && isWord(sql + start, p - start, "atomic"))
+        blocks++;
+      else if (blocks > 0 && isWord(sql + start, p - start, "case"))
+        blocks++;
+      else if (blocks > 0 && isWord(sql + start, p - start, "end"))
+        blocks--;
+      begin = isWord(sql + start, p - start, "begin");
+    }
+    else if (c == '(')
+    {
+      depth++;
+      p++;
+    }
+    else if (c == ')')
+    {
+      if (depth > 0)
+        depth--;
+      p++;
+    }
+    else if (c == ';' && depth == 0 && blocks == 0)
+      return p + 1;
+    else
+      p++;
+  }
+
+  return end;
+}
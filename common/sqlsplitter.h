@@ -0,0 +1,58 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __SQLSPLITTER_H__
+#define __SQLSPLITTER_H__
+
+#include <QByteArray>
+#include <QString>
+
+/* Walk through a SQL script one statement at a time without copying or
+   converting it. Statements end at a semicolon outside of comments,
+   quoted strings and identifiers, dollar-quoted strings, parentheses and
+   BEGIN ATOMIC ... END function bodies.
+   A COPY ... FROM STDIN statement is followed by its data, up to a line
+   holding only \., as psql expects. The statements returned by next()
+   share the script's buffer, so the script must outlive them.
+ */
+class SqlSplitter
+{
+  public:
+    SqlSplitter(const QByteArray &sql);
+    virtual ~SqlSplitter();
+
+    virtual bool       atEnd()    const { return _pos >= _sql.size(); }
+    virtual QByteArray copyData() const { return _copyData; }
+    virtual bool       isBlank()  const;
+    virtual int        line()     const { return _line; }
+    virtual int        lineAt(int charpos) const;
+    virtual QByteArray next();
+    virtual int        position() const { return _pos; }
+
+    static QString    identifier(const QByteArray &word);
+    static bool       isIdentifier(const QByteArray &word);
+    static QByteArray nextWord(const QByteArray &statement, int &pos,
+                               int *wordStart = 0);
+
+  protected:
+    QByteArray _copyData;
+    int        _line;           // where the statement's text begins
+    int        _linePos;
+    int        _startLine;      // where the statement's leading blanks begin
+    QByteArray _sql;
+    QByteArray _statement;
+    int        _pos;
+
+    virtual int  copyEnd(int from, int &dataStart, int &dataEnd) const;
+    virtual bool isCopyFromStdin(const QByteArray &statement) const;
+    virtual int  statementEnd(int from) const;
+};
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "updaterledger.h"
+
+#include <QCryptographicHash>
+#include <QObject>
+#include <QSqlError>
+#include <QVariant>     // used by XSqlQuery::bindValue()
+
+#include "servercapabilities.h"
+#include "xsqlquery.h"
+
+#define TR(a) QObject::tr(a)
+
+#define DEBUG false
+
+QString UpdaterLedger::_sqlerrtxt = TR("The following error was encountered "
+                                       "while trying to record %1 in the "
+                                       "updater ledger:<br><pre>%2<br>%3</pre>");
+
+UpdaterLedger::UpdaterLedger(const QString &pkgname, const QString &version)
+  : _loaded(false),
+    _pkgname(pkgname.isNull() ? QString("") : pkgname),   // core updates
+    _version(version)
+{
+}
+
+UpdaterLedger::~UpdaterLedger()
+{
+}
+
+QString UpdaterLedger::digest(const QByteArray &data)
+{
+  return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex());
+}
+
+/** Read this package's entries from the ledger, if there is one, with a
+    single query the first time it is needed.
+*/
+int UpdaterLedger::load(QString &errMsg)
+{
+  if (_loaded)
+    return 0;
+  _loaded = true;
+
+  XSqlQuery ledgerq;
+  if (ServerCapabilities::isKnown())
+  {
+    if (! ServerCapabilities::hasTable("public", "updaterledger"))
+      return 0;
+  }
+  else
+  {
+    ledgerq.exec("SELECT EXISTS(SELECT 1"
+                 "                FROM pg_class"
+                 "                JOIN pg_namespace ON (relnamespace=pg_namespace.oid)"
+                 "               WHERE relname='updaterledger'"
+                 "                 AND nspname='public') AS found;");
+    if (! ledgerq.first() || ! ledgerq.value("found").toBool())
+      return 0;
+  }
+
+  ledgerq.prepare("SELECT updaterledger_file, updaterledger_digest"
+                  "  FROM public.updaterledger"
+                  " WHERE updaterledger_pkgname=:pkgname;");
+  ledgerq.bindValue(":pkgname", _pkgname);
+  ledgerq.exec();
+  while (ledgerq.next())
+    _applied.insert(ledgerq.value("updaterledger_file").toString() + "\n" +
+                    ledgerq.value("updaterledger_digest").toString());
+  if (ledgerq.lastError().type() != QSqlError::NoError)
+  {
+    errMsg = _sqlerrtxt.arg(_pkgname)
+                       .arg(ledgerq.lastError().databaseText())
+                       .arg(ledgerq.lastError().driverText());
+    return -1;
+  }
+
+  if (DEBUG)
+    qDebug("UpdaterLedger::load() found %d entries for %s",
+           _applied.size(), qPrintable(_pkgname));
+
+  return 0;
+}
+
+/** Has this script, with exactly this content, been applied before?
+    If the ledger cannot be read the answer is no, so the script runs.
+*/
+bool UpdaterLedger::contains(const QString &filename, const QByteArray &data)
+{
+  QString errMsg;
+  if (load(errMsg) < 0)
+  {
+    if (DEBUG)
+      qDebug("UpdaterLedger::contains() %s", qPrintable(errMsg));
+    return false;
+  }
+
+  return _applied.contains(filename + "\n" + digest(data));
+}
+
+/** Record that the script has been applied. The ledger is written in the
+    caller's transaction, so the entry disappears if the update is rolled
+    back. A failure here does not disturb the transaction.
+
+    @return 0 on success or a negative number if the entry could not be
+            written, in which case errMsg says why
+*/
+int UpdaterLedger::record(const QString &filename, const QByteArray &data,
+                          QString &errMsg)
+{
+  QString filedigest = digest(data);
+  if (_applied.contains(filename + "\n" + filedigest))
+    return 0;
+
+  XSqlQuery ledgerq;
+  ledgerq.exec("SAVEPOINT updaterLedger;");
+  ledgerq.exec("CREATE TABLE IF NOT EXISTS public.updaterledger ("
+               "  updaterledger_id      SERIAL PRIMARY KEY,"
+               "  updaterledger_pkgname TEXT NOT NULL DEFAULT '',"
+               "  updaterledger_file    TEXT NOT NULL,"
+               "  updaterledger_digest  TEXT NOT NULL,"
+               "  updaterledger_version TEXT,"
+               "  updaterledger_applied TIMESTAMP WITH TIME ZONE NOT NULL DEFAULT now(),"
+               "  UNIQUE (updaterledger_pkgname, updaterledger_file,"
+               "          updaterledger_digest));");
+  if (ledgerq.lastError().type() == QSqlError::NoError)
+  {
+    ledgerq.prepare("INSERT INTO public.updaterledger ("
+                    "  updaterledger_pkgname, updaterledger_file,"
+                    "  updaterledger_digest,  updaterledger_version"
+                    ") VALUES (:pkgname, :file, :digest, :version);");
+    ledgerq.bindValue(":pkgname", _pkgname);
+    ledgerq.bindValue(":file",    filename);
+    ledgerq.bindValue(":digest",  filedigest);
+    ledgerq.bindValue(":version", _version);
+    ledgerq.exec();
+  }
+
+  if (ledgerq.lastError().type() != QSqlError::NoError)
+  {
+    errMsg = _sqlerrtxt.arg(filename)
+                       .arg(ledgerq.lastError().databaseText())
+                       .arg(ledgerq.lastError().driverText());
+    ledgerq.exec("ROLLBACK TO updaterLedger;");
+    ledgerq.exec("RELEASE SAVEPOINT updaterLedger;");
+    return -1;
+  }
+
+  ledgerq.exec("RELEASE SAVEPOINT updaterLedger;");
+  _applied.insert(filename + "\n" + filedigest);
+
+  return 0;
+}
+
+/** Remove this package's entries for files whose names start with
+    fileprefix, in the caller's transaction.
+
+    @return the number of entries removed or a negative number on failure
+*/
+int UpdaterLedger::forget(const QString &fileprefix, QString &errMsg)
+{
+  if (load(errMsg) < 0)
+    return -1;
+
+  QSet<QString> matches;
+  foreach (QString entry, _applied)
+  {
+    if (entry.startsWith(fileprefix))
+      matches.insert(entry);
+  }
+  if (matches.isEmpty())
+    return 0;
+
+  XSqlQuery ledgerq;
+  ledgerq.prepare("DELETE FROM public.updaterledger"
+                  " WHERE updaterledger_pkgname=:pkgname"
+                  "   AND substr(updaterledger_file, 1, length(:prefix))=:prefix;");
+  ledgerq.bindValue(":pkgname", _pkgname);
+  ledgerq.bindValue(":prefix",  fileprefix);
+  if (! ledgerq.exec())
+  {
+    errMsg = _sqlerrtxt.arg(fileprefix)
+                       .arg(ledgerq.lastError().databaseText())
+                       .arg(ledgerq.lastError().driverText());
+    return -2;
+  }
+
+  _applied.subtract(matches);
+
+  return ledgerq.numRowsAffected();
+}
@@ -0,0 +1,48 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __UPDATERLEDGER_H__
+#define __UPDATERLEDGER_H__
+
+#include <QByteArray>
+#include <QSet>
+#include <QString>
+
+/* Remembers which runonce scripts have been applied to the database, by
+   package, file name and a digest of the file's contents, in the
+   public.updaterledger table. The table is created the first time a
+   script is recorded. Online updates and the stages of a checkpointed
+   update also keep their progress here until the run finishes.
+ */
+class UpdaterLedger
+{
+  public:
+    UpdaterLedger(const QString &pkgname, const QString &version);
+    virtual ~UpdaterLedger();
+
+    virtual bool contains(const QString &filename, const QByteArray &data);
+    virtual int  forget(const QString &fileprefix, QString &errMsg);
+    virtual int  record(const QString &filename, const QByteArray &data,
+                        QString &errMsg);
+
+    static QString digest(const QByteArray &data);
+
+  protected:
+    QSet<QString> _applied;     // filename + digest
+    bool          _loaded;
+    QString       _pkgname;
+    QString       _version;
+
+    virtual int load(QString &errMsg);
+
+    static QString _sqlerrtxt;
+};
+
+#endif
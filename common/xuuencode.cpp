@@ -0,0 +1,327 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#include "xuuencode.h"
+
+#include <QBuffer>
+#include <string.h>
+
+#include <quuencode.h>
+
+#define DEBUG false
+
+#define UU_LINEBYTES 45
+#define UU_LINECHARS 62         // length, 60 characters, newline
+
+static inline char uuchar(unsigned int v)
+{
+  return v ? (char)(v + 32) : '`';
+}
+
+static void encodeLinesScalar(const unsigned char *in, int lines, char *out)
+{
+  for (int l = 0; l < lines; l++)
+  {
+    *out++ = 'M';
+    for (int i = 0; i < UU_LINEBYTES; i += 3, in += 3)
+    {
+      *out++ = uuchar(in[0] >> 2);
+      *out++ = uuchar(((in[0] << 4) & 060) | ((in[1] >> 4) & 017));
+      *out++ = uuchar(((in[1] << 2) & 074) | ((in[2] >> 6) & 03));
+      *out++ = uuchar(in[2] & 077);
+    }
+    *out++ = '\n';
+  }
+}
+
+static void decodeGroup(const char *in, unsigned char *out, int n)
+{
+  unsigned int a = (in[0] - 32) & 077;
+  unsigned int b = (in[1] - 32) & 077;
+  unsigned int c = (in[2] - 32) & 077;
+  unsigned int d = (in[3] - 32) & 077;
+  if (n > 0) out[0] = (unsigned char)((a << 2) | (b >> 4));
+  if (n > 1) out[1] = (unsigned char)((b << 4) | (c >> 2));
+  if (n > 2) out[2] = (unsigned char)((c << 6) | d);
+}
+
+static void decodeLineScalar(const char *in, unsigned char *out)
+{
+  for (int i = 0; i < UU_LINEBYTES; i += 3, in += 4)
+    decodeGroup(in, out + i, 3);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UU_X86
+#include <immintrin.h>
+
+/* 12 input bytes in the low three quarters of in become 16 six-bit
+   values, one per byte, in output order. */
+__attribute__((target("ssse3")))
+static inline __m128i splitSSSE3(__m128i in)
+{
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                          4,  5, 3,  4, 1, 2, 0, 1));
+  __m128i hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                               _mm_set1_epi32(0x04000040));
+  __m128i lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                               _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(hi, lo);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i toCharsSSSE3(__m128i v)
+{
+  __m128i zero = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+  return _mm_add_epi8(_mm_add_epi8(v, _mm_set1_epi8(32)),
+                      _mm_and_si128(zero, _mm_set1_epi8(64)));
+}
+
+/* Four lines at a time: 180 bytes are 15 blocks of 12, whose 240
+   characters are then laid out as four lines. The last load reads 4
+   bytes past the block, so the caller leaves at least that much. */
+__attribute__((target("ssse3")))
+static void encodeLinesSSSE3(const unsigned char *in, int lines, char *out)
+{
+  char chars[240];
+  for (; lines >= 4; lines -= 4, in += 4 * UU_LINEBYTES)
+  {
+    for (int i = 0; i < 15; i++)
+    {
+      __m128i block = _mm_loadu_si128((const __m128i *)(in + 12 * i));
+      _mm_storeu_si128((__m128i *)(chars + 16 * i),
+                       toCharsSSSE3(splitSSSE3(block)));
+    }
+    for (int l = 0; l < 4; l++)
+    {
+      *out++ = 'M';
+      memcpy(out, chars + 60 * l, 60);
+      out += 60;
+      *out++ = '\n';
+    }
+  }
+  encodeLinesScalar(in, lines, out);
+}
+
+__attribute__((target("avx2")))
+static void encodeLinesAVX2(const unsigned char *in, int lines, char *out)
+{
+  const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4,  5, 3,  4, 1, 2, 0, 1,
+                                          10, 11, 9, 10, 7, 8, 6, 7,
+                                           4,  5, 3,  4, 1, 2, 0, 1);
+  char chars[480];
+  for (; lines >= 8; lines -= 8, in += 8 * UU_LINEBYTES)
+  {
+    for (int i = 0; i < 15; i++)
+    {
+      __m256i block = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + 24 * i))),
+            _mm_loadu_si128((const __m128i *)(in + 24 * i + 12)), 1);
+      block = _mm256_shuffle_epi8(block, shuffle);
+      __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00)),
+                                      _mm256_set1_epi32(0x04000040));
+      __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0)),
+                                      _mm256_set1_epi32(0x01000010));
+      __m256i v  = _mm256_or_si256(hi, lo);
+      __m256i zero = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+      v = _mm256_add_epi8(_mm256_add_epi8(v, _mm256_set1_epi8(32)),
+                          _mm256_and_si256(zero, _mm256_set1_epi8(64)));
+      _mm256_storeu_si256((__m256i *)(chars + 32 * i), v);
+    }
+    for (int l = 0; l < 8; l++)
+    {
+      *out++ = 'M';
+      memcpy(out, chars + 60 * l, 60);
+      out += 60;
+      *out++ = '\n';
+    }
+  }
+  encodeLinesSSSE3(in, lines, out);
+}
+
+/* 60 characters become 45 bytes: three blocks of 16 characters and the
+   last 12 characters by hand. Each store writes 4 bytes past its 12, all
+   within the line except for the last which is done by hand anyway. */
+__attribute__((target("ssse3")))
+static void decodeLineSSSE3(const char *in, unsigned char *out)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + 16 * i));
+    v = _mm_and_si128(_mm_sub_epi8(v, _mm_set1_epi8(32)), _mm_set1_epi8(077));
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                          14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i *)(out + 12 * i), v);
+  }
+  for (int i = 36; i < UU_LINEBYTES; i += 3)
+    decodeGroup(in + i / 3 * 4, out + i, 3);
+}
+#endif
+
+typedef void (*EncodeLinesFunc)(const unsigned char *in, int lines, char *out);
+typedef void (*DecodeLineFunc)(const char *in, unsigned char *out);
+
+static EncodeLinesFunc _encodeLines = 0;
+static DecodeLineFunc  _decodeLine  = 0;
+static const char     *_kernel      = 0;
+
+static void selectKernel()
+{
+  if (_kernel)
+    return;
+
+  EncodeLinesFunc encode = encodeLinesScalar;
+  DecodeLineFunc  decode = decodeLineScalar;
+  const char     *name   = "scalar";
+#ifdef UU_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3"))
+  {
+    encode = encodeLinesSSSE3;
+    decode = decodeLineSSSE3;
+    name   = "ssse3";
+  }
+  if (__builtin_cpu_supports("avx2"))
+  {
+    encode = encodeLinesAVX2;
+    name   = "avx2";
+  }
+#endif
+  _encodeLines = encode;
+  _decodeLine  = decode;
+  _kernel      = name;
+
+  if (DEBUG)
+    qDebug("XUUEncode using the %s kernel", _kernel);
+}
+
+/** Return the name of the conversion routines in use on this processor:
+    avx2, ssse3, or scalar.
+*/
+const char *XUUKernel()
+{
+  selectKernel();
+  return _kernel;
+}
+
+/** Uuencode data the same way QUUEncode() does.
+
+    All but the last full line are converted here. The last full line and
+    any short line after it go through QUUEncode() itself, which also
+    supplies the begin and end lines, so the framing and the padding of a
+    short line are whatever QUUEncode() makes them. The full line before
+    the short one gives the vector loads room to read past the end of the
+    lines they convert.
+*/
+QByteArray XUUEncode(const QByteArray &data)
+{
+  selectKernel();
+
+  int fulllines = data.size() / UU_LINEBYTES;
+  int fast      = fulllines > 0 ? fulllines - 1 : 0;
+
+  QBuffer restbuf;
+  restbuf.setData(data.mid(fast * UU_LINEBYTES));
+  QByteArray rest = QUUEncode(restbuf).toLatin1();
+  if (rest.isNull())
+    return QByteArray();
+
+  // split the QUUEncode() output after its begin line
+  int headerlen = rest.indexOf('\n') + 1;
+  if (headerlen <= 0)
+    return QByteArray();
+
+  QByteArray result;
+  result.resize(headerlen + fast * UU_LINECHARS + rest.size() - headerlen);
+  char *out = result.data();
+  memcpy(out, rest.constData(), headerlen);
+  _encodeLines((const unsigned char *)data.constData(), fast, out + headerlen);
+  memcpy(out + headerlen + fast * UU_LINECHARS, rest.constData() + headerlen,
+         rest.size() - headerlen);
+
+  return result;
+}
+
+/** Decode uuencoded text. If remote or mode are given they are set from
+    the begin line. Returns a null QByteArray if the text is not uuencoded
+    or a line is too short for the number of bytes it claims to hold.
+*/
+QByteArray XUUDecode(const QByteArray &encoded, QString *remote, int *mode)
+{
+  selectKernel();
+
+  const char *p   = encoded.constData();
+  const char *end = p + encoded.size();
+
+  // find the begin line
+  while (p < end)
+  {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (! eol)
+      eol = end;
+    if (eol - p > 6 && strncmp(p, "begin ", 6) == 0)
+    {
+      QByteArray begin = QByteArray(p + 6, eol - p - 6).trimmed();
+      int space = begin.indexOf(' ');
+      if (mode)
+        *mode = begin.left(space).toInt(0, 8);
+      if (remote)
+        *remote = (space < 0) ? QString() : QString(begin.mid(space + 1));
+      p = eol + 1;
+      break;
+    }
+    p = eol + 1;
+  }
+  if (p > end)
+    return QByteArray();
+
+  QByteArray result;
+  result.resize((end - p) / 4 * 3 + UU_LINEBYTES);
+  unsigned char *out = (unsigned char *)result.data();
+
+  while (p < end)
+  {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (! eol)
+      eol = end;
+    int linelen = eol - p;
+    if (linelen > 0 && p[linelen - 1] == '\r')
+      linelen--;
+
+    if (linelen == 3 && strncmp(p, "end", 3) == 0)
+      break;
+
+    if (linelen > 0)
+    {
+      int n = (p[0] - 32) & 077;
+      if (n == 0)
+        break;
+      int groups = (n + 2) / 3;
+      if (linelen < 1 + groups * 4)
+        return QByteArray();
+
+      if (n == UU_LINEBYTES)
+        _decodeLine(p + 1, out);
+      else
+      {
+        for (int i = 0; i < groups; i++)
+          decodeGroup(p + 1 + i * 4, out + i * 3, qMin(3, n - i * 3));
+      }
+      out += n;
+    }
+    p = eol + 1;
+  }
+
+  result.resize(out - (unsigned char *)result.data());
+  return result;
+}
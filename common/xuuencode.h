@@ -0,0 +1,27 @@
+/*
+ * This file is part of the xTuple ERP: PostBooks Edition, a free and
+ * open source Enterprise Resource Planning software suite,
+ * Copyright (c) 1999-2015 by OpenMFG LLC, d/b/a xTuple.
+ * It is licensed to you under the Common Public Attribution License
+ * version 1.0, the full text of which (including xTuple-specific Exhibits)
+ * is available at www.xtuple.com/CPAL.  By using this software, you agree
+ * to be bound by its terms.
+ */
+
+#ifndef __XUUENCODE_H__
+#define __XUUENCODE_H__
+
+#include <QByteArray>
+#include <QString>
+
+/* Fast replacements for QUUEncode() and QUUDecode() that work on byte
+   arrays. XUUEncode() produces exactly the same text as QUUEncode() on a
+   QBuffer holding the same data. Full lines are converted with SSSE3 or
+   AVX2 where the processor has them.
+ */
+QByteArray  XUUEncode(const QByteArray &data);
+QByteArray  XUUDecode(const QByteArray &encoded, QString *remote = 0,
+                      int *mode = 0);
+const char *XUUKernel();
+
+#endif
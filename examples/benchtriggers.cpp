@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QString>
+#include <QVariant>
+
+/* Compare the two ways the loader can keep the pkg*altertrigger triggers
+   from firing while it writes a package: ALTER TABLE ... DISABLE TRIGGER
+   on every table or SET LOCAL session_replication_role TO replica.
+   Each run creates a scratch schema with one guarded table per package
+   item type, writes a row to each with the triggers suppressed, counts
+   the ACCESS EXCLUSIVE locks held at that point, and rolls back. The
+   schema is named for the process and must not exist beforehand, so the
+   benchmark only ever drops what it created itself.
+ */
+
+static bool run(QSqlQuery &q, const QString &sql)
+{
+  if (q.exec(sql))
+    return true;
+  fprintf(stderr, "%s\n%s\n", qPrintable(sql), qPrintable(q.lastError().text()));
+  return false;
+}
+
+static int exclusiveLocks(QSqlQuery &q)
+{
+  q.exec("SELECT COUNT(*) FROM pg_locks"
+         " WHERE pid=pg_backend_pid() AND mode='AccessExclusiveLock'"
+         "   AND locktype='relation';");
+  return q.first() ? q.value(0).toInt() : -1;
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  if (argc < 4)
+  {
+    fprintf(stderr, "usage: %s host dbname user [ password [ tables [ iterations ] ] ]\n",
+            argv[0]);
+    return 2;
+  }
+
+  int tables     = (argc > 5) ? atoi(argv[5]) : 8;
+  int iterations = (argc > 6) ? atoi(argv[6]) : 20;
+
+  QSqlDatabase db = QSqlDatabase::addDatabase("QPSQL");
+  db.setHostName(argv[1]);
+  db.setDatabaseName(argv[2]);
+  db.setUserName(argv[3]);
+  if (argc > 4)
+    db.setPassword(argv[4]);
+  if (! db.open())
+  {
+    fprintf(stderr, "%s\n", qPrintable(db.lastError().text()));
+    return 2;
+  }
+
+  QString   schema = QString("benchtriggers_%1")
+                       .arg(QCoreApplication::applicationPid());
+  QSqlQuery q(db);
+  if (! run(q, QString("CREATE SCHEMA %1;").arg(schema)))
+  {
+    fprintf(stderr, "not running: could not create the scratch schema %s\n",
+            qPrintable(schema));
+    return 2;
+  }
+
+  bool created = run(q, QString("CREATE FUNCTION %1.altertrigger()"
+                                " RETURNS TRIGGER AS $$"
+                                " BEGIN RAISE EXCEPTION 'You may not alter %',"
+                                " TG_TABLE_NAME; END; $$ LANGUAGE plpgsql;")
+                          .arg(schema));
+  for (int i = 0; created && i < tables; i++)
+  {
+    created = run(q, QString("CREATE TABLE %1.pkgitem%2"
+                             " (id SERIAL PRIMARY KEY, name TEXT);")
+                       .arg(schema).arg(i)) &&
+              run(q, QString("CREATE TRIGGER pkgitem%2altertrigger"
+                             " BEFORE INSERT OR UPDATE OR DELETE"
+                             " ON %1.pkgitem%2 FOR EACH ROW"
+                             " EXECUTE PROCEDURE %1.altertrigger();")
+                       .arg(schema).arg(i));
+  }
+  if (! created)
+  {
+    q.exec(QString("DROP SCHEMA %1 CASCADE;").arg(schema));
+    return 2;
+  }
+
+  printf("\n\nSuppressing %d alter triggers, %d iterations\n"
+         "%-12s %6s %12s %8s\n", tables, iterations,
+         "mode", "ok", "time", "locks");
+
+  const char *modes[] = { "altertable", "replica" };
+  int failures = 0;
+  for (unsigned int m = 0; m < sizeof(modes) / sizeof(*modes); m++)
+  {
+    bool altertable = (m == 0);
+    bool ok    = true;
+    int  locks = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int j = 0; ok && j < iterations; j++)
+    {
+      ok = run(q, "BEGIN;");
+      if (altertable)
+      {
+        for (int i = 0; ok && i < tables; i++)
+          ok = run(q, QString("ALTER TABLE %1.pkgitem%2"
+                              " DISABLE TRIGGER pkgitem%2altertrigger;")
+                        .arg(schema).arg(i));
+      }
+      else
+        ok = ok && run(q, "SET LOCAL session_replication_role TO replica;");
+
+      for (int i = 0; ok && i < tables; i++)
+        ok = run(q, QString("INSERT INTO %1.pkgitem%2 (name)"
+                            " VALUES ('item');").arg(schema).arg(i));
+      if (ok)
+        locks = exclusiveLocks(q);
+
+      if (altertable)
+      {
+        for (int i = tables - 1; ok && i >= 0; i--)
+          ok = run(q, QString("ALTER TABLE %1.pkgitem%2"
+                              " ENABLE TRIGGER pkgitem%2altertrigger;")
+                        .arg(schema).arg(i));
+      }
+      else
+        ok = ok && run(q, "SET LOCAL session_replication_role TO DEFAULT;");
+      q.exec("ROLLBACK;");
+    }
+    qint64 elapsed = timer.nsecsElapsed() / iterations;
+
+    if (! ok)
+      failures++;
+    printf("%-12s %6s %10lldus %8d\n", modes[m], (ok ? "T" : "F"),
+           elapsed / 1000, locks);
+  }
+
+  q.exec(QString("DROP SCHEMA %1 CASCADE;").arg(schema));
+
+  printf("\n%d failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QString>
+
+#include <quuencode.h>
+
+#include "xuuencode.h"
+
+int sizes[] = { 0, 1, 2, 3, 44, 45, 46, 89, 90, 91, 179, 180, 181, 359,
+                360, 361, 405, 4096, 65536, 1048576 };
+
+static QByteArray randomData(int size)
+{
+  QByteArray data(size, '\0');
+  for (int i = 0; i < size; i++)
+    data[i] = (char)(rand() & 0xff);
+  return data;
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 20;
+  int failures   = 0;
+
+  printf("\n\nComparing XUUEncode (%s) with QUUEncode\n"
+         "%8s %6s %12s %12s %12s %12s\n", XUUKernel(),
+         "bytes", "match", "QUUEncode", "XUUEncode", "QUUDecode", "XUUDecode");
+
+  for (unsigned int i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+  {
+    QByteArray data = randomData(sizes[i]);
+    QBuffer    buffer;
+    buffer.setData(data);
+    QByteArray expected = QUUEncode(buffer).toLatin1();
+    QByteArray actual   = XUUEncode(data);
+    QByteArray decoded  = XUUDecode(actual);
+    bool ok = (expected == actual && decoded == data &&
+               QUUDecode(QString(actual)) == data);
+    if (! ok)
+      failures++;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int j = 0; j < iterations; j++)
+    {
+      QBuffer b;
+      b.setData(data);
+      QUUEncode(b).toLatin1();
+    }
+    qint64 qenc = timer.nsecsElapsed() / iterations;
+
+    timer.restart();
+    for (int j = 0; j < iterations; j++)
+      XUUEncode(data);
+    qint64 xenc = timer.nsecsElapsed() / iterations;
+
+    QString text(expected);
+    timer.restart();
+    for (int j = 0; j < iterations; j++)
+      QUUDecode(text);
+    qint64 qdec = timer.nsecsElapsed() / iterations;
+
+    timer.restart();
+    for (int j = 0; j < iterations; j++)
+      XUUDecode(expected);
+    qint64 xdec = timer.nsecsElapsed() / iterations;
+
+    printf("%8d %6s %10lldns %10lldns %10lldns %10lldns\n", sizes[i],
+           (ok ? "T" : "F"), qenc, xenc, qdec, xdec);
+  }
+
+  printf("\n%d failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+
+#include <QByteArray>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include "createfunction.h"
+#include "createtable.h"
+#include "createview.h"
+#include "script.h"
+#include "scriptschedule.h"
+
+/* Each test is some SQL, names referencedObjects() should find in it and
+   names it should not, separated by blanks.
+ */
+struct reftest {
+  const char *name;
+  const char *sql;
+  const char *found;
+  const char *notfound;
+} reftests[] = {
+  { "view bodies",
+    "CREATE VIEW v AS SELECT a FROM t, w JOIN s.u ON (t.x = u.x);",
+    "t s.u w",                  "v x" },
+  { "defaults, FKs, inheritance",
+    "CREATE TABLE t (a INTEGER DEFAULT nextid('t'),"
+    " b INTEGER REFERENCES u (id)) INHERITS (p);",
+    "nextid( nextid(1) u p",    "t a b id" },
+  { "SQL function bodies",
+    "CREATE FUNCTION f(INTEGER) RETURNS INTEGER AS $$"
+    " SELECT count(*)::INTEGER FROM t WHERE g($1, 2) > 0; $$ LANGUAGE sql;",
+    "t g( g(2)",                "f f(" },
+  { "quoted language names",
+    "CREATE FUNCTION f() RETURNS INTEGER AS $$ SELECT x FROM t $$"
+    " LANGUAGE 'sql';",
+    "t",                        "f x" },
+  { "PL/pgSQL bodies",
+    "CREATE OR REPLACE FUNCTION f() RETURNS TRIGGER AS $f$ BEGIN"
+    " INSERT INTO t VALUES (g(1)); RETURN NEW; END; $f$ LANGUAGE plpgsql;"
+    " CREATE TRIGGER ft AFTER INSERT ON u"
+    " FOR EACH ROW EXECUTE PROCEDURE f();",
+    "u f( f(0)",                "t g( ft" },
+  { "DO blocks",
+    "DO $do$ BEGIN EXECUTE $x$SELECT 1$x$;"
+    " CREATE FUNCTION h() RETURNS INTEGER AS $h$ BEGIN RETURN k(); END $h$"
+    " LANGUAGE plpgsql; PERFORM m(); UPDATE t SET a = 1; END $do$;",
+    "m( m(0) t",                "k( h" },
+  { "drops",
+    "DROP VIEW IF EXISTS v; DROP TRIGGER x ON t;",
+    "t",                        "v x" }
+};
+
+/* Each test is some SQL and the tables lockedTables() should find in it,
+   as table=MODE in name order.
+ */
+struct locktest {
+  const char *name;
+  const char *sql;
+  const char *locks;
+} locktests[] = {
+  { "lock modes",
+    "ALTER TABLE t ADD COLUMN a INTEGER; CREATE INDEX i ON s.u (a);"
+    " TRUNCATE v, w; CREATE INDEX CONCURRENTLY j ON x (b);",
+    "s.u=SHARE t=ACCESS EXCLUSIVE v=ACCESS EXCLUSIVE w=ACCESS EXCLUSIVE"
+    " x=SHARE UPDATE EXCLUSIVE" },
+  { "strongest lock wins",
+    "CREATE TRIGGER x AFTER INSERT ON t FOR EACH ROW EXECUTE PROCEDURE f();"
+    " ALTER TABLE t DISABLE TRIGGER x; CREATE TRIGGER y BEFORE UPDATE ON u"
+    " FOR EACH ROW EXECUTE PROCEDURE f();",
+    "t=ACCESS EXCLUSIVE u=SHARE ROW EXCLUSIVE" },
+  { "DO blocks and bodies",
+    "DO $$ BEGIN ALTER TABLE t DISABLE TRIGGER ALL; END $$;"
+    " CREATE FUNCTION f() RETURNS VOID AS $$ ALTER TABLE u ADD b INTEGER $$"
+    " LANGUAGE sql;",
+    "t=ACCESS EXCLUSIVE u=ACCESS EXCLUSIVE" },
+  { "no strong locks",
+    "SELECT * FROM t; UPDATE u SET a = 1; CREATE VIEW v AS SELECT 1;",
+    "" }
+};
+
+/* Each test is a package: scripts in the phases the loader uses (0 for
+   database scripts, 1 functions, 2 tables, 3 triggers, 4 views), each
+   declaring the object it is named for, and the schedule ScriptSchedule
+   should build for them.
+ */
+struct scheduledscript {
+  int         phase;
+  char        kind;             // S script, F function, T table, V view
+  const char *name;
+  const char *sql;
+};
+
+struct scheduletest {
+  const char     *name;
+  scheduledscript scripts[4];
+  const char     *order;
+  const char     *readysets;
+  int             messages;
+} scheduletests[] = {
+  { "creation-time references",
+    { { 1, 'F', "f", "CREATE FUNCTION f() RETURNS BIGINT AS"
+                     " $$ SELECT count(*) FROM t $$ LANGUAGE sql;" },
+      { 2, 'T', "t", "CREATE TABLE t (a INTEGER);" },
+      { 4, 'V', "v", "CREATE VIEW v AS SELECT f();" } },
+    "t f v", "[t] [f] [v]", 1 },
+  { "run-time references",
+    { { 1, 'F', "g", "CREATE FUNCTION g() RETURNS TRIGGER AS $$ BEGIN"
+                     " INSERT INTO t VALUES (1); RETURN NEW; END; $$"
+                     " LANGUAGE plpgsql;" },
+      { 2, 'T', "t", "CREATE TABLE t (a INTEGER);" },
+      { 3, 'S', "gt", "CREATE TRIGGER gt AFTER INSERT ON t"
+                      " FOR EACH ROW EXECUTE PROCEDURE g();" } },
+    "g t gt", "[g t] [gt]", 0 },
+  { "cycles",
+    { { 2, 'T', "a", "CREATE TABLE a (x INTEGER REFERENCES b);" },
+      { 2, 'T', "b", "CREATE TABLE b (y INTEGER REFERENCES a);" },
+      { 4, 'V', "c", "CREATE VIEW c AS SELECT * FROM a;" } },
+    "a b c", "[a b] [c]", 1 },
+  { "independent scripts",
+    { { 2, 'T', "a", "CREATE TABLE a (x INTEGER);" },
+      { 2, 'T', "b", "CREATE TABLE b (y INTEGER);" },
+      { 4, 'V', "c", "CREATE VIEW c AS SELECT * FROM a;" },
+      { 4, 'V', "d", "CREATE VIEW d AS SELECT * FROM b;" } },
+    "a b c d", "[a b] [c d]", 0 }
+};
+
+static QString names(const QList<Script*> &scripts)
+{
+  QStringList result;
+  foreach (Script *s, scripts)
+    result.append(s->filename().section('.', 0, 0));
+  return result.join(" ");
+}
+
+int main(int argc, char *argv[])
+{
+  Q_UNUSED(argc);
+  Q_UNUSED(argv);
+  int failures = 0;
+
+  printf("\n\nTesting Objects Referenced by Scripts\n");
+  for (unsigned int i = 0; i < sizeof(reftests) / sizeof(*reftests); i++)
+  {
+    QSet<QString> refs = ScriptSchedule::referencedObjects(reftests[i].sql);
+    bool ok = true;
+    foreach (QString name, QString(reftests[i].found).split(" "))
+      if (! refs.contains(name))
+      {
+        printf("  %s not found\n", qPrintable(name));
+        ok = false;
+      }
+    foreach (QString name, QString(reftests[i].notfound).split(" "))
+      if (refs.contains(name))
+      {
+        printf("  %s found\n", qPrintable(name));
+        ok = false;
+      }
+    printf("%-30s %s\n", reftests[i].name, ok ? "ok" : "FAILED");
+    if (! ok)
+      failures++;
+  }
+
+  printf("\n\nTesting Tables Locked by Scripts\n");
+  for (unsigned int i = 0; i < sizeof(locktests) / sizeof(*locktests); i++)
+  {
+    QMap<QString, QString> tables = ScriptSchedule::lockedTables(locktests[i].sql);
+    QStringList locks;
+    QMap<QString, QString>::const_iterator it;
+    for (it = tables.constBegin(); it != tables.constEnd(); ++it)
+      locks.append(it.key() + "=" + it.value());
+    bool ok = (locks.join(" ") == locktests[i].locks);
+    if (! ok)
+      printf("  got      [%s]\n  expected [%s]\n",
+             qPrintable(locks.join(" ")), locktests[i].locks);
+    printf("%-30s %s\n", locktests[i].name, ok ? "ok" : "FAILED");
+    if (! ok)
+      failures++;
+  }
+
+  printf("\n\nTesting Script Schedules\n");
+  for (unsigned int i = 0; i < sizeof(scheduletests) / sizeof(*scheduletests); i++)
+  {
+    QList<Script*>             phases[5];
+    QList<Script*>             all;
+    QMap<QString, QByteArray>  files;
+    for (int j = 0; j < 4 && scheduletests[i].scripts[j].name; j++)
+    {
+      const scheduledscript &s = scheduletests[i].scripts[j];
+      QString filename = QString(s.name) + ".sql";
+      Script *script = 0;
+      switch (s.kind)
+      {
+        case 'F': script = new CreateFunction(filename, s.name); break;
+        case 'T': script = new CreateTable(filename, s.name);    break;
+        case 'V': script = new CreateView(filename, s.name);     break;
+        default:  script = new Script(filename);                 break;
+      }
+      phases[s.phase].append(script);
+      all.append(script);
+      files.insert("pkg/" + filename, QByteArray(s.sql));
+    }
+
+    ScriptSchedule schedule;
+    for (int p = 0; p < 5; p++)
+      schedule.addPhase(phases[p]);
+    QStringList msgs;
+    int messages = schedule.build(files, "pkg/", "pkg", msgs);
+
+    QStringList readysets;
+    foreach (QList<Script*> set, schedule.readySets())
+      readysets.append("[" + names(set) + "]");
+
+    bool ok = true;
+    if (names(schedule.order()) != scheduletests[i].order)
+    {
+      printf("  order     [%s], expected [%s]\n",
+             qPrintable(names(schedule.order())), scheduletests[i].order);
+      ok = false;
+    }
+    if (readysets.join(" ") != scheduletests[i].readysets)
+    {
+      printf("  readySets %s, expected %s\n",
+             qPrintable(readysets.join(" ")), scheduletests[i].readysets);
+      ok = false;
+    }
+    if (messages != scheduletests[i].messages)
+    {
+      printf("  %d messages, expected %d:\n", messages,
+             scheduletests[i].messages);
+      foreach (QString msg, msgs)
+        printf("    %s\n", qPrintable(msg));
+      ok = false;
+    }
+    printf("%-30s %s\n", scheduletests[i].name, ok ? "ok" : "FAILED");
+    if (! ok)
+      failures++;
+
+    qDeleteAll(all);
+  }
+
+  printf("\n%d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <QByteArray>
+
+#include "sqlsplitter.h"
+
+/* Each test is a script and the statements SqlSplitter should find in
+   it, with the leading blanks trimmed. A statement holding COPY data is
+   followed by the data, after a | marker.
+ */
+struct splittest {
+  const char *name;
+  const char *sql;
+  const char *statements[4];
+} splittests[] = {
+  { "dollar quotes with tags",
+    "CREATE FUNCTION f() RETURNS INTEGER AS $body$ SELECT 1; $x$;$x$ $body$"
+    " LANGUAGE sql; SELECT $1, a$b FROM t;",
+    { "CREATE FUNCTION f() RETURNS INTEGER AS $body$ SELECT 1; $x$;$x$ $body$"
+      " LANGUAGE sql;",
+      "SELECT $1, a$b FROM t;" } },
+  { "nested comments",
+    "/* outer /* inner; */ still a comment; */ SELECT 1; -- a; comment\nSELECT 2;",
+    { "/* outer /* inner; */ still a comment; */ SELECT 1;",
+      "-- a; comment\nSELECT 2;" } },
+  { "E'' strings",
+    "SELECT E'it\\'s; \\\\'; SELECT e'\\\\'; SELECT 'a\\';",
+    { "SELECT E'it\\'s; \\\\';",
+      "SELECT e'\\\\';",
+      "SELECT 'a\\';" } },
+  { "doubled quotes",
+    "SELECT 'don''t; stop'; SELECT \"we\"\";ird\" FROM t;",
+    { "SELECT 'don''t; stop';",
+      "SELECT \"we\"\";ird\" FROM t;" } },
+  { "COPY FROM stdin",
+    "COPY t (a, b) FROM stdin;\n1\tx;y\n2\t\\N\n\\.\nSELECT 1;",
+    { "COPY t (a, b) FROM stdin;|1\tx;y\n2\t\\N\n",
+      "SELECT 1;" } },
+  { "parenthesised rule bodies",
+    "CREATE RULE r AS ON INSERT TO t DO INSTEAD"
+    " (INSERT INTO u VALUES (1); UPDATE v SET a = 1); SELECT 1;",
+    { "CREATE RULE r AS ON INSERT TO t DO INSTEAD"
+      " (INSERT INTO u VALUES (1); UPDATE v SET a = 1);",
+      "SELECT 1;" } },
+  { "BEGIN ATOMIC bodies",
+    "CREATE FUNCTION f() RETURNS INTEGER LANGUAGE sql BEGIN ATOMIC"
+    " SELECT CASE WHEN true THEN 1 END; SELECT 2; END; BEGIN; SELECT 3;",
+    { "CREATE FUNCTION f() RETURNS INTEGER LANGUAGE sql BEGIN ATOMIC"
+      " SELECT CASE WHEN true THEN 1 END; SELECT 2; END;",
+      "BEGIN;",
+      "SELECT 3;" } },
+  { "no final semicolon",
+    "SELECT 1;\n\n  SELECT 2",
+    { "SELECT 1;",
+      "SELECT 2" } }
+};
+
+/* Each test finds a statement in a script and checks the line lineAt()
+   gives for a character position in it, as the server reports errors.
+ */
+struct linetest {
+  const char *name;
+  const char *sql;
+  int         statement;        // 1-based
+  int         charpos;
+  int         line;
+} linetests[] = {
+  { "first line",         "SELECT x FROM t;",                       1,  8, 1 },
+  { "later statement",    "SELECT 1;\n\nSELECT\n  x\n  FROM t;",    2, 12, 4 },
+  { "blank lines before", "SELECT 1;\n\n\n-- note\nSELECT y;",      2, 19, 5 },
+  { "multibyte text",     "SELECT 'd\xc3\xa9j\xc3\xa0',\n  z;",     1, 17, 2 },
+  { "after COPY data",    "COPY t FROM stdin;\n1\n2\n\\.\nSELECT\nw;", 2,  8, 6 }
+};
+
+static QByteArray trimmed(const QByteArray &statement)
+{
+  QByteArray result(statement.constData(), statement.size());
+  return result.trimmed();
+}
+
+int main(int argc, char *argv[])
+{
+  Q_UNUSED(argc);
+  Q_UNUSED(argv);
+  int failures = 0;
+
+  printf("\n\nTesting Splitting of Scripts into Statements\n");
+  for (unsigned int i = 0; i < sizeof(splittests) / sizeof(*splittests); i++)
+  {
+    SqlSplitter splitter(QByteArray(splittests[i].sql));
+    bool ok    = true;
+    int  count = 0;
+    while (! splitter.atEnd())
+    {
+      QByteArray statement = trimmed(splitter.next());
+      if (splitter.isBlank())
+        continue;
+      if (! splitter.copyData().isEmpty())
+        statement += "|" + QByteArray(splitter.copyData().constData(),
+                                      splitter.copyData().size());
+      const char *expected = count < 4 ? splittests[i].statements[count] : 0;
+      if (! expected || statement != expected)
+      {
+        printf("  statement %d: got [%s]\n               expected [%s]\n",
+               count + 1, statement.constData(), expected ? expected : "");
+        ok = false;
+      }
+      count++;
+    }
+    if (count < 4 && splittests[i].statements[count])
+    {
+      printf("  statement %d: missing [%s]\n", count + 1,
+             splittests[i].statements[count]);
+      ok = false;
+    }
+    printf("%-30s %s\n", splittests[i].name, ok ? "ok" : "FAILED");
+    if (! ok)
+      failures++;
+  }
+
+  printf("\n\nTesting Mapping of Error Positions to Lines\n");
+  for (unsigned int i = 0; i < sizeof(linetests) / sizeof(*linetests); i++)
+  {
+    SqlSplitter splitter(QByteArray(linetests[i].sql));
+    for (int s = 0; s < linetests[i].statement; s++)
+      splitter.next();
+    int line = splitter.lineAt(linetests[i].charpos);
+    bool ok  = (line == linetests[i].line);
+    printf("%-30s line %2d, expected %2d %s\n", linetests[i].name, line,
+           linetests[i].line, ok ? "ok" : "FAILED");
+    if (! ok)
+      failures++;
+  }
+
+  printf("\n%d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -52,6 +52,17 @@ isEmpty( XTUPLE_LIBDIR ) {
 ! isEmpty( XTUPLE_LIBDIR_REL  ) { XTUPLE_LIBDIR  = ../$${XTUPLE_LIBDIR}  }
 message("Looking for xTuple in $${XTUPLE_HEADERS} and $${XTUPLE_LIBDIR}.")
 
+PGSQL_HEADERS = $$(PGSQL_HEADERS)
+isEmpty( PGSQL_HEADERS ) {
+  PGSQL_HEADERS = $$system(pg_config --includedir)
+}
+
+PGSQL_LIBDIR = $$(PGSQL_LIBDIR)
+isEmpty( PGSQL_LIBDIR ) {
+  PGSQL_LIBDIR = $$system(pg_config --libdir)
+}
+message("Looking for libpq in $${PGSQL_HEADERS} and $${PGSQL_LIBDIR}.")
+
 UPDATER_LIBDIR=../lib
 exists(../updater-desktop-build) {
   UPDATER_LIBDIR=../updater-desktop-build/lib
@@ -60,12 +71,16 @@ exists(../updater-desktop-build) {
 INCLUDEPATH += ../common \
                $${OPENRPT_HEADERS}/common \
                $${OPENRPT_HEADERS}/MetaSQL \
-               $${XTUPLE_HEADERS}/common
+               $${XTUPLE_HEADERS}/common \
+               $${PGSQL_HEADERS}
 INCLUDEPATH = $$unique(INCLUDEPATH)
 DEPENDPATH  += $${INCLUDEPATH}
 
 CONFIG += release
 
+PGSQL_LIBS                 = -lpq
+win32-msvc*:PGSQL_LIBS     = -llibpq
+
 win32*:OPENRPTLIBEXT       = a
 win32*:XTLIBEXT            = a
 win32-msvc*:OPENRPTLIBEXT  = lib
@@ -10,17 +10,25 @@
 
 #include "loaderwindow.h"
 
+#include <QApplication>
+#include <QCloseEvent>
 #include <QDomDocument>
+#include <QElapsedTimer>
+#include <QEventLoop>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QList>
+#include <QMap>
 #include <QMessageBox>
 #include <QProcess>
 #include <QRegExp>
+#include <QSet>
 #include <QSettings>
 #include <QSqlDatabase>
 #include <QSqlError>
+#include <QTimer>
 #include <QTimerEvent>
+#include <QMenuBar>
 #include <QDateTime>
 #include <QDesktopServices>
 
@@ -28,6 +36,7 @@
 #include <cmdlinemessagehandler.h>
 #include <guimessagehandler.h>
 #include <gunzip.h>
+#include <createdbobj.h>
 #include <createfunction.h>
 #include <createtable.h>
 #include <createtrigger.h>
@@ -37,14 +46,20 @@
 #include <loadappscript.h>
 #include <loadappui.h>
 #include <loadcmd.h>
+#include <loadablepreparer.h>
 #include <loadimage.h>
 #include <loadmetasql.h>
 #include <loadpriv.h>
 #include <loadreport.h>
 #include <package.h>
+#include <pgconnection.h>
 #include <pkgschema.h>
 #include <prerequisite.h>
 #include <script.h>
+#include <scriptschedule.h>
+#include <servercapabilities.h>
+#include <sqlarray.h>
+#include <updaterledger.h>
 #include <tarfile.h>
 #include <xsqlquery.h>
 
@@ -68,6 +83,8 @@
 #include <unistd.h>
 #include <pwd.h>
 #endif
+#include <limits.h>
+#include <signal.h>
 
 extern QString _databaseURL;
 
@@ -77,7 +94,15 @@ QString LoaderWindow::_rollbackMsg(tr("<p><font color='red'>The upgrade has "
                                       "it was in when the upgrade was "
                                       "initiated.</font><br>"));
 
-class LoaderWindowPrivate
+// set by interrupted() when SIGINT or SIGTERM arrives during an update
+static volatile sig_atomic_t interruptFlag = 0;
+
+static void interrupted(int)
+{
+  interruptFlag = 1;
+}
+
+class LoaderWindowPrivate : public ScriptListener, public PgWaitListener
 {
   private:
     LoaderWindow *_p;
@@ -85,14 +110,44 @@ class LoaderWindowPrivate
   public:
     LoaderWindowPrivate(LoaderWindow *parent)
       : _p(parent),
-        handler(0)
+        handler(0),
+        ledger(0),
+        online(false),
+        onlineArg(false),
+        preparer(0),
+        schedule(0),
+        statusScript(0),
+        triggerMode(AlterTable),
+        cancelRequested(false),
+        cancelSentAt(-1),
+        closeRequested(false),
+        itemTimeout(0),
+        itemTimeoutArg(-1),
+        oldSigint(SIG_DFL),
+        oldSigterm(SIG_DFL),
+        running(false),
+        timeout(0),
+        timeoutArg(-1),
+        itemsPassed(0),
+        nextStage(0),
+        replicaLifted(false),
+        resumeAt(0),
+        stagesCommitted(0),
+        triggersOff(false)
     {
       setCmdline(false);
+      statusTimer.start();
+      qsrand(QDateTime::currentDateTime().toTime_t() ^ QCoreApplication::applicationPid());
+      Script::setListener(this);
     }
 
     ~LoaderWindowPrivate()
     {
+      Script::setListener(0);
       delete handler;
+      delete ledger;
+      delete preparer;
+      delete schedule;
     }
 
     void setCmdline(bool p)
@@ -127,14 +182,110 @@ class LoaderWindowPrivate
       return _p->tr("<p>Total elapsed time is %1h %2m %3s</p>").arg(hour).arg(min).arg(sec);
     }
 
-    int disableTriggers();
-    int enableTriggers();
+    enum TriggerMode { AlterTable, ReplicationRole };
+
+    // the schedule phases, in the order openFile() adds them
+    enum SchedulePhase { ScriptPhase, FunctionPhase, TablePhase,
+                         TriggerPhase, ViewPhase };
+
+    // keep the window alive and show where a long script has got to
+    void statementDone(Script *script, int statement, int total,
+                       int line, qint64 msecs)
+    {
+      if (msecs >= 10000)
+        handler->message(QtWarningMsg,
+                         _p->tr("<font color='orange'>The statement at line %1 "
+                                "of %2 took %3s.</font><br>")
+                         .arg(line).arg(script->filename()).arg(msecs / 1000));
+      if (script != statusScript)
+      {
+        statusScript = script;
+        statusTimer.restart();
+      }
+      if (statusTimer.elapsed() < 1000 || statement >= total)
+        return;
+      statusTimer.restart();
+      handler->message(QtDebugMsg,
+                       _p->tr("applying %1: statement %2 of %3 at line %4<br/>")
+                       .arg(script->filename()).arg(statement).arg(total).arg(line));
+      qApp->processEvents();
+    }
+
+    // cancel a statement that has run past its time or been cancelled
+    void waiting(qint64 msecs)
+    {
+      if (stopRequested() && (cancelSentAt < 0 || msecs < cancelSentAt ||
+                              msecs - cancelSentAt >= 1000))
+      {
+        QString errMsg;
+        if (PgConnection::cancel(errMsg) < 0 && DEBUG)
+          qDebug("LoaderWindowPrivate::waiting() %s", qPrintable(errMsg));
+        cancelSentAt = msecs;
+      }
+      qApp->processEvents();
+    }
+
+    bool    retryTransient(int &retries);
+    bool    stopRequested();
+    int     stop();
+    int     startItem(const QString &item);
+    void    limitStatements(bool limit);
+    void    startRun();
+    void    endRun();
+
+    int     commitStage(int &ignored);
+    bool    itemPassed();
+    void    planStages(const QString &prefix);
+    bool    skipItem(const QString &filename);
+    QString stageKey(int stage) const;
+
+    void    collectTriggers();
+    int     disableTriggers();
+    int     enableTriggers();
+    int     lockTables(const QString &prefix);
+    void    pause(int msecs);
+    QString requestedTriggerMode() const;
+    int     setReplicationRole(const QString &role);
 
     XAbstractMessageHandler *handler;
     int         dbTimerId;
+    UpdaterLedger *ledger;     // runonce scripts already applied
     bool        multitrans;
+    bool        online;        // apply in short committed batches
+    bool        onlineArg;     // -online, in addition to the package.xml
+    LoadablePreparer *preparer; // parses and encodes loadables in the background
+    ScriptSchedule *schedule;  // order in which to apply database scripts
+    Script     *statusScript;  // the script statementDone() last heard about
+    QElapsedTimer statusTimer; // limits how often statementDone() updates
     QStringList triggers;      // to be disabled and enabled
+    TriggerMode triggerMode;   // how the triggers are being suppressed
+    QString     triggerModeArg; // -triggermode overrides the package.xml
     bool        useCmdline;
+
+    bool          cancelRequested; // the Cancel Update button was pressed
+    qint64        cancelSentAt;    // when waiting() last asked the server to cancel
+    bool          closeRequested;  // the window was closed during the update
+    QString       currentItem;     // the file being applied
+    QElapsedTimer itemTimer;       // how long currentItem has been running
+    int           itemTimeout;     // milliseconds, 0 for no limit
+    int           itemTimeoutArg;  // -itemtimeout in seconds, or -1
+    void        (*oldSigint)(int);
+    void        (*oldSigterm)(int);
+    bool          running;         // sStart() is applying the package
+    QElapsedTimer runTimer;        // how long the update has been running
+    QString       stopReason;      // why the update is being stopped
+    int           timeout;         // milliseconds for the update, 0 for no limit
+    int           timeoutArg;      // -timeout in seconds, or -1
+
+    int           itemsPassed;     // items sStart() has applied or skipped
+    int           nextStage;       // the stage being applied
+    bool          replicaLifted;   // the scripts run with the replica role lifted
+    int           resumeAt;        // items committed by an earlier run
+    QList<QByteArray> stageData;   // names and digests of each stage's files
+    QList<int>    stageEnds;       // items applied by the end of each stage
+    QStringList   stageNames;
+    int           stagesCommitted; // by this run
+    bool          triggersOff;     // disableTriggers() is in effect
 };
 
 LoaderWindow::LoaderWindow(QWidget* parent, const char* name, Qt::WindowFlags fl)
@@ -175,6 +326,12 @@ void LoaderWindow::fileNew()
   // we don't actually create files here but we are using this as the
   // stub to unload and properly setup the UI to respond correctly to
   // having no package currently loaded.
+  if (_p->preparer)
+  {
+    delete _p->preparer;
+    _p->preparer = 0;
+  }
+
   if(_package != 0)
   {
     delete _package;
@@ -187,6 +344,12 @@ void LoaderWindow::fileNew()
     _files = 0;
   }
 
+  if (_p->schedule)
+  {
+    delete _p->schedule;
+    _p->schedule = 0;
+  }
+
   _pkgname->setText(tr("No Package is currently loaded."));
 
   _status->clear();
@@ -358,6 +521,26 @@ bool LoaderWindow::openFile(QString pfilename)
            _progress->maximum());
 
   _status->setEnabled(true);
+
+  QString prefix;
+  if (! _package->id().isEmpty())
+    prefix = _package->id() + "/";
+
+  QStringList schedMsgs;
+  _p->schedule = new ScriptSchedule();   // in SchedulePhase order
+  _p->schedule->addPhase(_package->_scripts);
+  _p->schedule->addPhase(_package->_functions);
+  _p->schedule->addPhase(_package->_tables);
+  _p->schedule->addPhase(_package->_triggers);
+  _p->schedule->addPhase(_package->_views);
+  if (_p->schedule->build(_files->_list, prefix, _package->name(), schedMsgs) > 0)
+  {
+    _p->handler->message(QtWarningMsg, "<h3>Checking Script Dependencies...</h3>");
+    foreach (QString msg, schedMsgs)
+      _p->handler->message(QtWarningMsg,
+                           QString("<font color='orange'>%1</font><br>").arg(msg));
+  }
+
   _p->handler->message(QtWarningMsg, "<h3>Checking Prerequisites...</h3>");
   bool allOk = true;
 
@@ -365,6 +548,7 @@ bool LoaderWindow::openFile(QString pfilename)
   XSqlQuery qry;
   if (_package->_prerequisites.size() > 0)
   {
+    Prerequisite::checkAll(_package->_prerequisites);
     foreach (Prerequisite *i, _package->_prerequisites)
     {
       _p->handler->message(QtWarningMsg, tr("checking %1<br/>").arg(i->name()));
@@ -472,7 +656,7 @@ void LoaderWindow::helpAbout()
 
 void LoaderWindow::timerEvent( QTimerEvent * e )
 {
-  if(e->timerId() == _p->dbTimerId)
+  if(e->timerId() == _p->dbTimerId && ! _p->running)
   {
     QSqlDatabase db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
     if(db.isValid())
@@ -481,15 +665,50 @@ void LoaderWindow::timerEvent( QTimerEvent * e )
   }
 }
 
+// stages an update has committed are recorded in the ledger under this
+static const QString checkpointPrefix("checkpoint/");
+
+/* Privileges and commands have no file, so in the ledger and in
+   checkpoints they are known by element, schema and name and described
+   by their own attributes.
+ */
+static QString itemKey(Loadable *item)
+{
+  if (! item->filename().isEmpty())
+    return item->filename();
+  return item->nodename() + "/" +
+         (item->schema().isEmpty() ? QString() : item->schema() + ".") +
+         item->name();
+}
+
+static QByteArray itemData(Loadable *item, const QByteArray &filedata)
+{
+  if (! item->filename().isEmpty())
+    return filedata;
+  QDomDocument doc;
+  doc.appendChild(item->createElement(doc));
+  return doc.toByteArray();
+}
+
+// used only in LoaderWindow::sStart(), to end the run however it returns
+struct runguard {
+  LoaderWindowPrivate *p;
+
+  runguard(LoaderWindowPrivate *priv) : p(priv) { p->startRun(); }
+  ~runguard() { p->endRun(); }
+};
+
 // used only in LoaderWindow::sStart()
 struct dbobj {
   QString header;
   QString footer;
   QList<Script*>   scriptlist;
   QList<Loadable*> loadablelist;
+  LoadableBulkWriter writer;
 
-  dbobj(QString h, QString s, QList<Script*>   l) : header(h), footer(s), scriptlist(l)   {}
-  dbobj(QString h, QString s, QList<Loadable*> l) : header(h), footer(s), loadablelist(l) {}
+  dbobj(QString h, QString s, QList<Script*>   l) : header(h), footer(s), scriptlist(l), writer(0)   {}
+  dbobj(QString h, QString s, QList<Loadable*> l, LoadableBulkWriter w = 0)
+    : header(h), footer(s), loadablelist(l), writer(w) {}
 };
 
 bool LoaderWindow::sStart()
@@ -497,6 +716,7 @@ bool LoaderWindow::sStart()
   bool returnValue = false;
 
   _start->setEnabled(false);
+  runguard guard(_p);
 
   QDateTime startTime = QDateTime::currentDateTime();
   QDateTime endTime = QDateTime::currentDateTime();
@@ -519,13 +739,75 @@ bool LoaderWindow::sStart()
   _p->handler->message(QtWarningMsg,
       tr("<p>Starting Update at %1</p>").arg(startTime.toString()));
 
+  if (_p->requestedTriggerMode() == "replica")
+    _p->handler->message(QtWarningMsg,
+        tr("<p><font color='orange'>The triggers will be suppressed with "
+           "the replica role. While the package's data loads this also "
+           "suppresses:<ul>"
+           "<li>the foreign key checks on every table, so rows that refer "
+           "to missing rows are not caught, now or at commit;</li>"
+           "<li>every other ordinary trigger on every table, including "
+           "the ERP's own business triggers;</li>"
+           "<li>ordinary rules.</li></ul>"
+           "Use -triggermode=altertable unless the package's data is known "
+           "to be consistent.</font></p>"));
+
+  // learn what the server can do before the transaction starts
+  QString capErr;
+  if (ServerCapabilities::probe(capErr) < 0)
+    _p->handler->message(QtDebugMsg, capErr);
+
   QString prefix = QString::null;
   if(!_package->id().isEmpty())
     prefix = _package->id() + "/";
 
+  // parse and encode loadables while the scripts are being applied
+  delete _p->preparer;
+  _p->preparer = new LoadablePreparer();
+  QList<Loadable*> preparable = _package->_metasqls + _package->_reports +
+                                _package->_appuis   + _package->_appscripts +
+                                _package->_images;
+  foreach (Loadable *i, preparable)
+    _p->preparer->add(i, _files->_list[prefix + i->filename()]);
+
+  // outside the transaction, so a rollback cannot take the tables away
+  QString stageErr;
+  if (Loadable::createStagingTables(stageErr) < 0)
+    _p->handler->message(QtDebugMsg, stageErr);
+
+  _p->online = _p->onlineArg || _package->online();
+  if (_p->online && ! _package->loadablesOnly())
+  {
+    _p->handler->message(QtWarningMsg,
+        tr("<font color='orange'>This package contains database scripts, "
+           "so it cannot be applied online. It will be applied in a "
+           "single transaction.</font><br>"));
+    _p->online = false;
+  }
+  else if (_p->online && _alwaysrollback->isChecked())
+  {
+    _p->handler->message(QtWarningMsg,
+        tr("<font color='orange'>An online update cannot be rolled back. "
+           "The package will be applied in a single transaction.</font><br>"));
+    _p->online = false;
+  }
+  if (_p->online)
+    return startOnline(startTime, prefix);
+
   XSqlQuery qry;
   qry.exec("begin;");
 
+  delete _p->ledger;
+  _p->ledger = new UpdaterLedger(_package->name(),
+                                 _package->version().toString());
+
+  if (_p->lockTables(prefix) < 0)
+  {
+    qry.exec("rollback;");
+    _p->handler->message(QtWarningMsg, _rollbackMsg);
+    return false;
+  }
+
   PkgSchema schema(_package->name(),
                    tr("Schema to hold contents of %1").arg(_package->name()));
   QString errMsg;
@@ -553,6 +835,8 @@ bool LoaderWindow::sStart()
     }
   }
 
+  _p->planStages(prefix);
+
   int ignoredErrCnt = 0;
   int tmpReturn     = 0;
 
@@ -561,16 +845,25 @@ bool LoaderWindow::sStart()
     _p->handler->message(QtWarningMsg, tr("<h3>Applying initialization scripts...</h3>"));
     foreach (Script *i, _package->_initscripts)
     {
-      _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
-      tmpReturn = applySql(i, _files->_list[prefix + i->filename()]);
-      if (tmpReturn < 0)
+      if (! _p->skipItem(i->filename()))
+      {
+        _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
+        tmpReturn = applySql(i, _files->_list[prefix + i->filename()]);
+        if (tmpReturn < 0)
+        {
+          qry.exec("ROLLBACK;");
+          _p->handler->message(QtWarningMsg, _rollbackMsg);
+          return false;
+        }
+        else
+          ignoredErrCnt += tmpReturn;
+      }
+      if (_p->itemPassed() && _p->commitStage(ignoredErrCnt) < 0)
       {
         qry.exec("ROLLBACK;");
         _p->handler->message(QtWarningMsg, _rollbackMsg);
         return false;
       }
-      else
-        ignoredErrCnt += tmpReturn;
     }
     _p->handler->message(QtWarningMsg, tr("<p>Finished initialization scripts</p>"));
     if (DEBUG)
@@ -588,16 +881,12 @@ bool LoaderWindow::sStart()
   if (_package->_privs.size() > 0)
   {
     _p->handler->message(QtWarningMsg, tr("<h3>Loading Privileges...</h3>"));
-    foreach (Loadable *i, _package->_privs)
+    if (applyStaged(_package->_privs, LoadPriv::bulkWriteToDB, prefix,
+                    ignoredErrCnt) < 0)
     {
-      tmpReturn = applyLoadable(i, _files->_list[prefix + i->filename()]);
-      if (tmpReturn < 0) {
-        qry.exec("ROLLBACK;");
-        _p->handler->message(QtWarningMsg, _rollbackMsg);
-        return false;
-      }
-      else
-        ignoredErrCnt += tmpReturn;
+      qry.exec("ROLLBACK;");
+      _p->handler->message(QtWarningMsg, _rollbackMsg);
+      return false;
     }
     _p->handler->message(QtWarningMsg, tr("<p>Finished Privileges</p>"));
     if (DEBUG)
@@ -614,26 +903,178 @@ bool LoaderWindow::sStart()
     << dbobj(tr("Loading View definitions..."),     tr("Finished View definitions"),     _package->_views)
     ;
 
-  foreach (dbobj objdesc, scriptobjs)
+  // the replica role silences every ordinary trigger, including the ones
+  // the package's own scripts rely on, so lift it while they run
+  if (_p->triggerMode == LoaderWindowPrivate::ReplicationRole &&
+      _p->setReplicationRole("DEFAULT") < 0)
+  {
+    qry.exec("ROLLBACK;");
+    _p->handler->message(QtWarningMsg, _rollbackMsg);
+    return false;
+  }
+  _p->replicaLifted = (_p->triggerMode == LoaderWindowPrivate::ReplicationRole);
+
+  // the schedule interleaves phases only when the package.xml is misordered.
+  // database objects are checked against the catalog once per phase
+  // instead of once per script
+  int  phase             = -1;
+  bool functionsCompared = false;
+  bool viewsCompared     = false;
+  QList<CreateDBObj*> unverified;
+  foreach (Script *i, _p->schedule->order())
   {
-    if (objdesc.scriptlist.size() > 0)
+    if (_p->schedule->phase(i) != phase)
     {
-      _p->handler->message(QtWarningMsg, tr("<h3>%1</h3>").arg(objdesc.header));
-      foreach(Script *i, objdesc.scriptlist)
+      if (phase >= 0)
       {
-        _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
-        tmpReturn = applySql(i, _files->_list[prefix + i->filename()]);
+        tmpReturn = verifyDeferred(unverified);
         if (tmpReturn < 0) {
           qry.exec("ROLLBACK;");
           _p->handler->message(QtWarningMsg, _rollbackMsg);
           return false;
         }
-        else
-          ignoredErrCnt += tmpReturn;
+        ignoredErrCnt += tmpReturn;
+        unverified.clear();
+        _p->handler->message(QtWarningMsg,
+                             tr("<p>%1</p>").arg(scriptobjs.at(phase).footer));
+      }
+      phase = _p->schedule->phase(i);
+      _p->handler->message(QtWarningMsg,
+                           tr("<h3>%1</h3>").arg(scriptobjs.at(phase).header));
+
+      // compare once, after the database scripts have had their say
+      if (phase == LoaderWindowPrivate::FunctionPhase && ! functionsCompared)
+      {
+        functionsCompared = true;
+        QList<QByteArray> functiondata;
+        foreach (Script *f, _package->_functions)
+          functiondata.append(_files->_list[prefix + f->filename()]);
+        tmpReturn = CreateFunction::findUnchanged(_package->_functions,
+                                                  functiondata, errMsg);
+        if (tmpReturn < 0)
+          _p->handler->message(QtWarningMsg,
+                               tr("<font color=orange>Could not compare the "
+                                  "functions with the database. All of them "
+                                  "will be replaced: %1</font><br/>")
+                               .arg(errMsg));
+        else if (tmpReturn > 0)
+          _p->handler->message(QtWarningMsg,
+                               tr("%1 of %2 function scripts are unchanged "
+                                  "and will not be replaced<br/>")
+                               .arg(tmpReturn)
+                               .arg(_package->_functions.size()));
+      }
+      else if (phase == LoaderWindowPrivate::ViewPhase && ! viewsCompared)
+      {
+        viewsCompared = true;
+        QList<QByteArray> viewdata;
+        QStringList       dependents;
+        foreach (Script *v, _package->_views)
+          viewdata.append(_files->_list[prefix + v->filename()]);
+        tmpReturn = CreateView::findUnchanged(_package->_views, viewdata,
+                                              _package->name(), dependents,
+                                              errMsg);
+        if (tmpReturn < 0)
+          _p->handler->message(QtWarningMsg,
+                               tr("<font color=orange>Could not compare the "
+                                  "views with the database. All of them "
+                                  "will be recreated: %1</font><br/>")
+                               .arg(errMsg));
+        else if (tmpReturn > 0)
+          _p->handler->message(QtWarningMsg,
+                               tr("%1 of %2 views are unchanged and will "
+                                  "not be recreated<br/>")
+                               .arg(tmpReturn)
+                               .arg(_package->_views.size()));
+        if (! dependents.isEmpty())
+          _p->handler->message(QtWarningMsg,
+                               tr("<font color=orange>These views are not in "
+                                  "the package but depend on views it "
+                                  "replaces, and may be dropped with them: "
+                                  "%1</font><br/>")
+                               .arg(dependents.join(", ")));
+      }
+    }
+    CreateDBObj *obj = dynamic_cast<CreateDBObj*>(i);
+    if (! _p->skipItem(i->filename()))
+    {
+      if (obj)
+        obj->setDeferVerify(true);
+      _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
+      tmpReturn = applySql(i, _files->_list[prefix + i->filename()]);
+      if (tmpReturn < 0) {
+        qry.exec("ROLLBACK;");
+        _p->handler->message(QtWarningMsg, _rollbackMsg);
+        return false;
+      }
+      else if (tmpReturn == 0 && obj)
+        unverified.append(obj);
+      else
+        ignoredErrCnt += tmpReturn;
+    }
+    if (_p->itemPassed())
+    {
+      // a stage's objects are checked before it is committed
+      tmpReturn = verifyDeferred(unverified);
+      unverified.clear();
+      if (tmpReturn >= 0)
+      {
+        ignoredErrCnt += tmpReturn;
+        tmpReturn = _p->commitStage(ignoredErrCnt);
+      }
+      if (tmpReturn < 0) {
+        qry.exec("ROLLBACK;");
+        _p->handler->message(QtWarningMsg, _rollbackMsg);
+        return false;
       }
-      _p->handler->message(QtWarningMsg, tr("<p>%1</p>").arg(objdesc.footer));
     }
   }
+  if (phase >= 0)
+  {
+    tmpReturn = verifyDeferred(unverified);
+    if (tmpReturn < 0) {
+      qry.exec("ROLLBACK;");
+      _p->handler->message(QtWarningMsg, _rollbackMsg);
+      return false;
+    }
+    ignoredErrCnt += tmpReturn;
+    _p->handler->message(QtWarningMsg,
+                         tr("<p>%1</p>").arg(scriptobjs.at(phase).footer));
+  }
+
+  if (_p->triggerMode == LoaderWindowPrivate::ReplicationRole &&
+      _p->setReplicationRole("replica") < 0)
+  {
+    qry.exec("ROLLBACK;");
+    _p->handler->message(QtWarningMsg, _rollbackMsg);
+    return false;
+  }
+  _p->replicaLifted = false;
+
+  // the scripts may have changed the functions the loadables call.
+  // endRun() forgets what this reads, as it includes uncommitted changes
+  if (ServerCapabilities::probe(capErr) < 0)
+    _p->handler->message(QtDebugMsg, capErr);
+
+  // find free grades for all of the reports at once rather than one by one
+  if (_package->_reports.size() > 1 && ! _package->name().isEmpty())
+  {
+    QList<QByteArray> reportdata;
+    foreach (Loadable *i, _package->_reports)
+    {
+      _p->preparer->wait(i);
+      reportdata.append(_files->_list[prefix + i->filename()]);
+    }
+    qry.exec("SAVEPOINT updaterGrades;");
+    if (LoadReport::resolveGrades(_package->_reports, reportdata,
+                                  _package->name(), errMsg) < 0)
+    {
+      _p->handler->message(QtWarningMsg,
+                           tr("<font color='orange'>%1</font><br>").arg(errMsg));
+      qry.exec("ROLLBACK TO updaterGrades;");
+    }
+    qry.exec("RELEASE SAVEPOINT updaterGrades;");
+  }
 
   QList<dbobj> loadableobjs;
   loadableobjs
@@ -641,24 +1082,20 @@ bool LoaderWindow::sStart()
     << dbobj(tr("Loading Report definitions..."),   tr("Finished Report definitions"),   _package->_reports)
     << dbobj(tr("Loading User Interface forms..."), tr("Finished User Interface forms"), _package->_appuis)
     << dbobj(tr("Loading Application scripts..."),  tr("Finished Application scripts"),  _package->_appscripts)
-    << dbobj(tr("Loading Images..."),               tr("Finished loading Images"),       _package->_images)
+    << dbobj(tr("Loading Images..."),               tr("Finished loading Images"),       _package->_images,
+             LoadImage::bulkWriteToDB)
     ;
   foreach (dbobj objdesc, loadableobjs)
   {
     if (objdesc.loadablelist.size() > 0)
     {
       _p->handler->message(QtWarningMsg, tr("<h3>%1</h3>").arg(objdesc.header));
-      foreach (Loadable *i, objdesc.loadablelist)
+      if (applyStaged(objdesc.loadablelist, objdesc.writer, prefix,
+                      ignoredErrCnt) < 0)
       {
-        _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
-        tmpReturn = applyLoadable(i, _files->_list[prefix + i->filename()]);
-        if (tmpReturn < 0) {
-          qry.exec("ROLLBACK;");
-          _p->handler->message(QtWarningMsg, _rollbackMsg);
-          return false;
-        }
-        else
-          ignoredErrCnt += tmpReturn;
+        qry.exec("ROLLBACK;");
+        _p->handler->message(QtWarningMsg, _rollbackMsg);
+        return false;
       }
       _p->handler->message(QtWarningMsg, tr("<p>%1</p>").arg(objdesc.footer));
     }
@@ -670,6 +1107,7 @@ bool LoaderWindow::sStart()
   {
     _p->handler->message(QtWarningMsg, tr("<h3>Loading Custom Commands...</h3>"));
     if (! _package->system() &&
+        _p->triggerMode == LoaderWindowPrivate::AlterTable &&
         (! qry.exec("ALTER TABLE pkgcmd DISABLE TRIGGER pkgcmdaltertrigger;") ||
          ! qry.exec("ALTER TABLE pkgcmdarg DISABLE TRIGGER pkgcmdargaltertrigger;")))
     {
@@ -677,18 +1115,27 @@ bool LoaderWindow::sStart()
       _p->handler->message(QtWarningMsg, _rollbackMsg);
       return false;
     }
+    if (applyStaged(_package->_cmds, LoadCmd::bulkWriteToDB, prefix,
+                    ignoredErrCnt) < 0)
+    {
+      qry.exec("ROLLBACK;");
+      _p->handler->message(QtWarningMsg, _rollbackMsg);
+      return false;
+    }
+    // updateCustomPrivs() rescans every command, so only call it if this
+    // package added a command privilege or changed one
+    bool privsChanged = false;
     foreach (Loadable *i, _package->_cmds)
     {
-      tmpReturn = applyLoadable(i, _files->_list[prefix + i->filename()]);
-      if (tmpReturn < 0) {
-        qry.exec("ROLLBACK;");
-        _p->handler->message(QtWarningMsg, _rollbackMsg);
-        return false;
+      LoadCmd *cmd = dynamic_cast<LoadCmd*>(i);
+      if (! cmd || cmd->privChanged())
+      {
+        privsChanged = true;
+        break;
       }
-      else
-        ignoredErrCnt += tmpReturn;
     }
-    XSqlQuery qry("SELECT updateCustomPrivs();");
+    if (privsChanged)
+      XSqlQuery qry("SELECT updateCustomPrivs();");
     _p->handler->message(QtWarningMsg, tr("<p>Finished Custom Commands</p>"));
     if (DEBUG)
       qDebug("LoaderWindow::sStart() progress %d out of %d",
@@ -701,18 +1148,19 @@ bool LoaderWindow::sStart()
     foreach (Prerequisite *i, _package->_prerequisites)
     {
       if (i->type() == Prerequisite::Dependency)
-      {
         _p->handler->message(QtDebugMsg, tr("applying dependency %1<br/>").arg(i->name()));
-        if (i->writeToDB(_package->name(), errMsg) < 0)
-        {
-          _p->handler->message(QtWarningMsg, errMsg);
-          qry.exec("rollback;");
-          _p->handler->message(QtWarningMsg, _rollbackMsg);
-          return false;
-        }
-      }
-      _progress->setValue(_progress->value() + 1);
     }
+    QStringList depErrors;
+    if (Prerequisite::writeAllToDB(_package->_prerequisites, _package->name(),
+                                   depErrors) < 0)
+    {
+      foreach (QString msg, depErrors)
+        _p->handler->message(QtWarningMsg, msg);
+      qry.exec("rollback;");
+      _p->handler->message(QtWarningMsg, _rollbackMsg);
+      return false;
+    }
+    _progress->setValue(_progress->value() + _package->_prerequisites.size());
     _p->handler->message(QtWarningMsg, tr("<p>Completed updating dependencies.</p>"));
     if (DEBUG)
       qDebug("LoaderWindow::sStart() progress %d out of %d",
@@ -731,12 +1179,21 @@ bool LoaderWindow::sStart()
     _p->handler->message(QtWarningMsg, tr("<h3>Applying final cleanup scripts...</h3>"));
     foreach (Script *i, _package->_finalscripts)
     {
-      _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
-      tmpReturn = applySql(i, _files->_list[prefix + i->filename()]);
-      if (tmpReturn < 0)
+      if (! _p->skipItem(i->filename()))
+      {
+        _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
+        tmpReturn = applySql(i, _files->_list[prefix + i->filename()]);
+        if (tmpReturn < 0)
+          return false;
+        else
+          ignoredErrCnt += tmpReturn;
+      }
+      if (_p->itemPassed() && _p->commitStage(ignoredErrCnt) < 0)
+      {
+        qry.exec("ROLLBACK;");
+        _p->handler->message(QtWarningMsg, _rollbackMsg);
         return false;
-      else
-        ignoredErrCnt += tmpReturn;
+      }
     }
     _p->handler->message(QtWarningMsg, tr("<p>Finished final cleanup</p>"));
     if (DEBUG)
@@ -746,6 +1203,11 @@ bool LoaderWindow::sStart()
 
   _progress->setValue(_progress->value() + 1);
 
+  // a finished update leaves nothing for the next run to resume
+  if (_p->ledger->forget(checkpointPrefix, errMsg) < 0)
+    _p->handler->message(QtWarningMsg,
+                         tr("<font color='orange'>%1</font><br>").arg(errMsg));
+
   if (_alwaysrollback->isChecked())
   {
     qry.exec("rollback;");
@@ -762,6 +1224,8 @@ bool LoaderWindow::sStart()
                               QMessageBox::No) == QMessageBox::Yes)
   {
     qry.exec("commit;");
+    Prerequisite::clearCache();
+    _p->stagesCommitted = 0;
     _p->handler->message(QtWarningMsg,
         tr("<h2>The Update is now complete but errors were ignored!</h2>"));
 
@@ -781,6 +1245,8 @@ bool LoaderWindow::sStart()
   else
   {
     qry.exec("commit;");
+    Prerequisite::clearCache();
+    _p->stagesCommitted = 0;
     _p->handler->message(QtWarningMsg, tr("<h2>The Update is now complete!</h2>"));
 
     endTime = QDateTime::currentDateTime();
@@ -829,18 +1295,86 @@ void LoaderWindow::setDebugPkg(bool p)
   _alwaysrollback->setEnabled(p);
 }
 
+void LoaderWindow::setTriggerMode(const QString &p)
+{
+  _p->triggerModeArg = p.toLower();
+}
+
+void LoaderWindow::setOnline(bool p)
+{
+  _p->onlineArg = p;
+}
+
+/** Set the time limits in seconds for each item and for the whole
+    update, overriding the package.xml. 0 means no limit and a negative
+    number leaves the package.xml's limit in force.
+*/
+void LoaderWindow::setTimeouts(int itemSeconds, int totalSeconds)
+{
+  _p->itemTimeoutArg = itemSeconds;
+  _p->timeoutArg     = totalSeconds;
+}
+
+void LoaderWindow::sCancel()
+{
+  if (! _p->running || _p->cancelRequested)
+    return;
+
+  _p->cancelRequested = true;
+  _cancel->setEnabled(false);
+  _p->handler->message(QtWarningMsg,
+                       tr("<font color='orange'>Cancelling the update while "
+                          "applying %1...</font><br>").arg(_p->currentItem));
+  QString errMsg;
+  if (PgConnection::cancel(errMsg) < 0 && DEBUG)
+    qDebug("LoaderWindow::sCancel() %s", qPrintable(errMsg));
+}
+
+/** The update keeps the event loop running while it waits for the
+    server, so the window can be closed in the middle of sStart(). Treat
+    that as Cancel Update instead of destroying the window under it, and
+    close once the update has rolled back.
+*/
+void LoaderWindow::closeEvent(QCloseEvent *event)
+{
+  if (_p->running)
+  {
+    _p->closeRequested = true;
+    sCancel();
+    event->ignore();
+  }
+  else
+    QMainWindow::closeEvent(event);
+}
+
 int LoaderWindow::applySql(Script *pscript, const QByteArray psql)
 {
   if (DEBUG)
     qDebug("LoaderWindow::applySql() - running script %s in file %s",
            qPrintable(pscript->name()), qPrintable(pscript->filename()));
 
+  if (pscript->runOnce() && _p->ledger &&
+      _p->ledger->contains(pscript->filename(), psql))
+  {
+    _p->handler->message(QtWarningMsg,
+        tr("Skipping %1, which has already been applied.")
+                  .arg(pscript->filename()));
+    _progress->setValue(_progress->value() + 1);
+    return 0;
+  }
+
+  if (_p->startItem(pscript->filename()) < 0)
+    return -1;
+
   XSqlQuery qry;
   bool again     = false;
+  int  retries   = 0;
   int  returnVal = 0;
   do {
     QString message;
+    again = false;
     qry.exec("SAVEPOINT updaterFile;");
+    _p->limitStatements(true);
     if (pscript->onError() == Script::Default)
       pscript->setOnError(Script::Stop);
 
@@ -861,6 +1395,13 @@ int LoaderWindow::applySql(Script *pscript, const QByteArray psql)
                     .arg(fatal ? "red" : "orange")
                     .arg(message));
       qry.exec("ROLLBACK TO updaterFile;");
+      if (_p->stopRequested())
+        return _p->stop();
+      if (_p->retryTransient(retries))
+      {
+        again = true;
+        continue;
+      }
 
       switch (pscript->onError())
       {
@@ -917,10 +1458,17 @@ int LoaderWindow::applySql(Script *pscript, const QByteArray psql)
       }
     }
     else
+    {
       _p->handler->message(QtWarningMsg,
           tr("Import of %1 was successful.").arg(pscript->filename()));
+      if (pscript->runOnce() && _p->ledger &&
+          _p->ledger->record(pscript->filename(), psql, message) < 0)
+        _p->handler->message(QtWarningMsg,
+            tr("<font color='orange'>%1</font><br>").arg(message));
+    }
   } while (again);
 
+  _p->limitStatements(false);
   qry.exec("RELEASE SAVEPOINT updaterFile;");
 
   _progress->setValue(_progress->value() + 1);
@@ -928,6 +1476,54 @@ int LoaderWindow::applySql(Script *pscript, const QByteArray psql)
   return returnVal;
 }
 
+/* Check that the database objects applied with deferred verification
+   exist. The scripts have already been released from their savepoints
+   so a missing object cannot be retried; it either stops the load or,
+   if the script's onerror allows, is reported and ignored.
+ */
+int LoaderWindow::verifyDeferred(const QList<CreateDBObj *> &objs)
+{
+  if (DEBUG)
+    qDebug("LoaderWindow::verifyDeferred() - checking %d objects", objs.size());
+
+  QList<CreateDBObj*> missing;
+  QString message;
+  int returnVal = CreateDBObj::verifyAll(objs, _package->name(), missing, message);
+  if (returnVal < 0)
+  {
+    _p->handler->message(QtWarningMsg,
+        tr("<p><font color='%1'>%2</font><br>").arg("red").arg(message));
+    return returnVal;
+  }
+
+  foreach (CreateDBObj *obj, missing)
+  {
+    bool fatal = ! (obj->onError() == Script::Ignore);
+    _p->handler->message(QtWarningMsg,
+        tr("<p><font color='%1'>%2</font><br>")
+                  .arg(fatal ? "red" : "orange")
+                  .arg(obj->notFoundMessage(_package->name())));
+
+    if (obj->onError() == Script::Prompt &&
+        _p->handler->question(tr("<pre>%1.</pre><p>Please select the action "
+                                 "that you would like to take.")
+                              .arg(obj->notFoundMessage(_package->name())),
+                              QMessageBox::Ignore|QMessageBox::Abort,
+                              QMessageBox::Abort) == QMessageBox::Ignore)
+      fatal = false;
+
+    if (fatal)
+      return -8;
+
+    _p->handler->message(QtWarningMsg,
+        tr("<font color='orange'><b>IGNORING</b> the above "
+           "errors in script %1.</font><br>").arg(obj->filename()));
+    returnVal++;
+  }
+
+  return returnVal;
+}
+
 // similar to applySql but Loadable::writeDoDB() returning -1 is a real error
 int LoaderWindow::applyLoadable(Loadable *pscript, const QByteArray psql)
 {
@@ -936,13 +1532,22 @@ int LoaderWindow::applyLoadable(Loadable *pscript, const QByteArray psql)
            qPrintable(pscript->name()), qPrintable(pscript->filename()),
            psql.data());
 
+  if (_p->preparer)
+    _p->preparer->wait(pscript);
+
+  if (_p->startItem(pscript->filename()) < 0)
+    return -1;
+
   XSqlQuery qry;
   bool again     = false;
+  int  retries   = 0;
   int  returnVal = 0;
   do {
     QString message;
+    again = false;
 
     qry.exec("SAVEPOINT updaterFile;");
+    _p->limitStatements(true);
     if (pscript->onError() == Script::Default)
       pscript->setOnError(Script::Stop);
 
@@ -955,7 +1560,14 @@ int LoaderWindow::applyLoadable(Loadable *pscript, const QByteArray psql)
                     .arg(fatal ? "red" : "orange")
                     .arg(message));
       qry.exec("ROLLBACK TO updaterFile;");
-
+      if (_p->stopRequested())
+        return _p->stop();
+      if (_p->retryTransient(retries))
+      {
+        again = true;
+        continue;
+      }
+
       switch (pscript->onError())
       {
         case Script::Stop:
@@ -1011,10 +1623,13 @@ int LoaderWindow::applyLoadable(Loadable *pscript, const QByteArray psql)
       }
     }
     else
+    {
       _p->handler->message(QtWarningMsg,
           tr("Import of %1 was successful.").arg(pscript->filename()));
+    }
   } while (again);
 
+  _p->limitStatements(false);
   qry.exec("RELEASE SAVEPOINT updaterFile;");
 
   _progress->setValue(_progress->value() + 1);
@@ -1022,7 +1637,369 @@ int LoaderWindow::applyLoadable(Loadable *pscript, const QByteArray psql)
   return returnVal;
 }
 
-int LoaderWindowPrivate::disableTriggers()
+/* Get ready to apply a package: work out the time limits, let the user
+   cancel and catch interrupts so the server is told to stop too.
+ */
+void LoaderWindowPrivate::startRun()
+{
+  int itemSeconds  = itemTimeoutArg >= 0 ? itemTimeoutArg : _p->_package->itemTimeout();
+  int totalSeconds = timeoutArg     >= 0 ? timeoutArg     : _p->_package->timeout();
+  itemTimeout = qMin(itemSeconds,  INT_MAX / 1000) * 1000;
+  timeout     = qMin(totalSeconds, INT_MAX / 1000) * 1000;
+
+  cancelRequested = false;
+  cancelSentAt    = -1;
+  closeRequested  = false;
+  currentItem     = QString();
+  stopReason      = QString();
+  interruptFlag   = 0;
+  stagesCommitted = 0;
+  itemTimer.invalidate();
+  runTimer.start();
+  running = true;
+
+  oldSigint  = signal(SIGINT,  interrupted);
+  oldSigterm = signal(SIGTERM, interrupted);
+  PgConnection::setWaitListener(this);
+  _p->menuBar()->setEnabled(false);
+  _p->_cancel->setEnabled(true);
+}
+
+void LoaderWindowPrivate::endRun()
+{
+  _p->_cancel->setEnabled(false);
+  _p->menuBar()->setEnabled(true);
+  PgConnection::setWaitListener(0);
+  signal(SIGINT,  oldSigint);
+  signal(SIGTERM, oldSigterm);
+  running = false;
+
+  // sStart() probes inside the transaction, which may have rolled back
+  ServerCapabilities::clearCache();
+
+  if (stagesCommitted > 0)
+    handler->message(QtWarningMsg,
+        _p->tr("<p><font color='red'>Only the changes made since the last "
+               "checkpoint were rolled back. The %1 stages committed before "
+               "it remain in the database. Apply the package again to "
+               "resume the update.</font></p>").arg(nextStage));
+
+  if (interruptFlag)            // let the interrupt do what it was meant to
+    raise(SIGINT);
+  else if (closeRequested)      // close once sStart() has unwound
+    QTimer::singleShot(0, _p, SLOT(close()));
+}
+
+/* Should the update stop? It should if the user cancelled it, the
+   updater was interrupted or a time limit has passed. The first reason
+   found is kept for stop() to report.
+ */
+bool LoaderWindowPrivate::stopRequested()
+{
+  if (! running)
+    return false;
+  if (! stopReason.isEmpty())
+    return true;
+
+  if (interruptFlag)
+    stopReason = _p->tr("the updater was interrupted");
+  else if (cancelRequested)
+    stopReason = _p->tr("the update was cancelled");
+  else if (itemTimeout > 0 && itemTimer.isValid() && itemTimer.elapsed() > itemTimeout)
+    stopReason = _p->tr("it ran longer than its limit of %1s")
+                   .arg(itemTimeout / 1000);
+  else if (timeout > 0 && runTimer.elapsed() > timeout)
+    stopReason = _p->tr("the update ran longer than its limit of %1s")
+                   .arg(timeout / 1000);
+
+  return ! stopReason.isEmpty();
+}
+
+// transient failures are retried this many times before onerror applies
+static const int transientRetries = 4;
+
+/* Decide whether the current item failed for a reason that goes away on
+   its own: a deadlock or a lock timeout. If so, and it has not been
+   retried too often, log the attempt, wait a little longer each time
+   with some jitter so competing sessions do not collide again, and
+   return true so the caller tries the item again after rolling back to
+   its savepoint. Only the SQLSTATE PgConnection saw is trusted;
+   startItem() clears it, so an item that failed through XSqlQuery is
+   not retried. A serialization failure is not retried either: the
+   snapshot it complains about belongs to the whole transaction, so
+   rolling back to a savepoint cannot cure it.
+ */
+bool LoaderWindowPrivate::retryTransient(int &retries)
+{
+  QString state = PgConnection::lastSqlState();
+  PgConnection::clearSqlState();        // don't let a retry see this one
+  bool transient = (state == "40P01" ||         // deadlock_detected
+                    state == "55P03");          // lock_not_available
+
+  if (! transient || retries >= transientRetries)
+    return false;
+
+  retries++;
+  int msecs = (250 << retries) + qrand() % 500;
+  handler->message(QtWarningMsg,
+      _p->tr("<font color='orange'>%1 failed because of other database "
+             "activity (%2). Trying again in %3ms (retry %4 of %5).</font><br>")
+                .arg(currentItem)
+                .arg(state)
+                .arg(msecs).arg(retries).arg(transientRetries));
+  pause(msecs);
+  return true;
+}
+
+/* Roll the update back and say which item it stopped in and why. */
+int LoaderWindowPrivate::stop()
+{
+  XSqlQuery qry;
+  qry.exec("rollback;");
+  handler->message(QtWarningMsg,
+      _p->tr("<p><font color='red'>Stopped while applying %1, %2s after it "
+             "started, because %3.</font></p>")
+                .arg(currentItem)
+                .arg(itemTimer.isValid() ? itemTimer.elapsed() / 1000 : 0)
+                .arg(stopReason));
+  handler->message(QtWarningMsg, _p->_rollbackMsg);
+  return -1;
+}
+
+/* Note the item about to be applied, or stop if the update should. */
+int LoaderWindowPrivate::startItem(const QString &item)
+{
+  if (stopRequested())
+    return stop();
+
+  currentItem  = item;
+  cancelSentAt = -1;
+  itemTimer.start();
+  PgConnection::clearSqlState();
+  return 0;
+}
+
+/* Statements sent through XSqlQuery cannot be watched while they run, so
+   while an item is applied the server is told to give up on any
+   statement that would take it past a time limit.
+ */
+void LoaderWindowPrivate::limitStatements(bool limit)
+{
+  int msecs = 0;
+  if (limit && itemTimeout > 0)
+    msecs = itemTimeout;
+  if (limit && timeout > 0)
+  {
+    int remaining = (int)qMax(qint64(1), timeout - runTimer.elapsed());
+    msecs = msecs > 0 ? qMin(msecs, remaining) : remaining;
+  }
+
+  if (limit && msecs <= 0)
+    return;
+  if (! limit && itemTimeout <= 0 && timeout <= 0)
+    return;
+
+  XSqlQuery timeoutq;
+  if (limit)
+    timeoutq.exec(QString("SET LOCAL statement_timeout TO %1;").arg(msecs));
+  else
+    timeoutq.exec("SET LOCAL statement_timeout TO DEFAULT;");
+}
+
+/* Divide the package into the stages its checkpoints declare. A stage
+   ends with the file a checkpoint follows, counted in the order sStart()
+   applies files rather than the order of the package.xml, and is
+   described by the names and digests of its files. Stages that an
+   earlier run committed and recorded in the ledger with the same
+   description are skipped; the first that differs or was never finished
+   and everything after it are applied again. The last stage needs no
+   record because the final commit ends it.
+ */
+void LoaderWindowPrivate::planStages(const QString &prefix)
+{
+  itemsPassed = 0;
+  nextStage   = 0;
+  resumeAt    = 0;
+  stageData.clear();
+  stageEnds.clear();
+  stageNames.clear();
+
+  Package *package = _p->_package;
+  if (package->_checkpoints.isEmpty())
+    return;
+  if (_p->_alwaysrollback->isChecked())
+  {
+    handler->message(QtWarningMsg,
+        _p->tr("<font color='orange'>The checkpoints will be ignored so the "
+               "update can be rolled back as requested.</font><br>"));
+    return;
+  }
+
+  QStringList files;            // in the order sStart() applies them
+  QStringList digests;
+  foreach (Script *i, package->_initscripts)
+    files.append(i->filename());
+  foreach (Loadable *i, package->_privs)
+    files.append(itemKey(i));
+  foreach (Script *i, schedule->order())
+    files.append(i->filename());
+  QList<Loadable*> loadables = package->_metasqls + package->_reports +
+                               package->_appuis   + package->_appscripts +
+                               package->_images   + package->_cmds;
+  foreach (Loadable *i, loadables)
+    files.append(itemKey(i));
+  foreach (Script *i, package->_finalscripts)
+    files.append(i->filename());
+
+  QMap<QString, QByteArray> described;  // items without files
+  foreach (Loadable *i, package->_privs + loadables)
+  {
+    if (i->filename().isEmpty())
+      described.insert(itemKey(i), itemData(i, QByteArray()));
+  }
+  foreach (QString file, files)
+    digests.append(UpdaterLedger::digest(described.contains(file)
+                                         ? described.value(file)
+                                         : _p->_files->_list.value(prefix + file)));
+
+  QMap<int, QString> ends;      // files applied by the end of a stage -> name
+  foreach (Checkpoint c, package->_checkpoints)
+  {
+    int pos = files.indexOf(c.after);
+    if (pos < 0)
+      handler->message(QtWarningMsg,
+          _p->tr("<font color='orange'>The checkpoint %1 follows %2, which "
+                 "is not in the package. It will be ignored.</font><br>")
+                    .arg(c.name).arg(c.after));
+    else if (pos + 1 < files.size())
+      ends.insert(pos + 1, c.name);
+  }
+
+  int start = 0;
+  foreach (int end, ends.keys())
+  {
+    QByteArray data;
+    for (int i = start; i < end; i++)
+      data += files.at(i).toUtf8() + "\n" + digests.at(i).toLatin1() + "\n";
+    stageData.append(data);
+    stageEnds.append(end);
+    stageNames.append(ends.value(end));
+    start = end;
+  }
+  if (stageEnds.isEmpty())
+    return;
+
+  while (nextStage < stageEnds.size() &&
+         ledger->contains(stageKey(nextStage), stageData.at(nextStage)))
+    nextStage++;
+
+  // records of later stages from an earlier run no longer describe the database
+  QString errMsg;
+  for (int i = nextStage; i < stageEnds.size(); i++)
+  {
+    if (ledger->forget(checkpointPrefix + QString("%1/").arg(i + 1), errMsg) < 0)
+      handler->message(QtWarningMsg,
+                       _p->tr("<font color='orange'>%1</font><br>").arg(errMsg));
+  }
+
+  handler->message(QtWarningMsg,
+      _p->tr("<p>The update will be applied in %1 stages and committed after "
+             "each one.</p>").arg(stageEnds.size() + 1));
+  if (nextStage > 0)
+  {
+    resumeAt = stageEnds.at(nextStage - 1);
+    handler->message(QtWarningMsg,
+        _p->tr("<p>Resuming after stage %1, which an earlier run committed. "
+               "The %2 files before it will be skipped.</p>")
+                  .arg(stageNames.at(nextStage - 1)).arg(resumeAt));
+  }
+}
+
+QString LoaderWindowPrivate::stageKey(int stage) const
+{
+  return checkpointPrefix + QString("%1/").arg(stage + 1) + stageNames.at(stage);
+}
+
+/* Skip the next file if an earlier run committed the stage it is in. */
+bool LoaderWindowPrivate::skipItem(const QString &filename)
+{
+  if (itemsPassed >= resumeAt)
+    return false;
+
+  handler->message(QtDebugMsg,
+                   _p->tr("skipping %1, which an earlier run committed<br/>")
+                   .arg(filename));
+  _p->_progress->setValue(_p->_progress->value() + 1);
+  return true;
+}
+
+/* Count a file that has been applied or skipped.
+   @return true if it ends a stage, which should now be committed
+ */
+bool LoaderWindowPrivate::itemPassed()
+{
+  itemsPassed++;
+  return nextStage < stageEnds.size() && itemsPassed == stageEnds.at(nextStage);
+}
+
+/* Commit the stage just applied, recording it in the ledger first so a
+   later run can skip it, and start the next stage in a new transaction
+   with the alter triggers suppressed again if they were. The locks taken
+   before the update started are released by the commit.
+ */
+int LoaderWindowPrivate::commitStage(int &ignored)
+{
+  QString name = stageNames.at(nextStage);
+  if (ignored > 0 &&
+      handler->question(_p->tr("<h2>One or more errors were ignored while "
+                               "processing stage %1. Are you sure you want "
+                               "to commit these changes?</h2><p>If you "
+                               "answer 'No' then this stage will be rolled "
+                               "back and the update will stop.</p>").arg(name),
+                        QMessageBox::Yes | QMessageBox::No,
+                        QMessageBox::No) != QMessageBox::Yes)
+    return -1;
+
+  bool suppressed = triggersOff;
+  if (suppressed && enableTriggers() < 0)
+    return -1;
+
+  QString errMsg;
+  if (ledger->record(stageKey(nextStage), stageData.at(nextStage), errMsg) < 0)
+    handler->message(QtWarningMsg,
+                     _p->tr("<font color='orange'>%1</font><br>").arg(errMsg));
+
+  XSqlQuery stageq;
+  stageq.exec("commit;");
+  if (stageq.lastError().type() != QSqlError::NoError)
+  {
+    handler->message(QtWarningMsg,
+        _p->tr("<font color='red'>Could not commit stage %1:"
+               "<pre>%2</pre></font><br>")
+                  .arg(name).arg(stageq.lastError().databaseText()));
+    return -1;
+  }
+  nextStage++;
+  stagesCommitted++;
+  ignored = 0;
+  handler->message(QtWarningMsg,
+      _p->tr("<p>Committed stage %1 (%2 of %3).</p>")
+                .arg(name).arg(nextStage).arg(stageEnds.size() + 1));
+
+  stageq.exec("begin;");
+  if (suppressed && disableTriggers() < 0)
+    return -1;
+  if (suppressed && replicaLifted && triggerMode == ReplicationRole &&
+      setReplicationRole("DEFAULT") < 0)
+    return -1;
+
+  return 0;
+}
+
+/* List the tables whose alter triggers must be disabled for the
+   package's loadables to be written.
+ */
+void LoaderWindowPrivate::collectTriggers()
 {
   QString schema;
 
@@ -1034,7 +2011,7 @@ int LoaderWindowPrivate::disableTriggers()
   loadables.insert("script",    _p->_package->_appscripts);
   loadables.insert("image",     _p->_package->_images);
 
-  if (_p->_package->_metasqls.size() > 0)
+  if (_p->_package->_metasqls.size() > 0 && ! triggers.contains("public.metasql"))
     triggers.append("public.metasql");
 
   foreach (QString key, loadables.keys())
@@ -1065,6 +2042,36 @@ int LoaderWindowPrivate::disableTriggers()
       triggers.append(schema + ".pkgcmdarg");
     }
   }
+}
+
+/* Return the trigger mode the package or command line asks for. The
+   replica role is only used when asked for by name, since it silences
+   far more than the alter triggers.
+ */
+QString LoaderWindowPrivate::requestedTriggerMode() const
+{
+  return triggerModeArg.isEmpty() ? _p->_package->triggerMode()
+                                  : triggerModeArg;
+}
+
+int LoaderWindowPrivate::disableTriggers()
+{
+  collectTriggers();
+
+  QString mode = requestedTriggerMode();
+  triggerMode = AlterTable;
+  if (mode == "replica")
+  {
+    if (setReplicationRole("replica") >= 0)
+    {
+      triggerMode = ReplicationRole;
+      triggersOff = true;
+      return triggers.size();
+    }
+    handler->message(QtWarningMsg,
+        _p->tr("<font color='orange'>Disabling the triggers table by "
+               "table instead.</font><br>"));
+  }
 
   QRegExp beforeDot(".*\\.");
   QString empty;
@@ -1086,11 +2093,20 @@ int LoaderWindowPrivate::disableTriggers()
     }
   }
 
+  triggersOff = true;
   return triggers.size();
 }
 
 int LoaderWindowPrivate::enableTriggers()
 {
+  if (triggerMode == ReplicationRole)
+  {
+    if (setReplicationRole("DEFAULT") < 0)
+      return -1;
+    triggersOff = false;
+    return triggers.size();
+  }
+
   QRegExp beforeDot(".*\\.");
   QString empty;
   for (int i = triggers.size() - 1; i >= 0; i--)
@@ -1111,9 +2127,240 @@ int LoaderWindowPrivate::enableTriggers()
     }
   }
 
+  triggersOff = false;
   return triggers.size();
 }
 
+// how often and how long lockTables() tries for each table
+static const int lockAttempts = 5;
+static const int lockTimeout  = 5000;   // milliseconds
+
+/* Take the strong locks the package will need before it changes anything,
+   so waiting for ERP users happens up front instead of part way through
+   and the update cannot deadlock with them later. The tables are those
+   whose alter triggers are disabled with ALTER TABLE and the tables the
+   package's scripts alter, drop, truncate, index or add triggers to. Each
+   is locked only as strongly as the strongest statement on it needs (see
+   ScriptSchedule::lockedTables()), so adding an index does not shut ERP
+   users out of reading the table. They are locked in name order, each
+   with a lock_timeout (or NOWAIT before 9.3). If any cannot be had, every
+   lock taken is let go and the whole set is tried again after a pause.
+   A failure for any other reason leaves the update to take its locks as
+   it goes.
+
+   @return the number of tables locked or a negative number if the user
+           chose to abort
+ */
+int LoaderWindowPrivate::lockTables(const QString &prefix)
+{
+  if (! PgConnection::handle())
+    return 0;
+
+  QString                pkgname = _p->_package->name().toLower();
+  QMap<QString, QString> names;         // table -> lock mode
+
+  if (requestedTriggerMode() != "replica")
+  {
+    // ALTER TABLE ... DISABLE TRIGGER needs less than ALTER TABLE since 9.5
+    QString mode = ServerCapabilities::serverVersion() >= 90500
+                   ? "SHARE ROW EXCLUSIVE" : "ACCESS EXCLUSIVE";
+    collectTriggers();
+    foreach (QString table, triggers)
+    {
+      QString name = table.contains(".") ? table.toLower()
+                                         : pkgname + "." + table.toLower();
+      names.insert(name, ScriptSchedule::strongerLock(names.value(name), mode));
+    }
+  }
+
+  QList<Script*> scripts = _p->_package->_initscripts + _p->_package->_scripts +
+                           _p->_package->_tables      + _p->_package->_triggers;
+  foreach (Script *s, scripts)
+  {
+    QMap<QString, QString> locked =
+      ScriptSchedule::lockedTables(_p->_files->_list[prefix + s->filename()]);
+    QMap<QString, QString>::const_iterator it;
+    for (it = locked.constBegin(); it != locked.constEnd(); ++it)
+    {
+      QStringList candidates(it.key());
+      if (! it.key().contains(".") && ! pkgname.isEmpty())
+        candidates.append(pkgname + "." + it.key()); // the package schema is first
+      foreach (QString name, candidates)
+        names.insert(name, ScriptSchedule::strongerLock(names.value(name),
+                                                        it.value()));
+    }
+  }
+
+  if (names.isEmpty())
+    return 0;
+
+  QStringList schemas;
+  QStringList relnames;
+  QStringList modes;
+  QMap<QString, QString>::const_iterator it;
+  for (it = names.constBegin(); it != names.constEnd(); ++it)
+  {
+    int dot = it.key().indexOf(".");
+    schemas.append(dot < 0 ? QString("") : it.key().left(dot));
+    relnames.append(it.key().mid(dot + 1));
+    modes.append(it.value());
+  }
+
+  XSqlQuery tableq;
+  tableq.prepare("SELECT quote_ident(nspname) || '.' ||"
+                 "       quote_ident(relname) AS name, wanted.mode"
+                 "  FROM (SELECT schemas[i] AS schema, names[i] AS name,"
+                 "               modes[i] AS mode"
+                 "          FROM " +
+                 sqlArrayRows(QStringList() << "schemas TEXT[]"
+                                            << "names TEXT[]"
+                                            << "modes TEXT[]") +
+                 ") AS wanted"
+                 "  JOIN pg_class ON (lower(relname)=wanted.name AND relkind='r')"
+                 "  JOIN pg_namespace ON (relnamespace=pg_namespace.oid)"
+                 " WHERE (wanted.schema='' AND pg_table_is_visible(pg_class.oid))"
+                 "    OR lower(nspname)=wanted.schema"
+                 " ORDER BY nspname, relname;");
+  tableq.bindValue(":schemas", toSqlArray(schemas));
+  tableq.bindValue(":names",   toSqlArray(relnames));
+  tableq.bindValue(":modes",   toSqlArray(modes));
+  tableq.exec();
+  QStringList            tables;        // in lock order
+  QMap<QString, QString> tableModes;
+  while (tableq.next())
+  {
+    QString table = tableq.value("name").toString();
+    if (! tableModes.contains(table))
+      tables.append(table);
+    tableModes.insert(table,
+                      ScriptSchedule::strongerLock(tableModes.value(table),
+                                                   tableq.value("mode").toString()));
+  }
+  if (tableq.lastError().type() != QSqlError::NoError)
+  {
+    handler->message(QtWarningMsg,
+        _p->tr("<font color='orange'>Could not find the tables to lock "
+               "before starting:<pre>%1</pre></font><br>")
+                  .arg(tableq.lastError().databaseText()));
+    return 0;
+  }
+  if (tables.isEmpty())
+    return 0;
+
+  bool timeout = ServerCapabilities::serverVersion() >= 90300;
+  for (int attempt = 1; ; attempt++)
+  {
+    QString errMsg;
+    QString sqlState;
+    QString failed;
+    tableq.exec("SAVEPOINT updaterLocks;");
+    if (timeout)
+      tableq.exec(QString("SET LOCAL lock_timeout TO %1;").arg(lockTimeout));
+    foreach (QString table, tables)
+    {
+      QByteArray lock = QString("LOCK TABLE %1 IN %2 MODE%3;")
+                          .arg(table, tableModes.value(table),
+                               timeout ? "" : " NOWAIT").toUtf8();
+      if (PgConnection::exec(lock, QByteArray(), errMsg, 0, &sqlState) < 0)
+      {
+        failed = table;
+        break;
+      }
+    }
+
+    if (failed.isEmpty())
+    {
+      if (timeout)
+        tableq.exec("SET LOCAL lock_timeout TO DEFAULT;");
+      tableq.exec("RELEASE SAVEPOINT updaterLocks;");
+      handler->message(QtWarningMsg,
+          _p->tr("Locked %1 tables before starting.").arg(tables.size()));
+      return tables.size();
+    }
+
+    tableq.exec("ROLLBACK TO updaterLocks;");
+    tableq.exec("RELEASE SAVEPOINT updaterLocks;");
+
+    if (sqlState != "55P03")    // lock_not_available
+    {
+      handler->message(QtWarningMsg,
+          _p->tr("<font color='orange'>Could not lock %1 before starting. "
+                 "Tables will be locked as the update needs them:"
+                 "<pre>%2</pre></font><br>").arg(failed).arg(errMsg));
+      return 0;
+    }
+
+    if (attempt < lockAttempts)
+    {
+      int msecs = (1000 << (attempt - 1)) + qrand() % 1000;
+      handler->message(QtWarningMsg,
+          _p->tr("<font color='orange'>%1 is in use. Trying again in "
+                 "%2s (attempt %3 of %4).</font><br>")
+                    .arg(failed).arg((msecs + 500) / 1000)
+                    .arg(attempt + 1).arg(lockAttempts));
+      pause(msecs);
+      continue;
+    }
+
+    switch (handler->question(
+              _p->tr("<p>%1 has been in use by other database sessions for "
+                     "every one of %2 attempts to lock it. Nothing has been "
+                     "changed yet.</p><p>Retry, continue and wait for the "
+                     "tables as the update needs them, or abort?</p>")
+                .arg(failed).arg(lockAttempts),
+              QMessageBox::Retry | QMessageBox::Ignore | QMessageBox::Abort,
+              QMessageBox::Abort))
+    {
+      case QMessageBox::Retry:
+        attempt = 0;
+        break;
+      case QMessageBox::Ignore:
+        return 0;
+      case QMessageBox::Abort:
+      default:
+        return -1;
+    }
+  }
+}
+
+/* Wait without freezing the window, so the update can still be cancelled. */
+void LoaderWindowPrivate::pause(int msecs)
+{
+  QEventLoop loop;
+  QTimer::singleShot(msecs, &loop, SLOT(quit()));
+  loop.exec();
+}
+
+/* Switching session_replication_role to replica stops ordinary triggers
+   from firing on every table for the rest of the transaction without
+   the ACCESS EXCLUSIVE lock ALTER TABLE ... DISABLE TRIGGER takes on each
+   one, so ERP users are not blocked while the package loads. Foreign
+   keys are enforced by triggers too, so rows written in replica mode are
+   not checked against the tables they refer to, and nothing checks them
+   later. It needs superuser privileges, so a failure leaves the
+   transaction usable and is reported to let the caller fall back.
+ */
+int LoaderWindowPrivate::setReplicationRole(const QString &role)
+{
+  XSqlQuery roleq;
+  roleq.exec("SAVEPOINT updaterTriggers;");
+  roleq.exec(QString("SET LOCAL session_replication_role TO %1;").arg(role));
+  if (roleq.lastError().type() != QSqlError::NoError)
+  {
+    handler->message(QtWarningMsg,
+        _p->tr("<br><font color='orange'>Could not set the session "
+               "replication role to %1:<pre>%2</pre></font><br>")
+                  .arg(role)
+                  .arg(roleq.lastError().text()));
+    roleq.exec("ROLLBACK TO updaterTriggers;");
+    roleq.exec("RELEASE SAVEPOINT updaterTriggers;");
+    return -1;
+  }
+  roleq.exec("RELEASE SAVEPOINT updaterTriggers;");
+
+  return 0;
+}
+
 void LoaderWindow::setWindowTitle()
 {
   QString name;
@@ -1150,9 +2397,15 @@ void LoaderWindow::setWindowTitle()
 void LoaderWindow::logUpdate(QDateTime startTime, QDateTime endTime)
 {
   XSqlQuery _q;
-  _q.exec("SELECT EXISTS(SELECT relname FROM pg_class JOIN pg_namespace ON relnamespace=pg_namespace.oid WHERE relname='updaterhist' AND pg_namespace.nspname='public');" );
-  if (_q.first())
-    if(_q.value(0).toBool())
+  bool found = false;
+  if (ServerCapabilities::isKnown())
+    found = ServerCapabilities::hasTable("public", "updaterhist");
+  else
+  {
+    _q.exec("SELECT EXISTS(SELECT relname FROM pg_class JOIN pg_namespace ON relnamespace=pg_namespace.oid WHERE relname='updaterhist' AND pg_namespace.nspname='public');" );
+    found = _q.first() && _q.value(0).toBool();
+  }
+  if (found)
     {
       QString osUser = NULL;
 
@@ -1218,3 +2471,369 @@ void LoaderWindow::logUpdate(QDateTime startTime, QDateTime endTime)
       _q.exec();
     }
 }
+
+// online updates commit after this many items
+static const int onlineBatchSize = 25;
+
+// online progress is kept in the updater ledger under this file prefix
+static const QString onlinePrefix("online/");
+
+/* Apply a package that holds only loadables in a series of short
+   transactions instead of one long one, so ERP users are held up for at
+   most one batch at a time. The alter triggers are suppressed batch by
+   batch, with ALTER TABLE unless the package or command line asks for
+   the replica role. Each item is recorded in the updater ledger in the
+   transaction that writes it; if the run stops part way, the next run
+   of the same package skips the items already committed, and the
+   entries are removed when a run completes.
+ */
+bool LoaderWindow::startOnline(QDateTime startTime, const QString &prefix)
+{
+  QString stopMsg(tr("<p><font color='red'>The online update has stopped. "
+                     "The batches committed before the error remain in the "
+                     "database. Apply the package again to finish the "
+                     "update.</font></p>"));
+
+  _p->handler->message(QtWarningMsg,
+      tr("<p>Applying the package online. Changes are committed every "
+         "%1 items.</p>").arg(onlineBatchSize));
+
+  delete _p->ledger;
+  _p->ledger = new UpdaterLedger(_package->name(),
+                                 _package->version().toString());
+
+  XSqlQuery qry;
+  QString   errMsg;
+  qry.exec("begin;");
+
+  PkgSchema schema(_package->name(),
+                   tr("Schema to hold contents of %1").arg(_package->name()));
+  if (! _package->name().isEmpty())
+  {
+    if (_package->writeToDB(errMsg) >= 0)
+      _p->handler->message(QtWarningMsg, tr("Saving Package Header was successful."));
+    else
+    {
+      _p->handler->message(QtWarningMsg, errMsg);
+      qry.exec("rollback;");
+      _p->handler->message(QtWarningMsg, stopMsg);
+      return false;
+    }
+
+    if (schema.create(errMsg) >= 0 && schema.setPath(errMsg) >= 0)
+      _p->handler->message(QtWarningMsg, tr("Saving Schema for Package was successful."));
+    else
+    {
+      _p->handler->message(QtWarningMsg, errMsg);
+      qry.exec("rollback;");
+      _p->handler->message(QtWarningMsg, stopMsg);
+      return false;
+    }
+  }
+
+  if (_package->_prerequisites.size() > 0)
+  {
+    QStringList depErrors;
+    if (Prerequisite::writeAllToDB(_package->_prerequisites, _package->name(),
+                                   depErrors) < 0)
+    {
+      foreach (QString msg, depErrors)
+        _p->handler->message(QtWarningMsg, msg);
+      qry.exec("rollback;");
+      _p->handler->message(QtWarningMsg, stopMsg);
+      return false;
+    }
+    _progress->setValue(_progress->value() + _package->_prerequisites.size());
+    _p->handler->message(QtWarningMsg, tr("<p>Completed updating dependencies.</p>"));
+  }
+
+  if (_package->_reports.size() > 1 && ! _package->name().isEmpty())
+  {
+    QList<QByteArray> reportdata;
+    foreach (Loadable *i, _package->_reports)
+    {
+      _p->preparer->wait(i);
+      reportdata.append(_files->_list[prefix + i->filename()]);
+    }
+    qry.exec("SAVEPOINT updaterGrades;");
+    if (LoadReport::resolveGrades(_package->_reports, reportdata,
+                                  _package->name(), errMsg) < 0)
+    {
+      _p->handler->message(QtWarningMsg,
+                           tr("<font color='orange'>%1</font><br>").arg(errMsg));
+      qry.exec("ROLLBACK TO updaterGrades;");
+    }
+    qry.exec("RELEASE SAVEPOINT updaterGrades;");
+  }
+  qry.exec("commit;");
+
+  QList<dbobj> loadableobjs;
+  loadableobjs
+    << dbobj(tr("Loading Privileges..."),           tr("Finished Privileges"),           _package->_privs,
+             LoadPriv::bulkWriteToDB)
+    << dbobj(tr("Loading MetaSQL statements..."),   tr("Finished MetaSQL statements"),   _package->_metasqls)
+    << dbobj(tr("Loading Report definitions..."),   tr("Finished Report definitions"),   _package->_reports)
+    << dbobj(tr("Loading User Interface forms..."), tr("Finished User Interface forms"), _package->_appuis)
+    << dbobj(tr("Loading Application scripts..."),  tr("Finished Application scripts"),  _package->_appscripts)
+    << dbobj(tr("Loading Images..."),               tr("Finished loading Images"),       _package->_images,
+             LoadImage::bulkWriteToDB)
+    << dbobj(tr("Loading Custom Commands..."),      tr("Finished Custom Commands"),      _package->_cmds,
+             LoadCmd::bulkWriteToDB)
+    ;
+
+  int batches = 0;
+  foreach (dbobj objdesc, loadableobjs)
+  {
+    if (objdesc.loadablelist.isEmpty())
+      continue;
+
+    _p->handler->message(QtWarningMsg, tr("<h3>%1</h3>").arg(objdesc.header));
+    for (int start = 0; start < objdesc.loadablelist.size(); start += onlineBatchSize)
+    {
+      QList<Loadable*> batch;
+      foreach (Loadable *i, objdesc.loadablelist.mid(start, onlineBatchSize))
+      {
+        if (_p->ledger->contains(onlinePrefix + itemKey(i),
+                                 itemData(i, _files->_list[prefix + i->filename()])))
+        {
+          _p->handler->message(QtWarningMsg,
+              tr("Skipping %1, which an earlier online update committed.")
+                        .arg(itemKey(i)));
+          _progress->setValue(_progress->value() + 1);
+        }
+        else
+          batch.append(i);
+      }
+      if (batch.isEmpty())
+        continue;
+
+      if (applyOnlineBatch(batch, objdesc.writer, prefix) < 0)
+      {
+        _p->handler->message(QtWarningMsg, stopMsg);
+        return false;
+      }
+      batches++;
+      _p->handler->message(QtDebugMsg,
+                           tr("committed batch %1<br/>").arg(batches));
+      qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
+    _p->handler->message(QtWarningMsg, tr("<p>%1</p>").arg(objdesc.footer));
+  }
+
+  bool privsChanged = false;
+  foreach (Loadable *i, _package->_cmds)
+  {
+    LoadCmd *cmd = dynamic_cast<LoadCmd*>(i);
+    if (! cmd || cmd->privChanged())
+    {
+      privsChanged = true;
+      break;
+    }
+  }
+
+  qry.exec("begin;");
+  if (privsChanged)
+    qry.exec("SELECT updateCustomPrivs();");
+  if (_p->ledger->forget(onlinePrefix, errMsg) < 0)
+    _p->handler->message(QtWarningMsg,
+                         tr("<font color='orange'>%1</font><br>").arg(errMsg));
+  qry.exec("commit;");
+  Prerequisite::clearCache();
+
+  QDateTime endTime = QDateTime::currentDateTime();
+  _p->handler->message(QtWarningMsg, tr("<h2>The Update is now complete!</h2>"));
+  _p->handler->message(QtWarningMsg,
+      tr("<p>Completed Update at %1</p>").arg(endTime.toString()));
+  _p->handler->message(QtWarningMsg, _p->elapsedTime(startTime, endTime));
+  _progress->setValue(_progress->maximum());
+
+  if (_p->useCmdline)
+  {
+    fileExit();       // need this so the app will quit its event loop
+    logUpdate(startTime, endTime);
+    return true;
+  }
+
+  if (! _package->system() && schema.clearPath(errMsg) < 0)
+    _p->handler->message(QtWarningMsg,
+        tr("<p><font color='orange'>The update completed "
+                     "successfully but there was an error resetting "
+                     "the schema path:</font></p><pre>%1</pre>"
+                     "<p>Quit the updater and start it "
+                     "again if you want to apply another update.</p>"));
+
+  logUpdate(startTime, endTime);
+  return true;
+}
+
+/* Write one batch of an online update in its own transaction and record
+   its items in the ledger before committing. If errors were ignored the
+   user decides whether to keep the batch, as for a whole package.
+ */
+int LoaderWindow::applyOnlineBatch(QList<Loadable *> batch,
+                                   LoadableBulkWriter writer,
+                                   const QString &prefix)
+{
+  XSqlQuery qry;
+  qry.exec("begin;");
+  if (_p->disableTriggers() < 0)
+  {
+    qry.exec("rollback;");
+    return -1;
+  }
+
+  int ignored = 0;
+  if (writer && batch.size() > 1)
+    ignored = applyBulk(batch, writer, prefix);
+  else
+  {
+    foreach (Loadable *i, batch)
+    {
+      _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(i->filename()));
+      int result = applyLoadable(i, _files->_list[prefix + i->filename()]);
+      if (result < 0)
+        return result;          // applyLoadable() has rolled back
+      ignored += result;
+    }
+  }
+  if (ignored < 0)
+    return ignored;
+
+  // an item whose errors were ignored was not written, so if any were
+  // the whole batch is left for the next run to try again
+  QString errMsg;
+  foreach (Loadable *i, batch)
+  {
+    if (ignored == 0 &&
+        _p->ledger->record(onlinePrefix + itemKey(i),
+                           itemData(i, _files->_list[prefix + i->filename()]),
+                           errMsg) < 0)
+      _p->handler->message(QtWarningMsg,
+                           tr("<font color='orange'>%1</font><br>").arg(errMsg));
+  }
+
+  if (_p->enableTriggers() < 0)
+  {
+    qry.exec("rollback;");
+    return -1;
+  }
+
+  if (ignored > 0 &&
+      _p->handler->question(tr("<h2>One or more errors were ignored while "
+                               "processing this batch. Are you sure you "
+                               "want to commit these changes?</h2><p>If you "
+                               "answer 'No' then this batch will be rolled "
+                               "back and the update will stop.</p>"),
+                            QMessageBox::Yes | QMessageBox::No,
+                            QMessageBox::No) != QMessageBox::Yes)
+  {
+    qry.exec("rollback;");
+    return -1;
+  }
+
+  qry.exec("commit;");
+  return ignored;
+}
+
+/* Write a whole list of loadables with one call to the bulk writer.
+   If that fails for any reason, undo it and apply the loadables one at a
+   time so each gets its own error message and onError handling.
+ */
+int LoaderWindow::applyBulk(QList<Loadable *> list, LoadableBulkWriter writer,
+                            const QString &prefix)
+{
+  QList<QByteArray> data;
+  foreach (Loadable *i, list)
+  {
+    if (_p->preparer)
+      _p->preparer->wait(i);
+    data.append(_files->_list[prefix + i->filename()]);
+  }
+
+  if (_p->startItem(list.size() > 1 ? tr("%1 and %2 more").arg(list.first()->filename())
+                                                           .arg(list.size() - 1)
+                                     : list.first()->filename()) < 0)
+    return -1;
+
+  XSqlQuery qry;
+  QString   errMsg;
+  qry.exec("SAVEPOINT updaterBulk;");
+  _p->limitStatements(true);
+  int bulkreturn = writer(list, data, _package->name(), errMsg);
+  _p->limitStatements(false);
+  if (bulkreturn >= 0)
+  {
+    qry.exec("RELEASE SAVEPOINT updaterBulk;");
+    foreach (Loadable *i, list)
+    {
+      _p->handler->message(QtWarningMsg,
+          tr("Import of %1 was successful.").arg(i->filename()));
+      _progress->setValue(_progress->value() + 1);
+    }
+    return 0;
+  }
+
+  if (DEBUG)
+    qDebug("LoaderWindow::applyBulk() falling back to one at a time: %s",
+           qPrintable(errMsg));
+  qry.exec("ROLLBACK TO updaterBulk;");
+  qry.exec("RELEASE SAVEPOINT updaterBulk;");
+  if (_p->stopRequested())
+    return _p->stop();
+
+  int ignored = 0;
+  for (int i = 0; i < list.size(); i++)
+  {
+    _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(list.at(i)->filename()));
+    int result = applyLoadable(list.at(i), data.at(i));
+    if (result < 0)
+      return result;
+    ignored += result;
+  }
+
+  return ignored;
+}
+
+/* Apply a list of loadables, skipping those in stages an earlier run
+   committed and committing each stage that ends part way through. The
+   files of each stage are written with the bulk writer if there is one.
+ */
+int LoaderWindow::applyStaged(QList<Loadable *> list, LoadableBulkWriter writer,
+                              const QString &prefix, int &ignored)
+{
+  QList<Loadable*> pending;
+  for (int i = 0; i < list.size(); i++)
+  {
+    if (! _p->skipItem(list.at(i)->filename()))
+      pending.append(list.at(i));
+    bool stageEnds = _p->itemPassed();
+
+    if ((stageEnds || i == list.size() - 1) && ! pending.isEmpty())
+    {
+      if (writer && pending.size() > 1)
+      {
+        int result = applyBulk(pending, writer, prefix);
+        if (result < 0)
+          return result;
+        ignored += result;
+      }
+      else
+      {
+        foreach (Loadable *l, pending)
+        {
+          _p->handler->message(QtDebugMsg, tr("applying %1<br/>").arg(l->filename()));
+          int result = applyLoadable(l, _files->_list[prefix + l->filename()]);
+          if (result < 0)
+            return result;
+          ignored += result;
+        }
+      }
+      pending.clear();
+    }
+
+    if (stageEnds && _p->commitStage(ignored) < 0)
+      return -1;
+  }
+
+  return 0;
+}
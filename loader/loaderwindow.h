@@ -11,6 +11,7 @@
 #ifndef LOADERWINDOW_H
 #define LOADERWINDOW_H
 
+class CreateDBObj;
 class Loadable;
 class Package;
 class Script;
@@ -18,6 +19,8 @@ class TarFile;
 
 #include <QMainWindow>
 
+#include <loadable.h>
+
 #include "ui_loaderwindow.h"
 
 class LoaderWindowPrivate;
@@ -42,9 +45,13 @@ public slots:
 
     virtual void setCmdline(bool);
     virtual void setDebugPkg(bool);
+    virtual void setTriggerMode(const QString &);
+    virtual void setOnline(bool);
+    virtual void setTimeouts(int itemSeconds, int totalSeconds);
     virtual bool openFile(QString filename);
     virtual void setWindowTitle();
     virtual bool sStart();
+    virtual void sCancel();
 
 protected:
     Package * _package;
@@ -56,7 +63,13 @@ protected:
 
     virtual int  applySql(Script *, const QByteArray);
     virtual int  applyLoadable(Loadable *, const QByteArray);
+    virtual int  applyBulk(QList<Loadable *>, LoadableBulkWriter, const QString &prefix);
+    virtual int  applyStaged(QList<Loadable *>, LoadableBulkWriter, const QString &prefix, int &ignored);
+    virtual int  applyOnlineBatch(QList<Loadable *>, LoadableBulkWriter, const QString &prefix);
+    virtual bool startOnline(QDateTime startTime, const QString &prefix);
+    virtual int  verifyDeferred(const QList<CreateDBObj *> &);
     virtual void launchBrowser(QWidget *w, const QString &url);
+    virtual void closeEvent(QCloseEvent *event);
     virtual void timerEvent( QTimerEvent * e );
     virtual void logUpdate(QDateTime startTime, QDateTime endTime);
 
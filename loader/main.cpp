@@ -21,7 +21,11 @@
 #include <xsqlquery.h>
 
 #include "data.h"
+#include "loadable.h"
 #include "loaderwindow.h"
+#include "prerequisite.h"
+#include "script.h"
+#include "servercapabilities.h"
 #include "xabstractmessagehandler.h"
 
 QString _databaseURL = "";
@@ -34,12 +38,16 @@ int main(int argc, char* argv[])
   QString passwd;
   QString pkgfile;
   QString port;
+  QString triggermode;
   QString username;
   XAbstractMessageHandler *handler;
   bool    autoRunArg      = false;
   bool    autoRunCheck    = false;
   bool    debugpkg        = false;
   bool    haveDatabaseURL = false;
+  bool    online          = false;
+  int     itemtimeout     = -1;
+  int     timeout         = -1;
   bool    acceptDefaults  = false;
 
   QApplication app(argc, argv);
@@ -64,8 +72,19 @@ int main(int argc, char* argv[])
                  " [ -passwd=databasePassword ]"
                  " [ -debug ]"
                  " [ -file=updaterFile.gz | -f updaterFile.gz ]"
-                 " [ -autorun [ -D ] ]",
+                 " [ -autorun [ -D ] ]"
+                 " [ -triggermode=altertable|replica ]"
+                 " [ -chunkthreshold=megabytes ]"
+                 " [ -sourceencoding=UTF8|WIN1252|... ]"
+                 " [ -online ]"
+                 " [ -itemtimeout=seconds ] [ -timeout=seconds ]"
+                 " [ -prereqtimeout=seconds ]",
                  argv[0]);
+        qWarning("-triggermode=replica suppresses every ordinary trigger and "
+                 "rule in the session, not just the alter triggers: foreign "
+                 "key checks and the ERP's business triggers do not run for "
+                 "the rows the package loads. Use -triggermode=altertable "
+                 "unless the package's data is known to be consistent.");
         return 0;
       }
       else if (argument.startsWith("-databaseURL=", Qt::CaseInsensitive))
@@ -119,11 +138,48 @@ int main(int argc, char* argv[])
       {
         acceptDefaults = true;
       }
+      else if (argument.startsWith("-triggermode=", Qt::CaseInsensitive))
+      {
+        triggermode = argument.right(argument.size() - argument.indexOf("=") - 1);
+      }
+      else if (argument.startsWith("-itemtimeout=", Qt::CaseInsensitive))
+      {
+        itemtimeout = argument.right(argument.size() - argument.indexOf("=") - 1).toInt();
+      }
+      else if (argument.startsWith("-timeout=", Qt::CaseInsensitive))
+      {
+        timeout = argument.right(argument.size() - argument.indexOf("=") - 1).toInt();
+      }
+      else if (argument.startsWith("-prereqtimeout=", Qt::CaseInsensitive))
+      {
+        int seconds = argument.right(argument.size() - argument.indexOf("=") - 1).toInt();
+        Prerequisite::setQueryTimeout(qMax(seconds, 0));
+      }
+      else if (argument.toLower() == "-online")
+      {
+        online = true;
+      }
+      else if (argument.startsWith("-chunkthreshold=", Qt::CaseInsensitive))
+      {
+        int megabytes = argument.right(argument.size() - argument.indexOf("=") - 1).toInt();
+        Loadable::setChunkThreshold(megabytes > 0 ? qMin(megabytes, 2047) * 1024 * 1024 : 0);
+      }
+      else if (argument.startsWith("-sourceencoding=", Qt::CaseInsensitive))
+      {
+        QString encoding = argument.right(argument.size() - argument.indexOf("=") - 1);
+        if (! Script::setSourceEncoding(encoding) ||
+            ! Loadable::setSourceEncoding(encoding))
+          qWarning("%s is not a known encoding name; ignoring it",
+                   qPrintable(encoding));
+      }
     }
   }
 
   LoaderWindow * mainwin = new LoaderWindow();
   mainwin->setDebugPkg(debugpkg);
+  mainwin->setTriggerMode(triggermode);
+  mainwin->setOnline(online);
+  mainwin->setTimeouts(itemtimeout, timeout);
   mainwin->setCmdline(autoRunArg);
   handler = mainwin->handler();
   handler->setAcceptDefaults(autoRunArg && acceptDefaults);
@@ -207,6 +263,11 @@ int main(int argc, char* argv[])
       return 4;
   }
 
+  // ask the server once what it can do; the writers fall back to
+  // finding out for themselves if this fails
+  QString capErr;
+  ServerCapabilities::probe(capErr);
+
   if (! pkgfile.isEmpty())
   {
     autoRunCheck = mainwin->openFile(pkgfile);